@@ -0,0 +1,559 @@
+/*
+    Title:  PolyHeap.cpp - Analyse a heap snapshot
+
+    Copyright (c) 2019 David C.J. Matthews
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License version 2.1 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+/*
+This is a stand-alone program that reads a heap snapshot written by
+PolyML.heapSnapshot and reports where the memory is going.  It does not
+need any part of the Poly/ML run-time system and can be built with
+    c++ -O2 -o polyheap PolyHeap.cpp
+The snapshot must be analysed on a machine with the same byte order as
+the one that wrote it.
+
+The snapshot is a graph with a single artificial root node that points to
+all the roots.  We compute the dominator tree of this graph using the
+Lengauer-Tarjan algorithm.  The retained size of an object is the total size
+of the objects that it dominates i.e. the memory that would be freed if
+it were no longer reachable.
+
+Objects are classified into types.  Code objects and closures use the name
+of the function.  If the snapshot was taken with allocation profiling on
+(PolyML.Profiling.ProfileAllocations) ordinary cells carry a pointer to
+the allocating function and that is used.  Otherwise cells are classified
+by their kind and length.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+
+#include "../polyheapsnapshot.h"
+
+typedef uint32_t NodeId;
+
+class HeapGraph
+{
+public:
+    HeapGraph(): addrSize(0), lengthSize(0) {}
+
+    bool ReadSnapshot(FILE *f);
+    void BuildGraph(void);
+    void ComputeDominators(void);
+    void ComputeRetained(void);
+    void Report(unsigned topN);
+
+private:
+    bool ReadWord(FILE *f, uint64_t &w);
+    NodeId FindNode(uint64_t addr);
+    std::string TypeName(NodeId n);
+    uint64_t ObjectBytes(NodeId n)
+        { return ((lengths[n] & POLY_SNAP_LENGTH_MASK(lengthSize)) + 1) * lengthSize; }
+    unsigned Flags(NodeId n) { return POLY_SNAP_FLAGS(lengths[n], lengthSize); }
+
+    unsigned addrSize, lengthSize;
+
+    // The objects in the order they were read.  The root node is added at the end.
+    std::vector<uint64_t> addrs, lengths;
+    // References from each object as addresses.  Converted to node ids.
+    std::vector<uint64_t> refStart, refAddrs;
+    std::vector<uint64_t> rootAddrs;
+    // Names of code objects, indexed by the address of the code and by the
+    // address of the profile cell.
+    std::map<uint64_t, std::string> codeNames, profileNames;
+
+    // Successors and predecessors in compressed form.
+    std::vector<NodeId> succStart, succs, predStart, preds;
+    std::vector<NodeId> sortedByAddr; // Node ids sorted by address for searching.
+
+    NodeId rootNode;
+    std::vector<NodeId> idom;
+    std::vector<uint64_t> retained;
+    std::vector<NodeId> order; // Nodes in DFS order from the root.
+};
+
+static const NodeId NoNode = (NodeId)-1;
+
+bool HeapGraph::ReadWord(FILE *f, uint64_t &w)
+{
+    if (addrSize == 8)
+        return fread(&w, 8, 1, f) == 1;
+    uint32_t w32;
+    if (fread(&w32, 4, 1, f) != 1) return false;
+    w = w32;
+    return true;
+}
+
+bool HeapGraph::ReadSnapshot(FILE *f)
+{
+    char magic[sizeof(POLY_SNAP_MAGIC)-1];
+    uint32_t header[3];
+    if (fread(magic, sizeof(magic), 1, f) != 1 || memcmp(magic, POLY_SNAP_MAGIC, sizeof(magic)) != 0)
+    {
+        fprintf(stderr, "Not a heap snapshot file\n");
+        return false;
+    }
+    if (fread(header, sizeof(header), 1, f) != 1 || header[0] != POLY_SNAP_VERSION ||
+        (header[1] != 4 && header[1] != 8) || (header[2] != 4 && header[2] != 8))
+    {
+        fprintf(stderr, "Unsupported snapshot version or word size\n");
+        return false;
+    }
+    addrSize = header[1];
+    lengthSize = header[2];
+
+    while (true)
+    {
+        int tag = fgetc(f);
+        uint64_t addr, w1, w2;
+        switch (tag)
+        {
+        case POLY_SNAP_END:
+            return true;
+
+        case POLY_SNAP_ROOT:
+            if (! ReadWord(f, addr)) break;
+            rootAddrs.push_back(addr);
+            continue;
+
+        case POLY_SNAP_OBJECT:
+            {
+                if (! ReadWord(f, addr) || ! ReadWord(f, w1) || ! ReadWord(f, w2)) break;
+                addrs.push_back(addr);
+                lengths.push_back(w1);
+                refStart.push_back(refAddrs.size());
+                uint64_t i;
+                for (i = 0; i < w2; i++)
+                {
+                    uint64_t ref;
+                    if (! ReadWord(f, ref)) break;
+                    refAddrs.push_back(ref);
+                }
+                if (i != w2) break;
+                continue;
+            }
+
+        case POLY_SNAP_CODENAME:
+            {
+                if (! ReadWord(f, addr) || ! ReadWord(f, w1) || ! ReadWord(f, w2)) break;
+                std::string name((size_t)w2, ' ');
+                if (w2 != 0 && fread(&name[0], (size_t)w2, 1, f) != 1) break;
+                codeNames[addr] = name;
+                if (w1 != 0) profileNames[w1] = name;
+                continue;
+            }
+
+        default:
+            break;
+        }
+        // Any failure comes here.
+        fprintf(stderr, "Snapshot file is truncated or corrupt\n");
+        return false;
+    }
+}
+
+NodeId HeapGraph::FindNode(uint64_t addr)
+{
+    size_t lo = 0, hi = sortedByAddr.size();
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        uint64_t a = addrs[sortedByAddr[mid]];
+        if (a == addr) return sortedByAddr[mid];
+        if (a < addr) lo = mid + 1; else hi = mid;
+    }
+    return NoNode;
+}
+
+struct CompareAddr
+{
+    CompareAddr(const std::vector<uint64_t> &a): addrs(a) {}
+    bool operator()(NodeId x, NodeId y) const { return addrs[x] < addrs[y]; }
+    const std::vector<uint64_t> &addrs;
+};
+
+// Convert the addresses into node ids and build the successor and predecessor lists.
+void HeapGraph::BuildGraph(void)
+{
+    NodeId nObjects = (NodeId)addrs.size();
+    sortedByAddr.resize(nObjects);
+    for (NodeId n = 0; n < nObjects; n++) sortedByAddr[n] = n;
+    std::sort(sortedByAddr.begin(), sortedByAddr.end(), CompareAddr(addrs));
+
+    rootNode = nObjects;
+    refStart.push_back(refAddrs.size());
+
+    // Weak objects hold their "SOME" cells strongly but the contents of those
+    // cells are weak.  Don't follow references out of them.
+    std::vector<bool> weakContents(nObjects, false);
+    for (NodeId n = 0; n < nObjects; n++)
+    {
+        if (Flags(n) & POLY_SNAP_F_WEAK)
+        {
+            for (uint64_t r = refStart[n]; r < refStart[n+1]; r++)
+            {
+                NodeId t = FindNode(refAddrs[r]);
+                if (t != NoNode) weakContents[t] = true;
+            }
+        }
+    }
+
+    succStart.resize(nObjects+2);
+    for (NodeId n = 0; n < nObjects; n++)
+    {
+        succStart[n] = (NodeId)succs.size();
+        if (weakContents[n]) continue;
+        for (uint64_t r = refStart[n]; r < refStart[n+1]; r++)
+        {
+            NodeId t = FindNode(refAddrs[r]);
+            if (t != NoNode) succs.push_back(t);
+        }
+    }
+    succStart[rootNode] = (NodeId)succs.size();
+    for (std::vector<uint64_t>::iterator i = rootAddrs.begin(); i != rootAddrs.end(); i++)
+    {
+        NodeId t = FindNode(*i);
+        if (t != NoNode) succs.push_back(t);
+    }
+    succStart[rootNode+1] = (NodeId)succs.size();
+    // We don't need the addresses of the references any longer.
+    std::vector<uint64_t>().swap(refAddrs);
+    std::vector<uint64_t>().swap(refStart);
+
+    // Predecessors.
+    NodeId nNodes = nObjects+1;
+    predStart.assign(nNodes+1, 0);
+    for (std::vector<NodeId>::iterator i = succs.begin(); i != succs.end(); i++)
+        predStart[*i+1]++;
+    for (NodeId n = 0; n < nNodes; n++) predStart[n+1] += predStart[n];
+    preds.resize(succs.size());
+    std::vector<NodeId> fill(predStart.begin(), predStart.end()-1);
+    for (NodeId n = 0; n < nNodes; n++)
+        for (NodeId s = succStart[n]; s < succStart[n+1]; s++)
+            preds[fill[succs[s]]++] = n;
+}
+
+// Lengauer-Tarjan with path compression.  Everything is iterative because
+// the graph can be very deep e.g. a long list.
+void HeapGraph::ComputeDominators(void)
+{
+    NodeId nNodes = rootNode+1;
+    std::vector<NodeId> dfnum(nNodes, NoNode), parent(nNodes, NoNode), semi(nNodes),
+        ancestor(nNodes, NoNode), best(nNodes), samedom(nNodes, NoNode);
+    std::vector<std::vector<NodeId> > bucket;
+
+    // Depth-first numbering.
+    {
+        std::vector<std::pair<NodeId, NodeId> > stack; // Node and next successor index
+        dfnum[rootNode] = 0;
+        order.push_back(rootNode);
+        stack.push_back(std::make_pair(rootNode, succStart[rootNode]));
+        while (! stack.empty())
+        {
+            NodeId n = stack.back().first;
+            NodeId &next = stack.back().second;
+            if (next == succStart[n+1]) { stack.pop_back(); continue; }
+            NodeId s = succs[next++];
+            if (dfnum[s] != NoNode) continue;
+            dfnum[s] = (NodeId)order.size();
+            parent[s] = n;
+            order.push_back(s);
+            stack.push_back(std::make_pair(s, succStart[s]));
+        }
+    }
+
+    bucket.resize(nNodes);
+    for (NodeId n = 0; n < nNodes; n++) { semi[n] = n; best[n] = n; }
+    idom.assign(nNodes, NoNode);
+
+    std::vector<NodeId> path;
+    for (size_t i = order.size()-1; i > 0; i--)
+    {
+        NodeId n = order[i];
+        NodeId p = parent[n];
+        NodeId s = p;
+        for (NodeId j = predStart[n]; j < predStart[n+1]; j++)
+        {
+            NodeId v = preds[j];
+            if (dfnum[v] == NoNode) continue; // Unreachable
+            NodeId sPrime;
+            if (dfnum[v] <= dfnum[n]) sPrime = v;
+            else
+            {
+                // Find the ancestor of v with the lowest semi-dominator,
+                // compressing the path as we go.
+                path.clear();
+                NodeId a = v;
+                while (ancestor[a] != NoNode && ancestor[ancestor[a]] != NoNode)
+                {
+                    path.push_back(a);
+                    a = ancestor[a];
+                }
+                for (size_t k = path.size(); k > 0; k--)
+                {
+                    NodeId x = path[k-1];
+                    NodeId anc = ancestor[x];
+                    if (dfnum[semi[best[anc]]] < dfnum[semi[best[x]]]) best[x] = best[anc];
+                    ancestor[x] = ancestor[anc];
+                }
+                sPrime = semi[best[v]];
+            }
+            if (dfnum[sPrime] < dfnum[s]) s = sPrime;
+        }
+        semi[n] = s;
+        bucket[s].push_back(n);
+        ancestor[n] = p;
+        for (std::vector<NodeId>::iterator b = bucket[p].begin(); b != bucket[p].end(); b++)
+        {
+            NodeId v = *b;
+            // Eval(v) as above.
+            path.clear();
+            NodeId a = v;
+            while (ancestor[a] != NoNode && ancestor[ancestor[a]] != NoNode)
+            {
+                path.push_back(a);
+                a = ancestor[a];
+            }
+            for (size_t k = path.size(); k > 0; k--)
+            {
+                NodeId x = path[k-1];
+                NodeId anc = ancestor[x];
+                if (dfnum[semi[best[anc]]] < dfnum[semi[best[x]]]) best[x] = best[anc];
+                ancestor[x] = ancestor[anc];
+            }
+            NodeId y = best[v];
+            if (semi[y] == semi[v]) idom[v] = p;
+            else samedom[v] = y;
+        }
+        std::vector<NodeId>().swap(bucket[p]);
+    }
+    for (size_t i = 1; i < order.size(); i++)
+    {
+        NodeId n = order[i];
+        if (samedom[n] != NoNode) idom[n] = idom[samedom[n]];
+    }
+}
+
+// The retained size is the sum of the sizes of the nodes in the dominator
+// subtree.  A node always comes after its dominator in DFS order so we can
+// accumulate in reverse order.
+void HeapGraph::ComputeRetained(void)
+{
+    retained.assign(rootNode+1, 0);
+    for (size_t i = order.size()-1; i > 0; i--)
+    {
+        NodeId n = order[i];
+        retained[n] += ObjectBytes(n);
+        retained[idom[n]] += retained[n];
+    }
+}
+
+std::string HeapGraph::TypeName(NodeId n)
+{
+    if (n == rootNode) return "<roots>";
+    unsigned flags = Flags(n);
+    uint64_t length = lengths[n] & POLY_SNAP_LENGTH_MASK(lengthSize);
+    char buff[40];
+
+    switch (flags & POLY_SNAP_F_TYPE_MASK)
+    {
+    case POLY_SNAP_F_CODE:
+        {
+            std::map<uint64_t, std::string>::iterator i = codeNames.find(addrs[n]);
+            return "code " + (i == codeNames.end() ? std::string("<not-named>") : i->second);
+        }
+    case POLY_SNAP_F_BYTE:
+        if (flags & POLY_SNAP_F_MUTABLE) return "mutable bytes";
+        return "bytes (strings, large integers, reals)";
+    default:
+        break;
+    }
+
+    // Word objects.  A closure has the address of its code as its first word.
+    if (succStart[n] != succStart[n+1])
+    {
+        NodeId first = succs[succStart[n]];
+        if ((Flags(first) & POLY_SNAP_F_TYPE_MASK) == POLY_SNAP_F_CODE)
+        {
+            std::map<uint64_t, std::string>::iterator i = codeNames.find(addrs[first]);
+            if (i != codeNames.end()) return "closure " + i->second;
+        }
+    }
+    // If it has a profile pointer it is the last word.
+    if ((flags & POLY_SNAP_F_PROFILE) && succStart[n] != succStart[n+1])
+    {
+        NodeId last = succs[succStart[n+1]-1];
+        std::map<uint64_t, std::string>::iterator i = profileNames.find(addrs[last]);
+        if (i != profileNames.end()) return "allocated by " + i->second;
+    }
+    if (flags & POLY_SNAP_F_WEAK) return "weak ref/array";
+    if (flags & POLY_SNAP_F_MUTABLE)
+        return length == 1 ? "ref" : "array";
+    if (length > 8) return "vector/tuple (large)";
+    sprintf(buff, "tuple/%u", (unsigned)length);
+    return buff;
+}
+
+struct TypeInfo
+{
+    TypeInfo(): count(0), shallow(0), retained(0) {}
+    uint64_t count, shallow, retained;
+};
+
+struct CompareRetained
+{
+    CompareRetained(const std::vector<uint64_t> &r): ret(r) {}
+    bool operator()(NodeId x, NodeId y) const { return ret[x] > ret[y]; }
+    const std::vector<uint64_t> &ret;
+};
+
+static bool compareTypes(const std::pair<std::string, TypeInfo> &a, const std::pair<std::string, TypeInfo> &b)
+{
+    return a.second.retained > b.second.retained;
+}
+
+void HeapGraph::Report(unsigned topN)
+{
+    uint64_t totalBytes = 0;
+    for (NodeId n = 0; n < rootNode; n++) totalBytes += ObjectBytes(n);
+    printf("Objects: %llu  Total size: %llu bytes  Roots: %llu\n",
+        (unsigned long long)rootNode, (unsigned long long)totalBytes, (unsigned long long)rootAddrs.size());
+    printf("Reachable (ignoring weak references): %llu bytes\n\n", (unsigned long long)retained[rootNode]);
+
+    // The retained size for a type counts only those objects that are not dominated
+    // by an object of the same type, otherwise e.g. the cells of a list would be
+    // counted many times.  Walk the dominator tree keeping a count of the number
+    // of ancestors of each type.
+    std::map<std::string, unsigned> typeIds;
+    std::vector<std::string> typeNames;
+    std::vector<unsigned> types(rootNode+1);
+    std::vector<TypeInfo> byType;
+    for (size_t i = 1; i < order.size(); i++)
+    {
+        NodeId n = order[i];
+        std::string name = TypeName(n);
+        std::map<std::string, unsigned>::iterator t = typeIds.find(name);
+        if (t == typeIds.end())
+        {
+            t = typeIds.insert(std::make_pair(name, (unsigned)typeNames.size())).first;
+            typeNames.push_back(name);
+            byType.push_back(TypeInfo());
+        }
+        types[n] = t->second;
+        byType[t->second].count++;
+        byType[t->second].shallow += ObjectBytes(n);
+    }
+    types[rootNode] = (unsigned)typeNames.size(); // Distinct from all the others.
+    {
+        std::vector<NodeId> childStart(rootNode+2, 0), children(order.size());
+        for (size_t i = 1; i < order.size(); i++) childStart[idom[order[i]]+1]++;
+        for (NodeId n = 0; n <= rootNode; n++) childStart[n+1] += childStart[n];
+        std::vector<NodeId> fill(childStart.begin(), childStart.end()-1);
+        for (size_t i = 1; i < order.size(); i++) children[fill[idom[order[i]]]++] = order[i];
+
+        std::vector<unsigned> active(typeNames.size()+1, 0);
+        std::vector<std::pair<NodeId, NodeId> > stack;
+        stack.push_back(std::make_pair(rootNode, childStart[rootNode]));
+        while (! stack.empty())
+        {
+            NodeId n = stack.back().first;
+            NodeId next = stack.back().second;
+            if (next == childStart[n+1])
+            {
+                active[types[n]]--;
+                stack.pop_back();
+                continue;
+            }
+            stack.back().second++;
+            if (next == childStart[n]) active[types[n]]++; // Entering n
+            NodeId c = children[next];
+            if (active[types[c]] == 0) byType[types[c]].retained += retained[c];
+            if (childStart[c] == childStart[c+1]) continue; // Leaf
+            stack.push_back(std::make_pair(c, childStart[c]));
+        }
+    }
+    std::vector<std::pair<std::string, TypeInfo> > typeList;
+    for (unsigned t = 0; t < typeNames.size(); t++)
+        typeList.push_back(std::make_pair(typeNames[t], byType[t]));
+    std::sort(typeList.begin(), typeList.end(), compareTypes);
+    printf("Top retainers by type\n");
+    printf("%14s %14s %10s  %s\n", "Retained", "Shallow", "Count", "Type");
+    for (size_t i = 0; i < typeList.size() && i < topN; i++)
+        printf("%14llu %14llu %10llu  %s\n", (unsigned long long)typeList[i].second.retained,
+            (unsigned long long)typeList[i].second.shallow, (unsigned long long)typeList[i].second.count,
+            typeList[i].first.c_str());
+
+    // Individual objects.  Only consider the immediate children of the root
+    // and objects with a different type from their dominator.
+    std::vector<NodeId> candidates;
+    for (size_t i = 1; i < order.size(); i++)
+    {
+        NodeId n = order[i];
+        if (idom[n] == rootNode || types[idom[n]] != types[n]) candidates.push_back(n);
+    }
+    size_t nShow = std::min(candidates.size(), (size_t)topN);
+    std::partial_sort(candidates.begin(), candidates.begin()+nShow, candidates.end(), CompareRetained(retained));
+    printf("\nTop retaining objects\n");
+    printf("%14s %18s %18s  %s\n", "Retained", "Address", "Dominator", "Type");
+    for (size_t i = 0; i < nShow; i++)
+    {
+        NodeId n = candidates[i];
+        printf("%14llu %18llx %18llx  %s\n", (unsigned long long)retained[n], (unsigned long long)addrs[n],
+            idom[n] == rootNode ? 0ULL : (unsigned long long)addrs[idom[n]], typeNames[types[n]].c_str());
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned topN = 30;
+    const char *fileName = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i+1 < argc)
+            topN = (unsigned)atoi(argv[++i]);
+        else if (fileName == 0 && argv[i][0] != '-')
+            fileName = argv[i];
+        else fileName = 0, i = argc;
+    }
+    if (fileName == 0)
+    {
+        fprintf(stderr, "Usage: %s [-n count] snapshot-file\n", argv[0]);
+        return 1;
+    }
+    FILE *f = fopen(fileName, "rb");
+    if (f == 0)
+    {
+        perror(fileName);
+        return 1;
+    }
+    HeapGraph graph;
+    bool ok = graph.ReadSnapshot(f);
+    fclose(f);
+    if (! ok) return 1;
+    graph.BuildGraph();
+    graph.ComputeDominators();
+    graph.ComputeRetained();
+    graph.Report(topN);
+    return 0;
+}
@@ -77,6 +77,15 @@ DCJM May 2000.
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>
 #endif
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_LIMITS_H
+#include <limits.h>
+#endif
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -99,11 +108,37 @@ DCJM May 2000.
 #include <stdio.h>
 #endif
 #include <limits>
+#include <deque>
+#include <string>
+#include <vector>
+
+#if ((!defined(_WIN32) || defined(__CYGWIN__)) && defined(HAVE_LIBPTHREAD) && defined(HAVE_PTHREAD_H))
+#define HAVE_PTHREAD 1
+#include <pthread.h>
+#endif
+
+// Asynchronous IO uses io_uring on Linux if the headers are recent enough
+// to probe for the operations we need.
+#if (defined(__linux__) && defined(__has_include))
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#if (defined(IO_URING_OP_SUPPORTED) && defined(IORING_FEAT_RW_CUR_POS))
+#define USE_IO_URING 1
+#endif
+#endif
+#endif
 
 #ifndef INFTIM
 #define INFTIM (-1)
 #endif
 
+// The maximum number of buffers in a single readv or writev.
+// POSIX requires at least 16.
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+
 #ifdef HAVE_DIRENT_H
 # include <dirent.h>
 # define NAMLEN(dirent) strlen((dirent)->d_name)
@@ -147,6 +182,7 @@ DCJM May 2000.
 #define FILEDOESNOTEXIST ENOENT
 #define ERRORNUMBER errno
 
+#define SIZEOF(x) (sizeof(x)/sizeof(PolyWord))
 
 #ifndef O_ACCMODE
 #define O_ACCMODE   (O_RDONLY|O_RDWR|O_WRONLY)
@@ -162,26 +198,28 @@ DCJM May 2000.
 extern "C" {
     POLYEXTERNALSYMBOL POLYUNSIGNED PolyChDir(PolyObject *threadId, PolyWord arg);
     POLYEXTERNALSYMBOL POLYUNSIGNED PolyBasicIOGeneral(PolyObject *threadId, PolyWord code, PolyWord strm, PolyWord arg);
+    POLYEXTERNALSYMBOL POLYUNSIGNED PolyBasicIOReadArrays(PolyObject *threadId, PolyWord strm, PolyWord arg);
+    POLYEXTERNALSYMBOL POLYUNSIGNED PolyBasicIOWriteArrays(PolyObject *threadId, PolyWord strm, PolyWord arg);
+    POLYEXTERNALSYMBOL POLYUNSIGNED PolyBasicIOPreadArray(PolyObject *threadId, PolyWord strm, PolyWord arg);
+    POLYEXTERNALSYMBOL POLYUNSIGNED PolyBasicIOPreadVector(PolyObject *threadId, PolyWord strm, PolyWord arg);
+    POLYEXTERNALSYMBOL POLYUNSIGNED PolyBasicIOPwriteArray(PolyObject *threadId, PolyWord strm, PolyWord arg);
+    POLYEXTERNALSYMBOL POLYUNSIGNED PolyBasicIOMapping(PolyObject *threadId, PolyWord code, PolyWord arg);
+    POLYEXTERNALSYMBOL POLYUNSIGNED PolyBasicIOAsync(PolyObject *threadId, PolyWord code, PolyWord arg);
 }
 
 static bool isAvailable(TaskData *taskData, int ioDesc)
 {
-#ifdef __CYGWIN__
-      static struct timeval poll = {0,1};
-#else
-      static struct timeval poll = {0,0};
-#endif
-      fd_set read_fds;
-      int selRes;
-      FD_ZERO(&read_fds);
-      FD_SET(ioDesc, &read_fds);
-
-      /* If there is something there we can return. */
-      selRes = select(FD_SETSIZE, &read_fds, NULL, NULL, &poll);
-      if (selRes > 0) return true; /* Something waiting. */
-      else if (selRes < 0 && errno != EINTR) // Maybe another thread closed descr
-          raise_syscall(taskData, "select error", ERRORNUMBER);
-      else return false;
+    // Use poll rather than select because select can't handle descriptors
+    // of FD_SETSIZE or larger.
+    struct pollfd fds;
+    fds.fd = ioDesc;
+    fds.events = POLLIN;
+    fds.revents = 0;
+    int pollRes = poll(&fds, 1, 0);
+    if (pollRes > 0) return true; /* Something waiting. */
+    else if (pollRes < 0 && errno != EINTR) // Maybe another thread closed descr
+        raise_syscall(taskData, "poll error", ERRORNUMBER);
+    return false;
 }
 
 // The strm argument is a volatile word containing the descriptor.
@@ -255,6 +293,9 @@ static Handle close_file(TaskData *taskData, Handle stream)
     {
         close(descr);
         *(int*)(stream->WordP()) = 0; // Mark as closed
+#ifdef USE_EPOLL_REACTOR
+        processes->ReactorWakeFD(descr);
+#endif
     }
 
     return Make_fixed_precision(taskData, 0);
@@ -309,6 +350,40 @@ static Handle readArray(TaskData *taskData, Handle stream, Handle args, bool/*is
     }
 }
 
+// Return the number of bytes that can be read without blocking or -1 if
+// that cannot be determined.  For a regular file this is the number of bytes
+// up to the end of the file; if that is more than an int it may be truncated.
+static long bytesReadyToRead(int fd)
+{
+#ifdef FIONREAD
+    int avail = 0;
+    if (ioctl(fd, FIONREAD, &avail) == 0 && avail >= 0)
+        return avail;
+#endif
+    return -1;
+}
+
+// Allocate a byte object to hold the result of a read.  The length is set
+// to the number requested.  Since this may GC the caller must not compute
+// any addresses in the heap until after this returns.
+static PolyStringObject *allocReadBuffer(TaskData *taskData, size_t length)
+{
+    PolyStringObject *result = (PolyStringObject *)alloc(taskData, WORDS(length) + 1, F_BYTE_OBJ);
+    result->length = length;
+    return result;
+}
+
+// If a read into a new byte object returned fewer bytes than requested we have
+// to copy the data into a new object with the correct length.  This is rare
+// because the size of the object is normally the number of bytes available.
+static Handle shortenReadBuffer(TaskData *taskData, Handle buffer, size_t haveRead)
+{
+    PolyStringObject *result = allocReadBuffer(taskData, haveRead);
+    // The GC may have moved the original buffer so we must get the address after the allocation.
+    memcpy(result->chars, ((PolyStringObject*)DEREFHANDLE(buffer))->chars, haveRead);
+    return SAVE(result);
+}
+
 /* Return input as a string. We don't actually need both readArray and
    readString but it's useful to have both to reduce unnecessary garbage.
    The IO library will construct one from the other but the higher levels
@@ -321,12 +396,33 @@ static Handle readString(TaskData *taskData, Handle stream, Handle args, bool/*i
 
     while (1) // Loop if interrupted.
     {
-        // First test to see if we have input available.
+        int fd = getStreamFileDescriptor(taskData, stream->Word());
+        // If we know how much is available we can read it directly into a newly
+        // allocated string.  That avoids waiting and copying through a buffer.
+        long ready = bytesReadyToRead(fd);
+        if (ready > 0)
+        {
+            if ((size_t)ready < length) length = ready;
+            Handle result = SAVE(allocReadBuffer(taskData, length));
+            // The allocation may have resulted in a GC and another thread may have closed the stream.
+            fd = getStreamFileDescriptor(taskData, stream->Word());
+            ssize_t haveRead = read(fd, ((PolyStringObject*)DEREFHANDLE(result))->chars, length);
+            if (haveRead >= 0)
+            {
+                if ((size_t)haveRead == length) return result;
+                return shortenReadBuffer(taskData, result, haveRead);
+            }
+            if (errno != EINTR)
+                raise_syscall(taskData, "Error while reading", ERRORNUMBER);
+            continue;
+        }
+
+        // Otherwise test to see if we have input available.
         // These tests may result in a GC if another thread is running.
         waitForAvailableInput(taskData, stream);
 
         // We can now try to read without blocking.
-        int fd = getStreamFileDescriptor(taskData, stream->Word());
+        fd = getStreamFileDescriptor(taskData, stream->Word());
         // We previously allocated the buffer on the stack but that caused
         // problems with multi-threading at least on Mac OS X because of
         // stack exhaustion.  We limit the space to 100k. */
@@ -371,22 +467,893 @@ static bool canOutput(TaskData *taskData, Handle stream)
 {
     int fd = getStreamFileDescriptor(taskData, stream->Word());
 
-    /* Unix - use "select" to find out if output is possible. */
-#ifdef __CYGWIN__
-    static struct timeval poll = {0,1};
+    struct pollfd fds;
+    fds.fd = fd;
+    fds.events = POLLOUT;
+    fds.revents = 0;
+    int pollRes = poll(&fds, 1, 0);
+    if (pollRes < 0 && errno != EINTR)
+        raise_syscall(taskData, "poll failed", ERRORNUMBER);
+    return pollRes > 0;
+}
+
+// Fill in an array of iovec entries from an ML list of (buffer, offset, length)
+// triples.  At most IOV_MAX entries are used; the callers return the number of
+// bytes transferred so the ML code treats the rest as a partial read or write.
+// The addresses are in the heap so nothing must be allocated until after the
+// system call.
+static int getIOVector(TaskData *taskData, PolyWord list, struct iovec *vec)
+{
+    int n = 0;
+    for (PolyWord p = list; !ML_Cons_Cell::IsNull(p) && n < IOV_MAX; p = ((ML_Cons_Cell*)p.AsObjPtr())->t)
+    {
+        PolyObject *entry = ((ML_Cons_Cell*)p.AsObjPtr())->h.AsObjPtr();
+        byte *base = entry->Get(0).AsObjPtr()->AsBytePtr();
+        vec[n].iov_base = base + getPolyUnsigned(taskData, entry->Get(1));
+        vec[n].iov_len = getPolyUnsigned(taskData, entry->Get(2));
+        n++;
+    }
+    return n;
+}
+
+// Scatter read into a list of arrays.  Like readArray this blocks until
+// some input is available.
+static Handle readArrays(TaskData *taskData, Handle stream, Handle args)
+{
+    processes->TestAnyEvents(taskData);
+
+    while (1) // Loop if interrupted.
+    {
+        waitForAvailableInput(taskData, stream);
+        int fd = getStreamFileDescriptor(taskData, stream->Word());
+        struct iovec vec[IOV_MAX];
+        int count = getIOVector(taskData, args->Word(), vec);
+        ssize_t haveRead = readv(fd, vec, count);
+        if (haveRead >= 0)
+            return Make_fixed_precision(taskData, haveRead);
+        if (errno != EINTR)
+            raise_syscall(taskData, "Error while reading", ERRORNUMBER);
+    }
+}
+
+// Gather write from a list of arrays or vectors.
+static Handle writeArrays(TaskData *taskData, Handle stream, Handle args)
+{
+    int fd = getStreamFileDescriptor(taskData, stream->Word());
+    struct iovec vec[IOV_MAX];
+    int count = getIOVector(taskData, args->Word(), vec);
+    ssize_t haveWritten = writev(fd, vec, count);
+    if (haveWritten < 0) raise_syscall(taskData, "Error while writing", ERRORNUMBER);
+    return Make_fixed_precision(taskData, haveWritten);
+}
+
+// Positional read into an array.  The argument is (buffer, offset, length, position).
+// This does not change the file position so it avoids a separate seek and can
+// be used by several threads sharing a descriptor.
+static Handle preadArray(TaskData *taskData, Handle stream, Handle args)
+{
+    off_t position = (off_t)get_C_long(taskData, DEREFHANDLE(args)->Get(3));
+    processes->TestAnyEvents(taskData);
+    while (1)
+    {
+        int fd = getStreamFileDescriptor(taskData, stream->Word());
+        byte *base = DEREFHANDLE(args)->Get(0).AsObjPtr()->AsBytePtr();
+        POLYUNSIGNED offset = getPolyUnsigned(taskData, DEREFHANDLE(args)->Get(1));
+        size_t length = getPolyUnsigned(taskData, DEREFHANDLE(args)->Get(2));
+        ssize_t haveRead = pread(fd, base + offset, length, position);
+        if (haveRead >= 0)
+            return Make_fixed_precision(taskData, haveRead);
+        if (errno != EINTR)
+            raise_syscall(taskData, "Error while reading", ERRORNUMBER);
+    }
+}
+
+// Positional read returning a vector.  The argument is (length, position).
+// The data is read directly into the result.
+static Handle preadVector(TaskData *taskData, Handle stream, Handle args)
+{
+    size_t length = getPolyUnsigned(taskData, DEREFHANDLE(args)->Get(0));
+    off_t position = (off_t)get_C_long(taskData, DEREFHANDLE(args)->Get(1));
+    processes->TestAnyEvents(taskData);
+    int fd = getStreamFileDescriptor(taskData, stream->Word());
+    // Don't allocate more than we need if we are close to the end of a file.
+    struct stat statBuff;
+    if (fstat(fd, &statBuff) == 0 && S_ISREG(statBuff.st_mode))
+    {
+        if (position >= statBuff.st_size) length = 0;
+        else if ((off_t)length > statBuff.st_size - position)
+            length = statBuff.st_size - position;
+    }
+    Handle result = SAVE(allocReadBuffer(taskData, length));
+    while (1)
+    {
+        fd = getStreamFileDescriptor(taskData, stream->Word());
+        ssize_t haveRead = pread(fd, ((PolyStringObject*)DEREFHANDLE(result))->chars, length, position);
+        if (haveRead >= 0)
+        {
+            if ((size_t)haveRead == length) return result;
+            return shortenReadBuffer(taskData, result, haveRead);
+        }
+        if (errno != EINTR)
+            raise_syscall(taskData, "Error while reading", ERRORNUMBER);
+    }
+}
+
+// Positional write.  The argument is (buffer, offset, length, position).
+static Handle pwriteArray(TaskData *taskData, Handle stream, Handle args)
+{
+    off_t position = (off_t)get_C_long(taskData, DEREFHANDLE(args)->Get(3));
+    int fd = getStreamFileDescriptor(taskData, stream->Word());
+    byte *base = DEREFHANDLE(args)->Get(0).AsObjPtr()->AsBytePtr();
+    POLYUNSIGNED offset = getPolyUnsigned(taskData, DEREFHANDLE(args)->Get(1));
+    size_t length = getPolyUnsigned(taskData, DEREFHANDLE(args)->Get(2));
+    ssize_t haveWritten = pwrite(fd, base + offset, length, position);
+    if (haveWritten < 0) raise_syscall(taskData, "Error while writing", ERRORNUMBER);
+    return Make_fixed_precision(taskData, haveWritten);
+}
+
+// Memory-mapped files.  The whole file is mapped read-only and the ML code
+// reads it through the address.  The mapping is not part of the heap so the
+// GC never scans or copies it and reading a large file does not put any
+// pressure on the heap.  The address is returned as a SysWord.
+static uintptr_t getMappingAddress(PolyWord w)
+{
+    return *(uintptr_t*)(w.AsCodePtr());
+}
+
+static Handle mapFile(TaskData *taskData, Handle filename)
+{
+    TempString cFileName(filename->Word());
+    if (cFileName == 0) raise_syscall(taskData, "Insufficient memory", NOMEMORY);
+    int fd;
+    do { fd = open(cFileName, O_RDONLY); } while (fd < 0 && errno == EINTR);
+    if (fd < 0) raise_syscall(taskData, "Cannot open", ERRORNUMBER);
+    struct stat statBuff;
+    if (fstat(fd, &statBuff) < 0)
+    {
+        int err = ERRORNUMBER;
+        close(fd);
+        raise_syscall(taskData, "Stat failed", err);
+    }
+    if (! S_ISREG(statBuff.st_mode) || (uintmax_t)statBuff.st_size > (uintmax_t)SIZE_MAX)
+    {
+        close(fd);
+        raise_syscall(taskData, "Cannot map file", EINVAL);
+    }
+    size_t length = (size_t)statBuff.st_size;
+    void *addr = 0;
+    // mmap fails for a length of zero.  An empty file is represented by a null address.
+    if (length != 0)
+    {
+        addr = mmap(0, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED)
+        {
+            int err = ERRORNUMBER;
+            close(fd);
+            raise_syscall(taskData, "Cannot map file", err);
+        }
+    }
+    // The mapping remains valid after the descriptor is closed.
+    close(fd);
+    Handle address = Make_sysword(taskData, (uintptr_t)addr);
+    Handle size = Make_fixed_precision(taskData, length);
+    Handle result = alloc_and_save(taskData, 2);
+    DEREFHANDLE(result)->Set(0, address->Word());
+    DEREFHANDLE(result)->Set(1, size->Word());
+    return result;
+}
+
+static Handle mappingGeneral(TaskData *taskData, Handle code, Handle args)
+{
+    unsigned c = get_C_unsigned(taskData, DEREFWORD(code));
+    switch (c)
+    {
+    case 0: // Map a file.  The argument is the file name.
+        return mapFile(taskData, args);
+
+    case 1: // Unmap.  The argument is (address, length).
+        {
+            uintptr_t addr = getMappingAddress(DEREFHANDLE(args)->Get(0));
+            size_t length = getPolyUnsigned(taskData, DEREFHANDLE(args)->Get(1));
+            if (addr != 0 && munmap((void*)addr, length) != 0)
+                raise_syscall(taskData, "munmap failed", ERRORNUMBER);
+            return Make_fixed_precision(taskData, 0);
+        }
+
+    case 2: // Advise the kernel on the expected use.  The argument is (address, length, advice).
+        {
+            uintptr_t addr = getMappingAddress(DEREFHANDLE(args)->Get(0));
+            size_t length = getPolyUnsigned(taskData, DEREFHANDLE(args)->Get(1));
+            int advice = MADV_NORMAL;
+            switch (get_C_unsigned(taskData, DEREFHANDLE(args)->Get(2)))
+            {
+            case 1: advice = MADV_SEQUENTIAL; break;
+            case 2: advice = MADV_RANDOM; break;
+            case 3: advice = MADV_WILLNEED; break;
+            case 4: advice = MADV_DONTNEED; break;
+            }
+            // This is only advice so ignore any error.
+            if (addr != 0) madvise((void*)addr, length, advice);
+            return Make_fixed_precision(taskData, 0);
+        }
+
+    case 3: // Copy out of the mapping.  The argument is (address, offset, buffer, bufOffset, length).
+            // The ML code has checked the ranges.
+        {
+            uintptr_t addr = getMappingAddress(DEREFHANDLE(args)->Get(0));
+            POLYUNSIGNED offset = getPolyUnsigned(taskData, DEREFHANDLE(args)->Get(1));
+            byte *base = DEREFHANDLE(args)->Get(2).AsObjPtr()->AsBytePtr();
+            POLYUNSIGNED bufOffset = getPolyUnsigned(taskData, DEREFHANDLE(args)->Get(3));
+            size_t length = getPolyUnsigned(taskData, DEREFHANDLE(args)->Get(4));
+            if (length != 0) memcpy(base + bufOffset, (byte*)addr + offset, length);
+            return Make_fixed_precision(taskData, 0);
+        }
+
+    default:
+        {
+            char msg[100];
+            sprintf(msg, "Unknown mapped file function: %d", c);
+            raise_exception_string(taskData, EXC_Fail, msg);
+            return 0;
+        }
+    }
+}
+
+// Asynchronous IO.  ML submits batches of requests to a queue and collects
+// the completions later so that a single ML thread can have many reads and
+// writes in progress.  On Linux the requests are passed to the kernel through
+// io_uring if the kernel supports the operations.  Otherwise, or if io_uring
+// has been disabled, e.g. in a sandbox, they are run on a small pool of threads.
+// The GC may move ML objects while a request is in progress so the data is
+// copied to and from malloced buffers.
+enum { ASYNC_READ = 0, ASYNC_WRITE, ASYNC_FSYNC, ASYNC_OPEN, ASYNC_FAILED };
+
+// Maximum number of threads in the pool for each queue.
+#define ASYNC_POOL_THREADS  4
+
+class AsyncRequest
+{
+public:
+    AsyncRequest(): buffer(0), path(0) {}
+    ~AsyncRequest() { free(buffer); free(path); }
+
+    POLYUNSIGNED tag;       // Tag supplied by ML and returned with the result.
+    int op;
+    int fd;
+    byte *buffer;           // Data to write or space to read into.
+    size_t length;
+    off_t offset;           // Position in the file or -1 for the current position.
+    char *path;             // File name for open.
+    int flags;              // Flags for open.
+    ssize_t result;         // Result or minus the error number.
+    struct iovec iov;
+};
+
+// Run a request synchronously.  Used by the thread pool.
+static void runAsyncRequest(AsyncRequest *req)
+{
+    ssize_t res = -1;
+    do {
+        switch (req->op)
+        {
+        case ASYNC_READ:
+            res = req->offset < 0 ? read(req->fd, req->buffer, req->length) : pread(req->fd, req->buffer, req->length, req->offset);
+            break;
+        case ASYNC_WRITE:
+            res = req->offset < 0 ? write(req->fd, req->buffer, req->length) : pwrite(req->fd, req->buffer, req->length, req->offset);
+            break;
+        case ASYNC_FSYNC:
+            res = fsync(req->fd);
+            break;
+        case ASYNC_OPEN:
+            res = open(req->path, req->flags | O_CLOEXEC, 0666);
+            break;
+        }
+    } while (res < 0 && errno == EINTR);
+    req->result = res < 0 ? -errno : res;
+}
+
+class AsyncIOQueue
+{
+public:
+    AsyncIOQueue(): outstanding(0) {}
+    virtual ~AsyncIOQueue() {}
+    // Start a request.
+    virtual void Submit(AsyncRequest *req) = 0;
+    // Add any completed requests to the vector.  Does not block.
+    virtual void Collect(std::vector<AsyncRequest*> &done) = 0;
+    // A descriptor that becomes readable when there may be completions.
+    virtual int WaitDescriptor(void) = 0;
+    virtual bool UsesIOUring(void) { return false; }
+
+    size_t outstanding; // Requests submitted but not yet returned to ML.
+};
+
+class ThreadPoolQueue: public AsyncIOQueue
+{
+public:
+    ThreadPoolQueue();
+    virtual ~ThreadPoolQueue();
+    bool Init(void);
+    virtual void Submit(AsyncRequest *req);
+    virtual void Collect(std::vector<AsyncRequest*> &done);
+    virtual int WaitDescriptor(void) { return wakeFds[0]; }
+
+private:
+    PLock poolLock;
+    std::deque<AsyncRequest*> pending, completed;
+    // The workers write a byte to the pipe when they complete a request.
+    int wakeFds[2];
+#ifdef HAVE_PTHREAD
+    static void *WorkerThread(void *arg);
+    void WorkerLoop(void);
+    PCondVar workAvailable;
+    std::vector<pthread_t> workers;
+    unsigned idleWorkers;
+    bool terminate;
+#endif
+};
+
+ThreadPoolQueue::ThreadPoolQueue()
+{
+    wakeFds[0] = wakeFds[1] = -1;
+#ifdef HAVE_PTHREAD
+    idleWorkers = 0;
+    terminate = false;
+#endif
+}
+
+bool ThreadPoolQueue::Init(void)
+{
+    if (pipe(wakeFds) != 0) return false;
+    for (unsigned i = 0; i < 2; i++)
+    {
+        fcntl(wakeFds[i], F_SETFD, FD_CLOEXEC);
+        fcntl(wakeFds[i], F_SETFL, fcntl(wakeFds[i], F_GETFL) | O_NONBLOCK);
+    }
+    return true;
+}
+
+ThreadPoolQueue::~ThreadPoolQueue()
+{
+#ifdef HAVE_PTHREAD
+    poolLock.Lock();
+    terminate = true;
+    poolLock.Unlock();
+    // Each signal wakes at least one waiting worker.  A worker that is not
+    // waiting sees terminate before it waits.
+    for (unsigned i = 0; i < workers.size(); i++)
+    {
+        poolLock.Lock();
+        workAvailable.Signal();
+        poolLock.Unlock();
+    }
+    for (std::vector<pthread_t>::iterator i = workers.begin(); i != workers.end(); i++)
+        pthread_join(*i, NULL);
+#endif
+    for (std::deque<AsyncRequest*>::iterator i = pending.begin(); i != pending.end(); i++)
+        delete(*i);
+    for (std::deque<AsyncRequest*>::iterator i = completed.begin(); i != completed.end(); i++)
+        delete(*i);
+    if (wakeFds[0] >= 0) close(wakeFds[0]);
+    if (wakeFds[1] >= 0) close(wakeFds[1]);
+}
+
+void ThreadPoolQueue::Submit(AsyncRequest *req)
+{
+#ifdef HAVE_PTHREAD
+    PLocker lock(&poolLock);
+    pending.push_back(req);
+    // Start another worker if there are more requests than idle workers.
+    if (pending.size() > idleWorkers && workers.size() < ASYNC_POOL_THREADS)
+    {
+        // Block signals in the worker.  They are handled by the ML threads.
+        sigset_t allSigs, oldSigs;
+        sigfillset(&allSigs);
+        pthread_sigmask(SIG_SETMASK, &allSigs, &oldSigs);
+        pthread_t worker;
+        if (pthread_create(&worker, NULL, WorkerThread, this) == 0)
+            workers.push_back(worker);
+        pthread_sigmask(SIG_SETMASK, &oldSigs, NULL);
+    }
+    if (workers.size() != 0)
+    {
+        workAvailable.Signal();
+        return;
+    }
+    // If we couldn't create any threads run the request now.
+    pending.pop_back();
+#endif
+    runAsyncRequest(req);
+    completed.push_back(req);
+}
+
+void ThreadPoolQueue::Collect(std::vector<AsyncRequest*> &done)
+{
+    PLocker lock(&poolLock);
+    char buff[64];
+    while (read(wakeFds[0], buff, sizeof(buff)) > 0) ;
+    while (! completed.empty())
+    {
+        done.push_back(completed.front());
+        completed.pop_front();
+    }
+}
+
+#ifdef HAVE_PTHREAD
+void *ThreadPoolQueue::WorkerThread(void *arg)
+{
+    ((ThreadPoolQueue*)arg)->WorkerLoop();
+    return 0;
+}
+
+void ThreadPoolQueue::WorkerLoop(void)
+{
+    poolLock.Lock();
+    while (true)
+    {
+        while (pending.empty() && ! terminate)
+        {
+            idleWorkers++;
+            workAvailable.Wait(&poolLock);
+            idleWorkers--;
+        }
+        if (terminate) break;
+        AsyncRequest *req = pending.front();
+        pending.pop_front();
+        poolLock.Unlock();
+        runAsyncRequest(req);
+        poolLock.Lock();
+        completed.push_back(req);
+        // If the pipe is full there is already a byte there.
+        char ch = 0;
+        if (write(wakeFds[1], &ch, 1) < 0) { }
+    }
+    poolLock.Unlock();
+}
+#endif
+
+#ifdef USE_IO_URING
+// io_uring.  The requests are put into the submission ring and passed to the
+// kernel with io_uring_enter.  The completions are read from the completion
+// ring without a system call.  The ring descriptor is readable when there are
+// completions to collect.
+class IOUringQueue: public AsyncIOQueue
+{
+public:
+    IOUringQueue();
+    virtual ~IOUringQueue();
+    bool Init(unsigned entries);
+    virtual void Submit(AsyncRequest *req);
+    virtual void Collect(std::vector<AsyncRequest*> &done);
+    virtual int WaitDescriptor(void) { return ringFd; }
+    virtual bool UsesIOUring(void) { return true; }
+
+private:
+    void SubmitPending(void);
+
+    int ringFd;
+    void *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray, *sqFlags, sqEntries;
+    unsigned *cqHead, *cqTail, *cqMask, cqEntries;
+    struct io_uring_cqe *cqes;
+    // Requests waiting for space in the ring.
+    std::deque<AsyncRequest*> pending;
+    // Requests in the ring that the kernel has not yet accepted.
+    unsigned unsubmitted;
+    // Requests that the kernel has accepted.  This is kept below the size of
+    // the completion ring so that completions are never dropped.
+    unsigned inFlight;
+};
+
+IOUringQueue::IOUringQueue(): ringFd(-1), sqRing(MAP_FAILED), cqRing(MAP_FAILED), sqRingSize(0), cqRingSize(0),
+    sqes((struct io_uring_sqe *)MAP_FAILED), sqesSize(0), unsubmitted(0), inFlight(0)
+{
+}
+
+IOUringQueue::~IOUringQueue()
+{
+    for (std::deque<AsyncRequest*>::iterator i = pending.begin(); i != pending.end(); i++)
+        delete(*i);
+    if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+    if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+    if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+    if (ringFd >= 0) close(ringFd);
+}
+
+bool IOUringQueue::Init(unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ringFd < 0) return false;
+    fcntl(ringFd, F_SETFD, FD_CLOEXEC);
+    if (! (params.features & IORING_FEAT_RW_CUR_POS)) return false;
+
+    // Check that the kernel supports all the operations we use.
+    const unsigned probeOps = 256;
+    size_t probeSize = sizeof(struct io_uring_probe) + probeOps * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, probeSize);
+    if (probe == 0) return false;
+    bool supported = syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, probeOps) == 0;
+    static const int requiredOps[] = { IORING_OP_READV, IORING_OP_WRITEV, IORING_OP_FSYNC, IORING_OP_OPENAT };
+    for (unsigned i = 0; supported && i < sizeof(requiredOps)/sizeof(requiredOps[0]); i++)
+    {
+        int op = requiredOps[i];
+        supported = op < probe->ops_len && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    if (! supported) return false;
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (cqRingSize > sqRingSize) sqRingSize = cqRingSize;
+        cqRingSize = sqRingSize;
+    }
+    sqRing = mmap(0, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) return false;
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        cqRing = sqRing;
+    else
+    {
+        cqRing = mmap(0, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) return false;
+    }
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe *)mmap(0, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) return false;
+
+    sqHead = (unsigned*)((char*)sqRing + params.sq_off.head);
+    sqTail = (unsigned*)((char*)sqRing + params.sq_off.tail);
+    sqMask = (unsigned*)((char*)sqRing + params.sq_off.ring_mask);
+    sqArray = (unsigned*)((char*)sqRing + params.sq_off.array);
+    sqFlags = (unsigned*)((char*)sqRing + params.sq_off.flags);
+    sqEntries = params.sq_entries;
+    cqHead = (unsigned*)((char*)cqRing + params.cq_off.head);
+    cqTail = (unsigned*)((char*)cqRing + params.cq_off.tail);
+    cqMask = (unsigned*)((char*)cqRing + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)((char*)cqRing + params.cq_off.cqes);
+    cqEntries = params.cq_entries;
+    return true;
+}
+
+void IOUringQueue::Submit(AsyncRequest *req)
+{
+    pending.push_back(req);
+    SubmitPending();
+}
+
+// Move as many pending requests as possible into the submission ring and tell the kernel.
+void IOUringQueue::SubmitPending(void)
+{
+    unsigned tail = *sqTail;
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    unsigned added = 0;
+    while (! pending.empty() && tail - head < sqEntries && inFlight + unsubmitted + added < cqEntries)
+    {
+        AsyncRequest *req = pending.front();
+        pending.pop_front();
+        unsigned index = tail & *sqMask;
+        struct io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        switch (req->op)
+        {
+        case ASYNC_READ:
+        case ASYNC_WRITE:
+            sqe->opcode = req->op == ASYNC_READ ? IORING_OP_READV : IORING_OP_WRITEV;
+            sqe->fd = req->fd;
+            req->iov.iov_base = req->buffer;
+            req->iov.iov_len = req->length;
+            sqe->addr = (uintptr_t)&req->iov;
+            sqe->len = 1;
+            sqe->off = (uint64_t)(int64_t)req->offset; // -1 means the current position.
+            break;
+        case ASYNC_FSYNC:
+            sqe->opcode = IORING_OP_FSYNC;
+            sqe->fd = req->fd;
+            break;
+        case ASYNC_OPEN:
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uintptr_t)req->path;
+            sqe->open_flags = req->flags | O_CLOEXEC;
+            sqe->len = 0666;
+            break;
+        }
+        sqe->user_data = (uintptr_t)req;
+        sqArray[index] = index;
+        tail++;
+        added++;
+    }
+    if (added != 0)
+    {
+        __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+        unsubmitted += added;
+    }
+    while (unsubmitted != 0)
+    {
+        int submitted = (int)syscall(__NR_io_uring_enter, ringFd, unsubmitted, 0, 0, NULL, 0);
+        if (submitted > 0)
+        {
+            unsubmitted -= submitted;
+            inFlight += submitted;
+        }
+        // If the kernel is short of resources leave the rest until the next call.
+        else if (submitted == 0 || errno != EINTR)
+            break;
+    }
+}
+
+void IOUringQueue::Collect(std::vector<AsyncRequest*> &done)
+{
+    // inFlight should prevent this but if the completion ring has overflowed
+    // the kernel holds the remaining completions until we ask for them.
+#ifdef IORING_SQ_CQ_OVERFLOW
+    if (__atomic_load_n(sqFlags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW)
+        syscall(__NR_io_uring_enter, ringFd, 0, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+#endif
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail)
+    {
+        struct io_uring_cqe *cqe = &cqes[head & *cqMask];
+        AsyncRequest *req = (AsyncRequest*)(uintptr_t)cqe->user_data;
+        req->result = cqe->res;
+        done.push_back(req);
+        head++;
+        inFlight--;
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    // There may now be space for more requests.
+    SubmitPending();
+}
+#endif
+
+// The ML queue is a weak byte cell containing the address of the AsyncIOQueue.
+// It is cleared when the queue is closed and when it is loaded from a saved
+// state.  asyncIOLock protects the cells and the queues.
+static PLock asyncIOLock("Async IO");
+
+static AsyncIOQueue *getAsyncQueue(TaskData *taskData, PolyWord cell)
+{
+    AsyncIOQueue *queue = *(AsyncIOQueue**)(cell.AsCodePtr());
+    if (queue == 0) raise_syscall(taskData, "Queue is closed", EBADF);
+    return queue;
+}
+
+// Create a list of completions.  Each is a triple of the tag, the kind of
+// result and the value.  The requests are deleted.
+static Handle asyncCompletions(TaskData *taskData, std::vector<AsyncRequest*> &done)
+{
+    Handle saved = taskData->saveVec.mark();
+    Handle list = SAVE(ListNull);
+    for (size_t i = done.size(); i-- > 0; )
+    {
+        AsyncRequest *req = done[i];
+        int kind = req->op;
+        Handle value;
+        if (req->result < 0)
+        {
+            // The value is the argument for OS.SysErr.
+            kind = ASYNC_FAILED;
+            int err = (int)-req->result;
+            Handle errornum = Make_sysword(taskData, err);
+            Handle option = alloc_and_save(taskData, 1);
+            DEREFHANDLE(option)->Set(0, errornum->Word()); /* SOME err */
+            Handle name = errorMsg(taskData, err);
+            value = alloc_and_save(taskData, 2);
+            DEREFHANDLE(value)->Set(0, name->Word());
+            DEREFHANDLE(value)->Set(1, option->Word());
+        }
+        else switch (req->op)
+        {
+        case ASYNC_READ:
+            value = SAVE(C_string_to_Poly(taskData, (const char*)req->buffer, req->result));
+            break;
+        case ASYNC_OPEN:
+            value = wrapFileDescriptor(taskData, (int)req->result);
+            break;
+        default:
+            value = Make_fixed_precision(taskData, (long)req->result);
+        }
+        Handle triple = alloc_and_save(taskData, 3);
+        DEREFHANDLE(triple)->Set(0, PolyWord::FromUnsigned(req->tag));
+        DEREFHANDLE(triple)->Set(1, TAGGED(kind));
+        DEREFHANDLE(triple)->Set(2, value->Word());
+        Handle next = alloc_and_save(taskData, SIZEOF(ML_Cons_Cell));
+        DEREFLISTHANDLE(next)->h = triple->Word();
+        DEREFLISTHANDLE(next)->t = list->Word();
+        taskData->saveVec.reset(saved);
+        list = SAVE(next->Word());
+        done[i] = 0;
+        delete(req);
+    }
+    return list;
+}
+
+// Collect any completions.  If wait is true and nothing has completed
+// block until at least one request has completed or there are none outstanding.
+static Handle asyncCollect(TaskData *taskData, Handle cell, bool wait)
+{
+    std::vector<AsyncRequest*> done;
+    while (true)
+    {
+        int waitFd;
+        {
+            PLocker lock(&asyncIOLock);
+            AsyncIOQueue *queue = getAsyncQueue(taskData, cell->Word());
+            queue->Collect(done);
+            queue->outstanding -= done.size();
+            if (! wait || done.size() != 0 || queue->outstanding == 0)
+                break;
+            waitFd = queue->WaitDescriptor();
+        }
+        WaitInputFD waiter(waitFd);
+        processes->ThreadPauseForIO(taskData, &waiter);
+    }
+    return asyncCompletions(taskData, done);
+}
+
+static Handle asyncGeneral(TaskData *taskData, Handle code, Handle args)
+{
+    unsigned c = get_C_unsigned(taskData, DEREFWORD(code));
+    switch (c)
+    {
+    case 0: // Create a queue.  The argument is (cell, entries, useIOUring).
+            // Returns true if the queue uses io_uring.
+        {
+            unsigned entries = get_C_unsigned(taskData, DEREFHANDLE(args)->Get(1));
+            bool useIOUring = DEREFHANDLE(args)->Get(2) == TAGGED(1);
+            if (entries == 0) entries = 1;
+            AsyncIOQueue *queue = 0;
+#ifdef USE_IO_URING
+            if (useIOUring)
+            {
+                IOUringQueue *uring = new IOUringQueue;
+                if (uring->Init(entries)) queue = uring;
+                else delete(uring);
+            }
 #else
-    static struct timeval poll = {0,0};
+            (void)useIOUring;
 #endif
-    fd_set read_fds, write_fds, except_fds;
-    int sel;
-    FD_ZERO(&read_fds);
-    FD_ZERO(&write_fds);
-    FD_ZERO(&except_fds);
-    FD_SET(fd, &write_fds);
-    sel = select(FD_SETSIZE,&read_fds,&write_fds,&except_fds,&poll);
-    if (sel < 0 && errno != EINTR)
-        raise_syscall(taskData, "select failed", ERRORNUMBER);
-    return sel > 0;
+            if (queue == 0)
+            {
+                ThreadPoolQueue *pool = new ThreadPoolQueue;
+                if (! pool->Init())
+                {
+                    int err = ERRORNUMBER;
+                    delete(pool);
+                    raise_syscall(taskData, "Cannot create queue", err);
+                }
+                queue = pool;
+            }
+            PLocker lock(&asyncIOLock);
+            *(AsyncIOQueue**)(DEREFHANDLE(args)->Get(0).AsCodePtr()) = queue;
+            return Make_fixed_precision(taskData, queue->UsesIOUring() ? 1 : 0);
+        }
+
+    case 1: // Submit a list of requests.  The argument is (cell, requests).  Each
+            // request is (tag, op, stream, buffer, bufOffset, length, position).
+            // For open the buffer is the file name and position is the mode.
+        {
+            std::vector<AsyncRequest*> requests;
+            try {
+                for (PolyWord p = DEREFHANDLE(args)->Get(1); !ML_Cons_Cell::IsNull(p); p = ((ML_Cons_Cell*)p.AsObjPtr())->t)
+                {
+                    PolyObject *entry = ((ML_Cons_Cell*)p.AsObjPtr())->h.AsObjPtr();
+                    AsyncRequest *req = new AsyncRequest;
+                    requests.push_back(req);
+                    req->tag = entry->Get(0).AsUnsigned();
+                    req->op = get_C_int(taskData, entry->Get(1));
+                    req->length = getPolyUnsigned(taskData, entry->Get(5));
+                    req->fd = -1;
+                    req->offset = -1;
+                    switch (req->op)
+                    {
+                    case ASYNC_OPEN:
+                        req->path = Poly_string_to_C_alloc(entry->Get(3));
+                        switch (get_C_int(taskData, entry->Get(6)))
+                        {
+                        case 0: req->flags = O_RDONLY; break;
+                        case 1: req->flags = O_WRONLY | O_CREAT | O_TRUNC; break;
+                        case 2: req->flags = O_WRONLY | O_CREAT | O_APPEND; break;
+                        default: req->flags = O_RDWR | O_CREAT; break;
+                        }
+                        if (req->path == 0) raise_syscall(taskData, "Insufficient memory", NOMEMORY);
+                        break;
+                    case ASYNC_READ:
+                    case ASYNC_WRITE:
+                        req->offset = (off_t)get_C_long(taskData, entry->Get(6));
+                        req->buffer = (byte*)malloc(req->length == 0 ? 1 : req->length);
+                        if (req->buffer == 0) raise_syscall(taskData, "Insufficient memory", NOMEMORY);
+                        if (req->op == ASYNC_WRITE)
+                        {
+                            byte *base = entry->Get(3).AsObjPtr()->AsBytePtr();
+                            memcpy(req->buffer, base + getPolyUnsigned(taskData, entry->Get(4)), req->length);
+                        }
+                        // Fall through
+                    case ASYNC_FSYNC:
+                        req->fd = getStreamFileDescriptor(taskData, entry->Get(2));
+                        break;
+                    default:
+                        raise_fail(taskData, "Unknown asynchronous request");
+                    }
+                }
+            }
+            catch (...) {
+                for (std::vector<AsyncRequest*>::iterator i = requests.begin(); i != requests.end(); i++)
+                    delete(*i);
+                throw;
+            }
+            PLocker lock(&asyncIOLock);
+            AsyncIOQueue *queue = *(AsyncIOQueue**)(DEREFHANDLE(args)->Get(0).AsCodePtr());
+            if (queue == 0)
+            {
+                for (std::vector<AsyncRequest*>::iterator i = requests.begin(); i != requests.end(); i++)
+                    delete(*i);
+                raise_syscall(taskData, "Queue is closed", EBADF);
+            }
+            for (std::vector<AsyncRequest*>::iterator i = requests.begin(); i != requests.end(); i++)
+                queue->Submit(*i);
+            queue->outstanding += requests.size();
+            return Make_fixed_precision(taskData, 0);
+        }
+
+    case 2: // Collect completions without blocking.
+        return asyncCollect(taskData, args, false);
+
+    case 3: // Wait for at least one completion.
+        return asyncCollect(taskData, args, true);
+
+    case 4: // Close the queue.  Waits for any outstanding requests and discards the results.
+        {
+            AsyncIOQueue *queue;
+            {
+                PLocker lock(&asyncIOLock);
+                queue = *(AsyncIOQueue**)(args->Word().AsCodePtr());
+                if (queue == 0) return Make_fixed_precision(taskData, 0);
+                // Clear the cell so that no more requests can be submitted.
+                *(AsyncIOQueue**)(args->Word().AsCodePtr()) = 0;
+            }
+            // The buffers and file names must not be freed until the requests have finished.
+            while (true)
+            {
+                std::vector<AsyncRequest*> done;
+                int waitFd;
+                {
+                    PLocker lock(&asyncIOLock);
+                    queue->Collect(done);
+                    queue->outstanding -= done.size();
+                    for (std::vector<AsyncRequest*>::iterator i = done.begin(); i != done.end(); i++)
+                    {
+                        // Close any files that were opened.
+                        if ((*i)->op == ASYNC_OPEN && (*i)->result >= 0) close((int)(*i)->result);
+                        delete(*i);
+                    }
+                    if (queue->outstanding == 0)
+                        break;
+                    waitFd = queue->WaitDescriptor();
+                }
+                WaitInputFD waiter(waitFd);
+                processes->ThreadPauseForIO(taskData, &waiter);
+            }
+            delete(queue);
+            return Make_fixed_precision(taskData, 0);
+        }
+
+    default:
+        {
+            char msg[100];
+            sprintf(msg, "Unknown asynchronous IO function: %d", c);
+            raise_exception_string(taskData, EXC_Fail, msg);
+            return 0;
+        }
+    }
 }
 
 static long seekStream(TaskData *taskData, int fd, long pos, int origin)
@@ -478,8 +1445,12 @@ void WaitPoll::Wait(unsigned maxMillisecs)
     if (nDescr == 0) pollResult = 0;
     else
     {
+#ifdef USE_EPOLL_REACTOR
+        pollResult = processes->ReactorPoll(fdVec, (unsigned)nDescr, maxTime);
+#else
         if (maxTime < maxMillisecs) maxMillisecs = maxTime;
         pollResult = poll(fdVec, nDescr, maxMillisecs);
+#endif
         if (pollResult < 0) errorResult = ERRORNUMBER;
     }
 }
@@ -525,7 +1496,11 @@ static Handle pollDescriptors(TaskData *taskData, Handle args, int blockType)
                 break;
             }
         case 1: /* Block until one of the descriptors is ready. */
+#ifdef USE_EPOLL_REACTOR
+            maxMillisecs = (unsigned)-1; // The reactor wakes us if we're interrupted.
+#else
             maxMillisecs = 1000; // Max 1 second
+#endif
             break;
         case 2: // Just a simple poll
             maxMillisecs = 0;
@@ -613,6 +1588,77 @@ Handle readDirectory(TaskData *taskData, Handle stream)
     }
 }
 
+// Directory entry kinds returned by readDirectoryEntries.
+enum { DIRENT_REGULAR = 0, DIRENT_DIRECTORY, DIRENT_SYMLINK, DIRENT_OTHER };
+
+struct DirectoryEntry {
+    std::string name;
+    int kind;
+    struct stat fbuff;
+};
+
+/* Read up to maxEntries entries from the directory, ignoring "." and "..",
+   and return a vector of (name, kind, size, modTime, inode) for them.  The
+   vector is empty at the end of the directory.  readdir already reads the
+   directory in large blocks and fstatat relative to the directory avoids
+   looking up the path for each entry.  Symbolic links are not followed.
+   An entry that has been removed since the directory was read is skipped. */
+static Handle readDirectoryEntries(TaskData *taskData, Handle stream, Handle args)
+{
+    DIR *pDir = *(DIR**)(stream->WordP()); // In a Volatile
+    if (pDir == 0) raise_syscall(taskData, "Stream is closed", STREAMCLOSED);
+    unsigned maxEntries = get_C_unsigned(taskData, args->Word());
+    int dirFd = dirfd(pDir);
+    std::vector<DirectoryEntry> entries;
+    while (entries.size() < maxEntries)
+    {
+        struct dirent *dp = readdir(pDir);
+        if (dp == NULL) break;
+        int len = NAMLEN(dp);
+        if ((len == 1 && strncmp(dp->d_name, ".", 1) == 0) ||
+            (len == 2 && strncmp(dp->d_name, "..", 2) == 0))
+            continue;
+        DirectoryEntry entry;
+        entry.name.assign(dp->d_name, len);
+        if (fstatat(dirFd, entry.name.c_str(), &entry.fbuff, AT_SYMLINK_NOFOLLOW) != 0)
+        {
+            if (errno == ENOENT) continue;
+            raise_syscall(taskData, "fstatat failed", ERRORNUMBER);
+        }
+        if (S_ISREG(entry.fbuff.st_mode)) entry.kind = DIRENT_REGULAR;
+        else if (S_ISDIR(entry.fbuff.st_mode)) entry.kind = DIRENT_DIRECTORY;
+        else if (S_ISLNK(entry.fbuff.st_mode)) entry.kind = DIRENT_SYMLINK;
+        else entry.kind = DIRENT_OTHER;
+        entries.push_back(entry);
+    }
+
+    Handle result = alloc_and_save(taskData, entries.size());
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        Handle saved = taskData->saveVec.mark();
+        struct stat *fbuff = &entries[i].fbuff;
+        Handle name = SAVE(C_string_to_Poly(taskData, entries[i].name.c_str(), entries[i].name.length()));
+        Handle size = Make_arbitrary_precision(taskData, fbuff->st_size);
+#ifdef HAVE_LONG_LONG
+        // This is the same as modTime but avoids the long arithmetic.
+        Handle mTime =
+            Make_arbitrary_precision(taskData, (long long)STAT_SECS(fbuff,m) * 1000000 + STAT_USECS(fbuff,m));
+#else
+        Handle mTime = Make_arb_from_pair_scaled(taskData, STAT_SECS(fbuff,m), STAT_USECS(fbuff,m), 1000000);
+#endif
+        Handle inode = Make_arbitrary_precision(taskData, fbuff->st_ino);
+        Handle record = alloc_and_save(taskData, 5);
+        DEREFHANDLE(record)->Set(0, name->Word());
+        DEREFHANDLE(record)->Set(1, TAGGED(entries[i].kind));
+        DEREFHANDLE(record)->Set(2, size->Word());
+        DEREFHANDLE(record)->Set(3, mTime->Word());
+        DEREFHANDLE(record)->Set(4, inode->Word());
+        DEREFHANDLE(result)->Set(i, record->Word());
+        taskData->saveVec.reset(saved);
+    }
+    return result;
+}
+
 Handle rewindDirectory(TaskData *taskData, Handle stream, Handle dirname)
 {
     DIR *pDir = *(DIR**)(stream->WordP()); // In a Volatile
@@ -1087,6 +2133,9 @@ static Handle IO_dispatch_c(TaskData *taskData, Handle args, Handle strm, Handle
             return open_file(taskData, name, mode|O_CREAT, access, 1);
         }
 
+    case 72: /* Read a batch of directory entries with their status. */
+        return readDirectoryEntries(taskData, strm, args);
+
     default:
         {
             char msg[100];
@@ -1124,10 +2173,77 @@ POLYUNSIGNED PolyBasicIOGeneral(PolyObject *threadId, PolyWord code, PolyWord st
     else return result->Word().AsUnsigned();
 }
 
+// Common code for the vectored, positional and mapped file calls.
+static POLYUNSIGNED basicIOCall(PolyObject *threadId, Handle (*op)(TaskData *, Handle, Handle), PolyWord strm, PolyWord arg)
+{
+    TaskData *taskData = TaskData::FindTaskForId(threadId);
+    ASSERT(taskData != 0);
+    taskData->PreRTSCall();
+    Handle reset = taskData->saveVec.mark();
+    Handle pushedStrm = taskData->saveVec.push(strm);
+    Handle pushedArg = taskData->saveVec.push(arg);
+    Handle result = 0;
+
+    try {
+        result = op(taskData, pushedStrm, pushedArg);
+    }
+    catch (KillException &) {
+        processes->ThreadExit(taskData); // TestAnyEvents may test for kill
+    }
+    catch (...) { } // If an ML exception is raised
+
+    taskData->saveVec.reset(reset);
+    taskData->PostRTSCall();
+    if (result == 0) return TAGGED(0).AsUnsigned();
+    else return result->Word().AsUnsigned();
+}
+
+POLYUNSIGNED PolyBasicIOReadArrays(PolyObject *threadId, PolyWord strm, PolyWord arg)
+{
+    return basicIOCall(threadId, readArrays, strm, arg);
+}
+
+POLYUNSIGNED PolyBasicIOWriteArrays(PolyObject *threadId, PolyWord strm, PolyWord arg)
+{
+    return basicIOCall(threadId, writeArrays, strm, arg);
+}
+
+POLYUNSIGNED PolyBasicIOPreadArray(PolyObject *threadId, PolyWord strm, PolyWord arg)
+{
+    return basicIOCall(threadId, preadArray, strm, arg);
+}
+
+POLYUNSIGNED PolyBasicIOPreadVector(PolyObject *threadId, PolyWord strm, PolyWord arg)
+{
+    return basicIOCall(threadId, preadVector, strm, arg);
+}
+
+POLYUNSIGNED PolyBasicIOPwriteArray(PolyObject *threadId, PolyWord strm, PolyWord arg)
+{
+    return basicIOCall(threadId, pwriteArray, strm, arg);
+}
+
+POLYUNSIGNED PolyBasicIOMapping(PolyObject *threadId, PolyWord code, PolyWord arg)
+{
+    return basicIOCall(threadId, mappingGeneral, code, arg);
+}
+
+POLYUNSIGNED PolyBasicIOAsync(PolyObject *threadId, PolyWord code, PolyWord arg)
+{
+    return basicIOCall(threadId, asyncGeneral, code, arg);
+}
+
 struct _entrypts basicIOEPT[] =
 {
     { "PolyChDir",                      (polyRTSFunction)&PolyChDir},
     { "PolyBasicIOGeneral",             (polyRTSFunction)&PolyBasicIOGeneral},
+    { "PolyBasicIOReadArrays",          (polyRTSFunction)&PolyBasicIOReadArrays},
+    { "PolyBasicIOWriteArrays",         (polyRTSFunction)&PolyBasicIOWriteArrays},
+    { "PolyBasicIOPreadArray",          (polyRTSFunction)&PolyBasicIOPreadArray},
+    { "PolyBasicIOPreadVector",         (polyRTSFunction)&PolyBasicIOPreadVector},
+    { "PolyBasicIOPwriteArray",         (polyRTSFunction)&PolyBasicIOPwriteArray},
+    { "PolyBasicIOMapping",             (polyRTSFunction)&PolyBasicIOMapping},
+    { "PolyBasicIOAsync",               (polyRTSFunction)&PolyBasicIOAsync},
 
     { NULL, NULL} // End of list.
 };
@@ -117,15 +117,16 @@ private:
     void MarkAndTestForScan(PolyWord *pt);
     void Reset();
 
-    void PushToStack(PolyObject *obj, PolyWord *currentPtr = 0)
+    void PushToStack(PolyObject *obj, POLYUNSIGNED *owner, PolyWord *currentPtr = 0)
     {
         // If we don't have all the threads running we start a new one but
         // only once we have several items on the stack.  Otherwise we
         // can end up creating a task that terminates almost immediately.
-        if (nInUse >= nThreads || msp < 2 || ! ForkNew(obj))
+        if (nInUse >= nThreads || msp < 2 || ! ForkNew(obj, owner))
         {
             if (msp < MARK_STACK_SIZE)
             {
+                ownerStack[msp] = owner;
                 markStack[msp++] = obj;
                 if (currentPtr != 0)
                 {
@@ -141,12 +142,27 @@ private:
     }
 
     static void StackOverflow(PolyObject *obj);
-    static bool ForkNew(PolyObject *obj);    
+    static bool ForkNew(PolyObject *obj, POLYUNSIGNED *owner);
+
+    // Charge the object to the retained-size profile if that is enabled.
+    // Returns the counter for anything reached from this object.
+    POLYUNSIGNED *ProfileRetained(PolyObject *obj, POLYUNSIGNED *owner)
+        { return profileMode == kProfileLiveRetained ? AddRetainedProfile(obj, owner) : owner; }
 
     PolyObject *markStack[MARK_STACK_SIZE];
     unsigned msp;
     bool active;
 
+    // For retained-size profiling each object is charged to the counter of the
+    // object from which it was first reached.  scanOwner is the counter for the
+    // object currently being scanned and ownerStack holds the counters for the
+    // objects on the mark stack.  scanDepth is zero if we are processing a root.
+    POLYUNSIGNED *scanOwner;
+    POLYUNSIGNED *ownerStack[MARK_STACK_SIZE];
+    unsigned scanDepth;
+    // The counter for the category of the roots currently being scanned.
+    POLYUNSIGNED *rootOwner;
+
     // For the typical small cell it's easier just to rescan from the start
     // but that can be expensive for large cells.  This caches the offset for
     // large cells.
@@ -178,11 +194,14 @@ inline PolyObject *FollowForwarding(PolyObject *obj)
     return obj;
 }
 
-MTGCProcessMarkPointers::MTGCProcessMarkPointers(): msp(0), active(false), locPtr(0)
+MTGCProcessMarkPointers::MTGCProcessMarkPointers(): msp(0), active(false), scanOwner(0), scanDepth(0), rootOwner(0), locPtr(0)
 {
     // Clear the mark stack
     for (unsigned i = 0; i < MARK_STACK_SIZE; i++)
+    {
         markStack[i] = 0;
+        ownerStack[i] = 0;
+    }
     // Clear the large object cache just to be sure.
     for (unsigned j = 0; j < LARGECACHE_SIZE; j++)
     {
@@ -225,7 +244,7 @@ void MTGCProcessMarkPointers::StackOverflow(PolyObject *obj)
 
 // Fork a new task.  Because we've checked nInUse without taking the lock
 // we may find that we can no longer create a new task.
-bool MTGCProcessMarkPointers::ForkNew(PolyObject *obj)
+bool MTGCProcessMarkPointers::ForkNew(PolyObject *obj, POLYUNSIGNED *owner)
 {
     MTGCProcessMarkPointers *marker = 0;
     {
@@ -242,6 +261,7 @@ bool MTGCProcessMarkPointers::ForkNew(PolyObject *obj)
         }
         ASSERT(marker != 0);
         marker->active = true;
+        marker->scanOwner = owner;
         nInUse++;
     }
     bool test = gpTaskFarm->AddWork(&MTGCProcessMarkPointers::MarkPointersTask, marker, obj);
@@ -279,6 +299,9 @@ void MTGCProcessMarkPointers::MarkPointersTask(GCTaskId *, void *arg1, void *arg
             // at any time.
             PolyObject *toSteal = steal->markStack[j];
             if (toSteal == 0) break; // Nothing more on the stack
+            // This may not match if the owning thread has changed it but
+            // the retained profile is only approximate.
+            marker->scanOwner = steal->ownerStack[j];
             // The idea here is that the original thread pushed this
             // because there were at least two addresses it needed to
             // process.  It started down one branch but left the other.
@@ -328,6 +351,7 @@ bool MTGCProcessMarkPointers::TestForScan(PolyWord *pt)
     if (OBJ_IS_BYTE_OBJECT(L))
     {
         obj->SetLengthWord(L | _OBJ_GC_MARK); // Mark it
+        (void)ProfileRetained(obj, scanOwner);
         return false; // We've done as much as we need
     }
     return true;
@@ -339,6 +363,7 @@ void MTGCProcessMarkPointers::MarkAndTestForScan(PolyWord *pt)
     {
         PolyObject *obj = (*pt).AsObjPtr();
         obj->SetLengthWord(obj->LengthWord() | _OBJ_GC_MARK);
+        (void)ProfileRetained(obj, scanOwner);
     }
 }
 
@@ -367,6 +392,9 @@ PolyObject *MTGCProcessMarkPointers::ScanObjectAddress(PolyObject *obj)
 
     if (profileMode == kProfileLiveData || (profileMode == kProfileLiveMutables && obj->IsMutable()))
         AddObjectProfile(obj);
+    // If this is a root it is charged to the root category otherwise it is
+    // a constant in the code currently being scanned.
+    POLYUNSIGNED *owner = ProfileRetained(obj, scanDepth == 0 ? rootOwner : scanOwner);
 
     POLYUNSIGNED n = OBJ_OBJECT_LENGTH(L);
     if (debugOptions & DEBUG_GC_DETAIL)
@@ -379,10 +407,13 @@ PolyObject *MTGCProcessMarkPointers::ScanObjectAddress(PolyObject *obj)
     // recursively to process a constant in a code segment.  Just push
     // it on the stack and let the caller deal with it.
     if (msp != 0)
-        PushToStack(obj); // Can't check this because it may have forwarding ptrs.
+        PushToStack(obj, owner); // Can't check this because it may have forwarding ptrs.
     else
     {
+        POLYUNSIGNED *savedOwner = scanOwner;
+        scanOwner = owner;
         MTGCProcessMarkPointers::ScanAddressesInObject(obj, L);
+        scanOwner = savedOwner;
         // We can only check after we've processed it because if we
         // have addresses left over from an incomplete partial GC they
         // may need to forwarded.
@@ -399,7 +430,11 @@ PolyObject *MTGCProcessMarkPointers::ScanObjectAddress(PolyObject *obj)
 void MTGCProcessMarkPointers::ScanRuntimeAddress(PolyObject **pt, RtsStrength weak)
 {
     if (weak == STRENGTH_WEAK) return;
+    POLYUNSIGNED *savedRoot = rootOwner;
+    if (profileMode == kProfileLiveRetained)
+        rootOwner = RetainedRootCounter(RETAINED_BY_RTS);
     *pt = ScanObjectAddress(*pt);
+    rootOwner = savedRoot;
     CheckPointer (*pt); // Check it after any forwarding pointers have been followed.
 }
 
@@ -412,6 +447,11 @@ void MTGCProcessMarkPointers::ScanAddressesInObject(PolyObject *obj, POLYUNSIGNE
     if (OBJ_IS_BYTE_OBJECT(lengthWord))
         return;
 
+    // scanOwner is the retained-profile counter for obj.  It is changed as
+    // we move through the objects so must be restored at the end.
+    POLYUNSIGNED *entryOwner = scanOwner;
+    scanDepth++;
+
     while (true)
     {
         ASSERT (OBJ_IS_LENGTH(lengthWord));
@@ -501,25 +541,28 @@ void MTGCProcessMarkPointers::ScanAddressesInObject(PolyObject *obj, POLYUNSIGNE
 
         if (baseAddr != endWord)
             // Put this back on the stack while we process the first word
-            PushToStack(obj, length < largeObjectSize ? 0 : restartAddr);
+            PushToStack(obj, scanOwner, length < largeObjectSize ? 0 : restartAddr);
         else if (secondWord != 0)
         {
             // Mark it now because we will process it.
             secondWord->SetLengthWord(secondWord->LengthWord() | _OBJ_GC_MARK);
             // Put this on the stack.  If this is a list node we will be
             // pushing the tail.
-            PushToStack(secondWord);
+            PushToStack(secondWord, ProfileRetained(secondWord, scanOwner));
         }
 
         if (firstWord != 0)
         {
             // Mark it and process it immediately.
             firstWord->SetLengthWord(firstWord->LengthWord() | _OBJ_GC_MARK);
+            scanOwner = ProfileRetained(firstWord, scanOwner);
             obj = firstWord;
         }
         else if (msp == 0)
         {
             markStack[msp] = 0; // Really finished
+            scanOwner = entryOwner;
+            scanDepth--;
             return;
         }
         else
@@ -531,6 +574,7 @@ void MTGCProcessMarkPointers::ScanAddressesInObject(PolyObject *obj, POLYUNSIGNE
             // is nothing else to do.  This is only really important
             // for large objects.
             obj = markStack[--msp]; // Pop something.
+            scanOwner = ownerStack[msp];
         }
 
         lengthWord = obj->LengthWord();
@@ -585,6 +629,8 @@ void MTGCProcessMarkPointers::MarkRoots(void)
     marker->active = true;
     nInUse = 1;
 
+    if (profileMode == kProfileLiveRetained)
+        marker->scanOwner = RetainedRootCounter(RETAINED_BY_PERMANENT);
     // Scan the permanent mutable areas.
     for (std::vector<PermanentMemSpace*>::iterator i = gMem.pSpaces.begin(); i < gMem.pSpaces.end(); i++)
     {
@@ -593,8 +639,13 @@ void MTGCProcessMarkPointers::MarkRoots(void)
             marker->ScanAddressesInRegion(space->bottom, space->top);
     }
 
-    // Scan the RTS roots.
+    // Scan the RTS roots.  Roots that don't come through ScanRuntimeAddress
+    // are thread stacks or handles.
+    if (profileMode == kProfileLiveRetained)
+        marker->rootOwner = RetainedRootCounter(RETAINED_BY_THREADS);
     GCModules(marker);
+    marker->rootOwner = 0;
+    marker->scanOwner = 0;
 
     ASSERT(marker->markStack[0] == 0);
 
@@ -663,6 +714,9 @@ bool MTGCProcessMarkPointers::RescanForStackOverflow()
     marker->active = true;
     nInUse = 1;
     bool rescan = false;
+    // We've lost track of how these objects were reached.
+    if (profileMode == kProfileLiveRetained)
+        marker->scanOwner = RetainedRootCounter(RETAINED_BY_UNKNOWN);
     Rescanner rescanner(marker);
 
     for (std::vector<LocalMemSpace*>::iterator i = gMem.lSpaces.begin(); i < gMem.lSpaces.end(); i++)
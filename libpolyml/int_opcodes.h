@@ -93,6 +93,11 @@
 #define INSTR_move_to_vec_5 0x4a    // Legacy
 #define INSTR_move_to_vec_6 0x4b    // Legacy
 #define INSTR_move_to_vec_7 0x4c    // Legacy
+// Combined instructions.  These were chosen from the most frequent sequences
+// found by building the interpreter with INTERPRETER_PROFILE_SEQUENCES.
+#define INSTR_localLocal    0x4d
+#define INSTR_localIndirect 0x4e
+#define INSTR_jump8Tagged   0x4f
 #define INSTR_reset_1       0x50
 #define INSTR_reset_2       0x51
 #define INSTR_get_store_2   0x52
@@ -129,6 +134,9 @@
 #define INSTR_callFastGtoF  0x71
 #define INSTR_callFastFFtoF 0x72
 #define INSTR_callFastFGtoF 0x73
+#define INSTR_jump8NEq      0x74
+#define INSTR_jump8NEqConst 0x75
+#define INSTR_jump8True     0x76
 #define INSTR_push_handler  0x78
 #define INSTR_realUnordered 0x79
 #define INSTR_floatUnordered 0x7a
@@ -52,8 +52,22 @@
 #include <math.h>
 #endif
 
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
 #include <cmath> // Currently just for isnan.
 
+#ifdef INTERPRETER_PROFILE_SEQUENCES
+#include <vector>
+#include <algorithm>
+#endif
+
+#ifdef INTERPRETER_JIT
+#include <vector>
+#include <map>
+#endif
+
 #include "globals.h"
 #include "int_opcodes.h"
 #include "machine_dep.h"
@@ -69,6 +83,8 @@
 #include "save_vec.h"
 #include "memmgr.h"
 #include "scanaddrs.h"
+#include "rts_module.h"
+#include "mpoly.h"
 
 #if (SIZEOF_VOIDP == 8)
 #define IS64BITS 1
@@ -78,6 +94,40 @@
 #define arg1    (pc[0] + pc[1]*256)
 #define arg2    (pc[2] + pc[3]*256)
 
+// With GCC and compatible compilers each instruction ends with its own
+// indirect jump through a table of label addresses ("labels as values").
+// These are predicted much better than the single indirect jump of the
+// switch, particularly on ARM.  The switch is still used to enter the
+// interpreter and with other compilers.  Define INTERPRETER_USE_SWITCH
+// to use the switch for every instruction.  Destructors are not run by
+// a computed goto so any object that has one, such as a PLocker, must
+// go out of scope before NEXT_INSTR.
+// Define INTERPRETER_PROFILE_SEQUENCES to count the pairs and triples of
+// instructions that are executed and print the most frequent when Poly/ML
+// exits.  This is used to choose the combined instructions that the byte code
+// generator produces.  It always uses the switch and is much slower.
+// Define INTERPRETER_JIT on X86-64 to compile frequently called functions
+// into machine code.  See InterpreterJit below.
+// When instruction profiling is turned on with the computed goto each
+// instruction jumps through countTable instead of dispatchTable so that
+// profiling costs nothing when it is off.
+#if (defined(__GNUC__) && ! defined(INTERPRETER_USE_SWITCH) && ! defined(INTERPRETER_PROFILE_SEQUENCES))
+#define USE_COMPUTED_GOTO 1
+#endif
+
+#ifdef USE_COMPUTED_GOTO
+#define CASE(x)         case x: lbl_##x
+#define DEFAULT_CASE    default: lbl_unknown
+#define NEXT_INSTR      goto *dispatch[*pc++]
+#define CHECK_INSTRUCTION_PROFILE() \
+    { countInstructions = CheckInstructionProfile(); dispatch = countInstructions ? countTable : dispatchTable; }
+#else
+#define CASE(x)         case x
+#define DEFAULT_CASE    default
+#define NEXT_INSTR      break
+#define CHECK_INSTRUCTION_PROFILE() countInstructions = CheckInstructionProfile()
+#endif
+
 const PolyWord True = TAGGED(1);
 const PolyWord False = TAGGED(0);
 const PolyWord Zero = TAGGED(0);
@@ -115,12 +165,102 @@ union realdb { double dble; POLYUNSIGNED puns[DOUBLESIZE]; };
 
 union flt { float fl; int32_t i; };
 
+#ifdef INTERPRETER_PROFILE_SEQUENCES
+// The last three opcodes executed are held in the low 24 bits.  0xff is not
+// a valid opcode so it marks an entry that has not been set.
+#define SEQUENCE_START  0xffffff
+static POLYUNSIGNED pairCounts[256*256];
+static uint32_t *tripleCounts; // 256*256*256 entries.
+static PLock sequenceLock;
+
+// Record an instruction.  The counts are not locked so they are only
+// approximate if several threads are running.
+static inline void CountSequence(unsigned &sequence, unsigned opcode)
+{
+    sequence = ((sequence << 8) | opcode) & 0xffffff;
+    if ((sequence & 0xff00) != 0xff00)
+        pairCounts[sequence & 0xffff]++;
+    if ((sequence & 0xff0000) != 0xff0000 && tripleCounts != 0 && tripleCounts[sequence] != 0xffffffff)
+        tripleCounts[sequence]++;
+}
+#endif
+
+#ifdef INTERPRETER_JIT
+// A baseline compiler that translates frequently called functions into X86-64
+// machine code by concatenating a template for each instruction.  Only the
+// simple instructions, which cannot allocate, call a function or loop, have
+// templates.  Any other instruction, or a check that fails in a template,
+// returns to the interpreter with the address of that instruction and the
+// interpreter continues from there.  The compiled code therefore only runs
+// for a short time and never while a GC is in progress.
+#if (! defined(HOSTARCHITECTURE_X86_64) || defined(POLYML32IN64))
+#error "INTERPRETER_JIT is only available on X86-64 with 64-bit words"
+#endif
+
+// The interpreter registers as seen by the compiled code.  The offsets are
+// built into the templates.
+struct JitState {
+    PolyWord    *sp;    // Offset 0
+    PolyWord    tos;    // Offset 8
+    PolyWord    *sl;    // Offset 16: The stack limit.
+};
+
+// Runs the compiled code and returns the address of the next instruction to interpret.
+typedef POLYCODEPTR (*JitCode)(JitState *);
+
+#define JIT_CACHE_SIZE  1024    // Must be a power of two.
+#define JIT_THRESHOLD   50      // Number of calls before a function is compiled.
+
+class InterpreterJit {
+public:
+    InterpreterJit(volatile bool *interrupt): interruptFlag(interrupt) { Flush(); }
+
+    // Called on each function entry.  Returns the compiled code for the function,
+    // compiling it if it has now been called often enough, or zero.  The table is
+    // direct-mapped so a function that is displaced has to be counted again.
+    JitCode Lookup(POLYCODEPTR entry)
+    {
+        JitCacheEntry &e = cache[((uintptr_t)entry >> 3) & (JIT_CACHE_SIZE-1)];
+        if (e.entry != entry)
+        {
+            e.entry = entry;
+            e.count = 0;
+            e.code = 0;
+        }
+        else if (e.code == 0 && ++e.count == JIT_THRESHOLD)
+            e.code = Compile(entry);
+        return e.code;
+    }
+
+    // Forget all the compiled code.  A full GC can free byte code and the space
+    // may then be reused for a different function.  Nothing else refers to the
+    // compiled code so the GC also frees that.
+    void Flush() { memset(cache, 0, sizeof(cache)); }
+
+private:
+    JitCode Compile(POLYCODEPTR entry);
+
+    volatile bool *interruptFlag;
+
+    struct JitCacheEntry {
+        POLYCODEPTR entry;
+        unsigned    count;
+        JitCode     code;
+    } cache[JIT_CACHE_SIZE];
+};
+#endif
+
 class IntTaskData: public TaskData {
 public:
-    IntTaskData(): interrupt_requested(false), overflowPacket(0), dividePacket(0) {}
+    IntTaskData(): interrupt_requested(false), overflowPacket(0), dividePacket(0),
+        profileStart(0), profileEnd(0), profileCount(0)
+#ifdef INTERPRETER_JIT
+        , jit(&interrupt_requested)
+#endif
+        {}
 
     virtual void GarbageCollect(ScanAddress *process);
-    void ScanStackAddress(ScanAddress *process, PolyWord &val, StackSpace *stack);
+    static void ScanStackAddress(ScanAddress *process, PolyWord &val, StackSpace *stack);
     virtual Handle EnterPolyCode(); // Start running ML
 
     // Switch to Poly and return with the io function to call.
@@ -147,13 +287,23 @@ public:
 
     virtual void addProfileCount(POLYUNSIGNED words) { add_count(this, taskPc, words); }
 
+    // Instruction profiling.
+    bool CheckInstructionProfile();
+    void CountInstruction(POLYCODEPTR pc);
+
     virtual void CopyStackFrame(StackObject *old_stack, uintptr_t old_length, StackObject *new_stack, uintptr_t new_length);
 
-    bool interrupt_requested;
+    virtual void InitFiberStack(FiberState *fiber, PolyObject *closure);
+    virtual void SaveFiberState(FiberState *fiber);
+    virtual POLYUNSIGNED LoadFiberState(FiberState *fiber);
+
+    // Set by another thread, e.g. to request a GC, and polled at function
+    // entry and on backward jumps.
+    volatile bool interrupt_requested;
 
     // Allocate memory on the heap.  Returns with the address of the cell. Does not set the
     // length word or any of the data.
-    PolyObject *allocateMemory(POLYUNSIGNED words, POLYCODEPTR &pc, PolyWord *&sp)
+    PolyObject *allocateMemory(POLYUNSIGNED words, POLYCODEPTR &pc, PolyWord *&sp, PolyWord &tos)
     {
         words++; // Add the size of the length word.
         // N.B. The allocation area may be empty so that both of these are zero.
@@ -163,21 +313,21 @@ public:
             return (PolyObject *)(this->allocPointer+1);
         }
         // Insufficient space.
-        SaveInterpreterState(pc, sp);
+        SaveInterpreterState(pc, sp, tos);
         // Find some space to allocate in. Returns a pointer to the newly allocated space.
         // N.B. This may return zero if the heap is exhausted and it has set this
         // up for an exception.  Generally it allocates by decrementing allocPointer
         // but if the required memory is large it may allocate in a separate area.
         PolyWord *space = processes->FindAllocationSpace(this, words, true);
-        LoadInterpreterState(pc, sp);
+        LoadInterpreterState(pc, sp, tos);
         if (space == 0) return 0;
         return (PolyObject *)(space+1);
     }
 
     // Put a real result in a "box"
-    PolyObject *boxDouble(double d, POLYCODEPTR &pc, PolyWord *&sp)
+    PolyObject *boxDouble(double d, POLYCODEPTR &pc, PolyWord *&sp, PolyWord &tos)
     {
-        PolyObject *mem = this->allocateMemory(DOUBLESIZE, pc, sp);
+        PolyObject *mem = this->allocateMemory(DOUBLESIZE, pc, sp, tos);
         if (mem == 0) return 0;
         mem->SetLengthWord(DOUBLESIZE, F_BYTE_OBJ);
         union realdb uniondb;
@@ -212,7 +362,7 @@ public:
         return argx.fl;
     }
 
-    PolyObject *boxFloat(float f, POLYCODEPTR &pc, PolyWord *&sp)
+    PolyObject *boxFloat(float f, POLYCODEPTR &pc, PolyWord *&sp, PolyWord &tos)
     {
         union flt argx;
         argx.fl = f;
@@ -221,9 +371,9 @@ public:
     }
 #else
     // Typically for 32-bit mode.  Use a boxed representation.
-    PolyObject *boxFloat(float f, POLYCODEPTR &pc, PolyWord *&sp)
+    PolyObject *boxFloat(float f, POLYCODEPTR &pc, PolyWord *&sp, PolyWord &tos)
     {
-        PolyObject *mem = this->allocateMemory(1, pc, sp);
+        PolyObject *mem = this->allocateMemory(1, pc, sp, tos);
         if (mem == 0) return 0;
         mem->SetLengthWord(1, F_BYTE_OBJ);
         union flt argx;
@@ -242,18 +392,22 @@ public:
 
 #endif
 
-    // Update the copies in the task object
-    void SaveInterpreterState(POLYCODEPTR pc, PolyWord *sp)
+    // Update the copies in the task object.  The value on the top of the
+    // stack is held in tos while the interpreter is running so it must be
+    // written back before anything else can look at the stack.
+    void SaveInterpreterState(POLYCODEPTR pc, PolyWord *sp, PolyWord tos)
     {
+        *sp = tos;
         taskPc = pc;
         taskSp = sp;
     }
 
     // Update the local state
-    void LoadInterpreterState(POLYCODEPTR &pc, PolyWord *&sp)
+    void LoadInterpreterState(POLYCODEPTR &pc, PolyWord *&sp, PolyWord &tos)
     {
         pc = taskPc;
         sp = taskSp;
+        tos = *sp;
     }
 
     POLYCODEPTR     taskPc; /* Program counter. */
@@ -264,6 +418,16 @@ public:
     PolyWord        *sl; /* Stack limit register. */
 
     PolyObject      *overflowPacket, *dividePacket;
+
+    // The code object containing the instructions most recently counted
+    // for instruction profiling and the number counted since execution
+    // entered it.
+    POLYCODEPTR     profileStart, profileEnd;
+    POLYUNSIGNED    profileCount;
+
+#ifdef INTERPRETER_JIT
+    InterpreterJit  jit;
+#endif
 };
 
 // This lock is used to synchronise all atomic operations.
@@ -281,6 +445,7 @@ public:
     // Create a task data object.
     virtual TaskData *CreateTaskData(void) { return new IntTaskData(); }
     virtual Architectures MachineArchitecture(void) { return MA_Interpreted; }
+    virtual void ScanFiberStack(ScanAddress *process, FiberState *fiber);
 };
 
 void IntTaskData::InitStackFrame(TaskData *parentTask, Handle proc, Handle arg)
@@ -314,6 +479,56 @@ void IntTaskData::InitStackFrame(TaskData *parentTask, Handle proc, Handle arg)
     dividePacket = makeExceptionPacket(parentTask, EXC_divide);
 }
 
+// Set up a fiber stack in the same way as InitStackFrame except that the
+// stack pointer is left pointing at the closure.  LoadFiberState returns the
+// closure as the result of the RTS call so that the interpreter pushes it back
+// and then enters the function.
+void IntTaskData::InitFiberStack(FiberState *fiber, PolyObject *closure)
+{
+    PolyWord *sp = fiber->stack->top;
+    sp--;
+    *sp = PolyWord::FromStackAddr(sp);
+    *(--sp) = SPECIAL_PC_END_THREAD;
+    fiber->handler = sp;
+    *(--sp) = TAGGED(0); // Unit argument
+    *(--sp) = SPECIAL_PC_END_THREAD;
+    *(--sp) = closure;
+    fiber->stackPtr = sp;
+    fiber->pc = closure->Get(0).AsCodePtr();
+    fiber->started = false;
+}
+
+// Called from within an RTS call so the saved state is the point
+// the interpreter will return to.
+void IntTaskData::SaveFiberState(FiberState *fiber)
+{
+    fiber->stack = this->stack;
+    fiber->stackPtr = this->taskSp;
+    fiber->handler = this->hr;
+    fiber->pc = this->taskPc;
+    fiber->started = true;
+}
+
+POLYUNSIGNED IntTaskData::LoadFiberState(FiberState *fiber)
+{
+    this->stack = fiber->stack;
+    this->taskSp = fiber->stackPtr;
+    this->hr = fiber->handler;
+    this->taskPc = fiber->pc;
+    this->sl = (PolyWord*)this->stack->stack() + OVERFLOW_STACK_SIZE;
+    if (fiber->started)
+        return TAGGED(0).AsUnsigned();
+    // First entry: pop the closure and return it.
+    fiber->started = true;
+    return (*this->taskSp++).AsUnsigned();
+}
+
+void Interpreter::ScanFiberStack(ScanAddress *process, FiberState *fiber)
+{
+    for (PolyWord *q = fiber->stackPtr; q < fiber->stack->top; q++)
+        IntTaskData::ScanStackAddress(process, *q, fiber->stack);
+}
+
 extern "C" {
     typedef POLYUNSIGNED(*callFastRts0)();
     typedef POLYUNSIGNED(*callFastRts1)(intptr_t);
@@ -365,51 +580,194 @@ int IntTaskData::SwitchToPoly()
     // it is important that access should be fast.
     POLYCODEPTR     pc;
     PolyWord        *sp;
+    // The value on the top of the stack.  This is kept in a local rather than
+    // in *sp so that most instructions do not have to load and store it.  The
+    // word at *sp is only written when tos is pushed down by another value
+    // or by SaveInterpreterState.  Everything below the top is always in memory.
+    PolyWord        tos;
     double          dv;
 
-    LoadInterpreterState(pc, sp);
+#ifdef USE_COMPUTED_GOTO
+    // The address of the code for each instruction in opcode order.  Opcodes
+    // without an instruction go to the default case.
+#ifdef IS64BITS
+#define LABEL64(x) &&lbl_##x
+#else
+#define LABEL64(x) &&lbl_unknown
+#endif
+    static void * const dispatchTable[256] =
+    {
+        /* 0x00 */ &&lbl_INSTR_enter_int, &&lbl_unknown, &&lbl_INSTR_jump8, &&lbl_INSTR_jump8false,
+        /* 0x04 */ &&lbl_unknown, &&lbl_unknown, &&lbl_INSTR_alloc_ref, &&lbl_unknown,
+        /* 0x08 */ &&lbl_unknown, &&lbl_unknown, &&lbl_INSTR_case16, &&lbl_INSTR_stack_container,
+        /* 0x0c */ &&lbl_INSTR_call_closure, &&lbl_INSTR_return_w, &&lbl_INSTR_pad, &&lbl_unknown,
+        /* 0x10 */ &&lbl_INSTR_raise_ex, &&lbl_INSTR_get_store_w, &&lbl_unknown, &&lbl_INSTR_local_w,
+        /* 0x14 */ &&lbl_INSTR_indirect_w, &&lbl_INSTR_move_to_vec_w, &&lbl_unknown, &&lbl_INSTR_set_stack_val_w,
+        /* 0x18 */ &&lbl_INSTR_reset_w, &&lbl_INSTR_reset_r_w, &&lbl_INSTR_constAddr16, &&lbl_INSTR_const_int_w,
+        /* 0x1c */ &&lbl_INSTR_callFastRRtoR, &&lbl_INSTR_callFastRGtoR, &&lbl_INSTR_jump_back8, &&lbl_INSTR_return_b,
+        /* 0x20 */ &&lbl_INSTR_jump_back16, &&lbl_INSTR_get_store_b, &&lbl_INSTR_local_b, &&lbl_INSTR_indirect_b,
+        /* 0x24 */ &&lbl_INSTR_move_to_vec_b, &&lbl_INSTR_set_stack_val_b, &&lbl_INSTR_reset_b, &&lbl_INSTR_reset_r_b,
+        /* 0x28 */ &&lbl_INSTR_const_int_b, &&lbl_INSTR_local_0, &&lbl_INSTR_local_1, &&lbl_INSTR_local_2,
+        /* 0x2c */ &&lbl_INSTR_local_3, &&lbl_INSTR_local_4, &&lbl_INSTR_local_5, &&lbl_INSTR_local_6,
+        /* 0x30 */ &&lbl_INSTR_local_7, &&lbl_INSTR_local_8, &&lbl_INSTR_local_9, &&lbl_INSTR_local_10,
+        /* 0x34 */ &&lbl_INSTR_local_11, &&lbl_INSTR_indirect_0, &&lbl_INSTR_indirect_1, &&lbl_INSTR_indirect_2,
+        /* 0x38 */ &&lbl_INSTR_indirect_3, &&lbl_INSTR_indirect_4, &&lbl_INSTR_indirect_5, &&lbl_INSTR_const_0,
+        /* 0x3c */ &&lbl_INSTR_const_1, &&lbl_INSTR_const_2, &&lbl_INSTR_const_3, &&lbl_INSTR_const_4,
+        /* 0x40 */ &&lbl_INSTR_const_10, &&lbl_INSTR_return_0, &&lbl_INSTR_return_1, &&lbl_INSTR_return_2,
+        /* 0x44 */ &&lbl_INSTR_return_3, &&lbl_INSTR_move_to_vec_0, &&lbl_INSTR_move_to_vec_1, &&lbl_INSTR_move_to_vec_2,
+        /* 0x48 */ &&lbl_INSTR_move_to_vec_3, &&lbl_INSTR_move_to_vec_4, &&lbl_INSTR_move_to_vec_5, &&lbl_INSTR_move_to_vec_6,
+        /* 0x4c */ &&lbl_INSTR_move_to_vec_7, &&lbl_INSTR_localLocal, &&lbl_INSTR_localIndirect, &&lbl_INSTR_jump8Tagged,
+        /* 0x50 */ &&lbl_INSTR_reset_1, &&lbl_INSTR_reset_2, &&lbl_INSTR_get_store_2, &&lbl_INSTR_get_store_3,
+        /* 0x54 */ &&lbl_INSTR_get_store_4, &&lbl_INSTR_tuple_container, &&lbl_INSTR_floatAbs, &&lbl_INSTR_floatNeg,
+        /* 0x58 */ &&lbl_INSTR_fixedIntToFloat, &&lbl_INSTR_floatToReal, &&lbl_INSTR_realToFloat, &&lbl_INSTR_floatEqual,
+        /* 0x5c */ &&lbl_INSTR_floatLess, &&lbl_INSTR_floatLessEq, &&lbl_INSTR_floatGreater, &&lbl_INSTR_floatGreaterEq,
+        /* 0x60 */ &&lbl_INSTR_floatAdd, &&lbl_INSTR_floatSub, &&lbl_INSTR_floatMult, &&lbl_INSTR_floatDiv,
+        /* 0x64 */ &&lbl_INSTR_reset_r_1, &&lbl_INSTR_reset_r_2, &&lbl_INSTR_reset_r_3, &&lbl_INSTR_tuple_w,
+        /* 0x68 */ &&lbl_INSTR_tuple_b, &&lbl_INSTR_tuple_2, &&lbl_INSTR_tuple_3, &&lbl_INSTR_tuple_4,
+        /* 0x6c */ &&lbl_INSTR_lock, &&lbl_INSTR_ldexc, &&lbl_INSTR_realToInt, &&lbl_INSTR_floatToInt,
+        /* 0x70 */ &&lbl_INSTR_callFastFtoF, &&lbl_INSTR_callFastGtoF, &&lbl_INSTR_callFastFFtoF, &&lbl_INSTR_callFastFGtoF,
+        /* 0x74 */ &&lbl_INSTR_jump8NEq, &&lbl_INSTR_jump8NEqConst, &&lbl_INSTR_jump8True, &&lbl_unknown,
+        /* 0x78 */ &&lbl_INSTR_push_handler, &&lbl_INSTR_realUnordered, &&lbl_INSTR_floatUnordered, &&lbl_INSTR_tail_b_b,
+        /* 0x7c */ &&lbl_INSTR_tail, &&lbl_INSTR_tail_3_b, &&lbl_INSTR_tail_4_b, &&lbl_INSTR_tail_3_2,
+        /* 0x80 */ &&lbl_INSTR_tail_3_3, &&lbl_INSTR_setHandler8, &&lbl_unknown, &&lbl_INSTR_callFastRTS0,
+        /* 0x84 */ &&lbl_INSTR_callFastRTS1, &&lbl_INSTR_callFastRTS2, &&lbl_INSTR_callFastRTS3, &&lbl_INSTR_callFastRTS4,
+        /* 0x88 */ &&lbl_INSTR_callFastRTS5, &&lbl_INSTR_callFullRTS0, &&lbl_INSTR_callFullRTS1, &&lbl_INSTR_callFullRTS2,
+        /* 0x8c */ &&lbl_INSTR_callFullRTS3, &&lbl_unknown, &&lbl_unknown, &&lbl_INSTR_callFastRtoR,
+        /* 0x90 */ &&lbl_INSTR_callFastGtoR, &&lbl_INSTR_notBoolean, &&lbl_INSTR_isTagged, &&lbl_INSTR_cellLength,
+        /* 0x94 */ &&lbl_INSTR_cellFlags, &&lbl_INSTR_clearMutable, &&lbl_INSTR_stringLength, &&lbl_INSTR_atomicIncr,
+        /* 0x98 */ &&lbl_INSTR_atomicDecr, &&lbl_INSTR_atomicReset, &&lbl_INSTR_longWToTagged, &&lbl_INSTR_signedToLongW,
+        /* 0x9c */ &&lbl_INSTR_unsignedToLongW, &&lbl_INSTR_realAbs, &&lbl_INSTR_realNeg, &&lbl_INSTR_fixedIntToReal,
+        /* 0xa0 */ &&lbl_INSTR_equalWord, &&lbl_unknown, &&lbl_INSTR_lessSigned, &&lbl_INSTR_lessUnsigned,
+        /* 0xa4 */ &&lbl_INSTR_lessEqSigned, &&lbl_INSTR_lessEqUnsigned, &&lbl_INSTR_greaterSigned, &&lbl_INSTR_greaterUnsigned,
+        /* 0xa8 */ &&lbl_INSTR_greaterEqSigned, &&lbl_INSTR_greaterEqUnsigned, &&lbl_INSTR_fixedAdd, &&lbl_INSTR_fixedSub,
+        /* 0xac */ &&lbl_INSTR_fixedMult, &&lbl_INSTR_fixedQuot, &&lbl_INSTR_fixedRem, &&lbl_unknown,
+        /* 0xb0 */ &&lbl_unknown, &&lbl_INSTR_wordAdd, &&lbl_INSTR_wordSub, &&lbl_INSTR_wordMult,
+        /* 0xb4 */ &&lbl_INSTR_wordDiv, &&lbl_INSTR_wordMod, &&lbl_unknown, &&lbl_INSTR_wordAnd,
+        /* 0xb8 */ &&lbl_INSTR_wordOr, &&lbl_INSTR_wordXor, &&lbl_INSTR_wordShiftLeft, &&lbl_INSTR_wordShiftRLog,
+        /* 0xbc */ &&lbl_INSTR_wordShiftRArith, &&lbl_INSTR_allocByteMem, &&lbl_INSTR_lgWordEqual, &&lbl_unknown,
+        /* 0xc0 */ &&lbl_INSTR_lgWordLess, &&lbl_INSTR_lgWordLessEq, &&lbl_INSTR_lgWordGreater, &&lbl_INSTR_lgWordGreaterEq,
+        /* 0xc4 */ &&lbl_INSTR_lgWordAdd, &&lbl_INSTR_lgWordSub, &&lbl_INSTR_lgWordMult, &&lbl_INSTR_lgWordDiv,
+        /* 0xc8 */ &&lbl_INSTR_lgWordMod, &&lbl_INSTR_lgWordAnd, &&lbl_INSTR_lgWordOr, &&lbl_INSTR_lgWordXor,
+        /* 0xcc */ &&lbl_INSTR_lgWordShiftLeft, &&lbl_INSTR_lgWordShiftRLog, &&lbl_INSTR_lgWordShiftRArith, &&lbl_INSTR_realEqual,
+        /* 0xd0 */ &&lbl_unknown, &&lbl_INSTR_realLess, &&lbl_INSTR_realLessEq, &&lbl_INSTR_realGreater,
+        /* 0xd4 */ &&lbl_INSTR_realGreaterEq, &&lbl_INSTR_realAdd, &&lbl_INSTR_realSub, &&lbl_INSTR_realMult,
+        /* 0xd8 */ &&lbl_INSTR_realDiv, &&lbl_INSTR_getThreadId, &&lbl_INSTR_allocWordMemory, &&lbl_INSTR_loadMLWord,
+        /* 0xdc */ &&lbl_INSTR_loadMLByte, &&lbl_INSTR_loadC8, &&lbl_INSTR_loadC16, &&lbl_INSTR_loadC32,
+        /* 0xe0 */ LABEL64(INSTR_loadC64), &&lbl_INSTR_loadCFloat, &&lbl_INSTR_loadCDouble, &&lbl_INSTR_storeMLWord,
+        /* 0xe4 */ &&lbl_INSTR_storeMLByte, &&lbl_INSTR_storeC8, &&lbl_INSTR_storeC16, &&lbl_INSTR_storeC32,
+        /* 0xe8 */ LABEL64(INSTR_storeC64), &&lbl_INSTR_storeCFloat, &&lbl_INSTR_storeCDouble, &&lbl_INSTR_blockMoveWord,
+        /* 0xec */ &&lbl_INSTR_blockMoveByte, &&lbl_INSTR_blockEqualByte, &&lbl_INSTR_blockCompareByte, &&lbl_INSTR_loadUntagged,
+        /* 0xf0 */ &&lbl_INSTR_storeUntagged, &&lbl_INSTR_deleteHandler, &&lbl_INSTR_jump32, &&lbl_INSTR_jump32False,
+        /* 0xf4 */ &&lbl_INSTR_constAddr32, &&lbl_INSTR_setHandler32, &&lbl_INSTR_case32, &&lbl_INSTR_jump16,
+        /* 0xf8 */ &&lbl_INSTR_jump16false, &&lbl_INSTR_setHandler16, &&lbl_INSTR_constAddr8, &&lbl_INSTR_stackSize8,
+        /* 0xfc */ &&lbl_INSTR_stackSize16, &&lbl_unknown, &&lbl_unknown, &&lbl_unknown
+    };
+#define COUNT4  &&lbl_countInstruction, &&lbl_countInstruction, &&lbl_countInstruction, &&lbl_countInstruction
+#define COUNT16 COUNT4, COUNT4, COUNT4, COUNT4
+#define COUNT64 COUNT16, COUNT16, COUNT16, COUNT16
+    static void * const countTable[256] = { COUNT64, COUNT64, COUNT64, COUNT64 };
+    void * const *dispatch;
+#endif
+    bool countInstructions;
+
+    LoadInterpreterState(pc, sp, tos);
+    CHECK_INSTRUCTION_PROFILE();
 
     sl = (PolyWord*)this->stack->stack() + OVERFLOW_STACK_SIZE;
 
+#ifdef INTERPRETER_PROFILE_SEQUENCES
+    unsigned sequence = SEQUENCE_START;
+    if (tripleCounts == 0)
+    {
+        PLocker l(&sequenceLock);
+        if (tripleCounts == 0)
+            tripleCounts = (uint32_t*)calloc(256*256*256, sizeof(uint32_t));
+    }
+#endif
+
     // We may have taken an interrupt which has set an exception.
     if (this->raiseException) goto RAISE_EXCEPTION;
 
     for(;;){ /* Each instruction */
 //        char buff[1000];
-//        sprintf(buff, "addr = %p sp=%p instr=%02x *sp=%p\n", pc, sp, *pc, (*sp).AsStackAddr());
+//        sprintf(buff, "addr = %p sp=%p instr=%02x tos=%p\n", pc, sp, *pc, tos.AsStackAddr());
 //        OutputDebugStringA(buff);
+#ifdef INTERPRETER_PROFILE_SEQUENCES
+        CountSequence(sequence, *pc);
+#endif
+        if (countInstructions) CountInstruction(pc);
 
         switch(*pc++) {
 
-        case INSTR_enter_int: pc++; /* Skip the argument. */ break;
+        CASE(INSTR_enter_int): pc++; /* Skip the argument. */ NEXT_INSTR;
 
-        case INSTR_jump8false:
+        CASE(INSTR_jump8false):
             {
-                PolyWord u = *sp++; /* Pop argument */
-                if (u == True) { pc += 1; break; }
+                PolyWord u = tos; /* Pop argument */
+                tos = *(++sp);
+                if (u == True) { pc += 1; NEXT_INSTR; }
                 /* else - false - take the jump */
             }
 
-        case INSTR_jump8: pc += *pc + 1; break;
+        CASE(INSTR_jump8): pc += *pc + 1; NEXT_INSTR;
+
+        // Combined equalWord and jump8false.
+        CASE(INSTR_jump8NEq):
+            {
+                PolyWord u = tos;
+                PolyWord v = *(++sp);
+                tos = *(++sp);
+                if (u == v) pc += 1; else pc += *pc + 1;
+                NEXT_INSTR;
+            }
+
+        // Combined push of a short constant, equalWord and jump8false.
+        CASE(INSTR_jump8NEqConst):
+            {
+                PolyWord u = tos;
+                tos = *(++sp);
+                if (u == TAGGED(pc[0])) pc += 2; else pc += pc[1] + 2;
+                NEXT_INSTR;
+            }
+
+        // Combined notBoolean and jump8false.
+        CASE(INSTR_jump8True):
+            {
+                PolyWord u = tos;
+                tos = *(++sp);
+                if (u == True) pc += *pc + 1; else pc += 1;
+                NEXT_INSTR;
+            }
+
+        // Combined isTagged, notBoolean and jump8false.
+        CASE(INSTR_jump8Tagged):
+            {
+                PolyWord u = tos;
+                tos = *(++sp);
+                if (u.IsTagged()) pc += *pc + 1; else pc += 1;
+                NEXT_INSTR;
+            }
 
-        case INSTR_jump16false:
+        CASE(INSTR_jump16false):
         {
-            PolyWord u = *sp++; /* Pop argument */
-            if (u == True) { pc += 2; break; }
+            PolyWord u = tos; /* Pop argument */
+            tos = *(++sp);
+            if (u == True) { pc += 2; NEXT_INSTR; }
             /* else - false - take the jump */
         }
 
-        case INSTR_jump16:
-            pc += arg1 + 2; break;
+        CASE(INSTR_jump16):
+            pc += arg1 + 2; NEXT_INSTR;
 
-        case INSTR_jump32False:
+        CASE(INSTR_jump32False):
         {
-            PolyWord u = *sp++; /* Pop argument */
-            if (u == True) { pc += 4; break; }
+            PolyWord u = tos; /* Pop argument */
+            tos = *(++sp);
+            if (u == True) { pc += 4; NEXT_INSTR; }
             /* else - false - take the jump */
         }
 
-        case INSTR_jump32:
+        CASE(INSTR_jump32):
         {
             // This is a 32-bit signed quantity on both 64-bits and 32-bits.
             POLYSIGNED offset = pc[3] & 0x80 ? -1 : 0;
@@ -418,105 +776,117 @@ int IntTaskData::SwitchToPoly()
             offset = (offset << 8) | pc[1];
             offset = (offset << 8) | pc[0];
             pc += offset + 4;
-            break;
+            NEXT_INSTR;
         }
 
-        case INSTR_push_handler: /* Save the old handler value. */
-            *(--sp) = PolyWord::FromStackAddr(this->hr); /* Push old handler */
-            break;
+        CASE(INSTR_push_handler): /* Save the old handler value. */
+            *sp-- = tos;
+            tos = PolyWord::FromStackAddr(this->hr); /* Push old handler */
+            NEXT_INSTR;
 
-        case INSTR_setHandler8: /* Set up a handler */
-            *(--sp) = PolyWord::FromCodePtr(pc + *pc + 1); /* Address of handler */
+        CASE(INSTR_setHandler8): /* Set up a handler */
+            *sp-- = tos;
+            // The handler address is read through hr so it must be stored.
+            *sp = tos = PolyWord::FromCodePtr(pc + *pc + 1); /* Address of handler */
             this->hr = sp;
             pc += 1;
-            break;
+            NEXT_INSTR;
 
-        case INSTR_setHandler16: /* Set up a handler */
-            *(--sp) = PolyWord::FromCodePtr(pc + arg1 + 2); /* Address of handler */
+        CASE(INSTR_setHandler16): /* Set up a handler */
+            *sp-- = tos;
+            *sp = tos = PolyWord::FromCodePtr(pc + arg1 + 2); /* Address of handler */
             this->hr = sp;
             pc += 2;
-            break;
+            NEXT_INSTR;
 
-        case INSTR_setHandler32: /* Set up a handler */
+        CASE(INSTR_setHandler32): /* Set up a handler */
         {
             POLYUNSIGNED offset = pc[0] + (pc[1] << 8) + (pc[2] << 16) + (pc[3] << 24);
-            *(--sp) = PolyWord::FromCodePtr(pc + offset + 4); /* Address of handler */
+            *sp-- = tos;
+            *sp = tos = PolyWord::FromCodePtr(pc + offset + 4); /* Address of handler */
             this->hr = sp;
             pc += 4;
-            break;
+            NEXT_INSTR;
         }
 
-        case INSTR_deleteHandler: /* Delete handler retaining the result. */
+        CASE(INSTR_deleteHandler): /* Delete handler retaining the result. */
         {
-            PolyWord u = *sp++;
             sp = this->hr;
             sp++; // Remove handler entry point
             this->hr = (*sp).AsStackAddr(); // Restore old handler
-            *sp = u; // Put back the result
-            break;
+            // The result replaces the old handler and is already in tos.
+            NEXT_INSTR;
         }
 
-        case INSTR_case16:
+        CASE(INSTR_case16):
             {
                 // arg1 is the largest value that is in the range
-                POLYSIGNED u = UNTAGGED(*sp++); /* Get the value */
+                POLYSIGNED u = UNTAGGED(tos); /* Get the value */
+                tos = *(++sp);
                 if (u > arg1 || u < 0) pc += (arg1+2)*2; /* Out of range */
                 else {
                     pc += 2;
                     pc += /* Index */pc[u*2]+pc[u*2 + 1]*256; }
-                break;
+                NEXT_INSTR;
             }
 
-        case INSTR_case32:
+        CASE(INSTR_case32):
         {
             // arg1 is the number of cases i.e. one more than the largest value
             // This is followed by that number of 32-bit offsets.
             // If the value is out of range the default case is immediately after the table.
-            POLYSIGNED u = UNTAGGED(*sp++); /* Get the value */
+            POLYSIGNED u = UNTAGGED(tos); /* Get the value */
+            tos = *(++sp);
             if (u >= arg1 || u < 0) pc += 2 + arg1 * 4; /* Out of range */
             else
             {
                 pc += 2;
                 pc += /* Index */pc[u*4] + (pc[u*4+1] << 8) + (pc[u*4+2] << 16) + (pc[u*4+3] << 24);
             }
-            break;
+            NEXT_INSTR;
         }
 
-        case INSTR_tail_3_b:
+        CASE(INSTR_tail_3_b):
+           *sp = tos;
            tailCount = 3;
            tailPtr = sp + tailCount;
            sp = tailPtr + *pc;
            goto TAIL_CALL;
 
-        case INSTR_tail_3_2:
+        CASE(INSTR_tail_3_2):
+           *sp = tos;
            tailCount = 3;
            tailPtr = sp + tailCount;
            sp = tailPtr + 2;
            goto TAIL_CALL;
 
-        case INSTR_tail_3_3:
+        CASE(INSTR_tail_3_3):
+           *sp = tos;
            tailCount = 3;
            tailPtr = sp + tailCount;
            sp = tailPtr + 3;
            goto TAIL_CALL;
 
-        case INSTR_tail_4_b:
+        CASE(INSTR_tail_4_b):
+           *sp = tos;
            tailCount = 4;
            tailPtr = sp + tailCount;
            sp = tailPtr + *pc;
            goto TAIL_CALL;
 
-        case INSTR_tail_b_b:
+        CASE(INSTR_tail_b_b):
+           *sp = tos;
            tailCount = *pc;
            tailPtr = sp + tailCount;
            sp = tailPtr + pc[1];
            goto TAIL_CALL;
 
-        case INSTR_tail:
+        CASE(INSTR_tail):
            /* Tail recursive call. */
            /* Move items up the stack. */
            /* There may be an overlap if the function we are calling
               has more args than this one. */
+           *sp = tos;
            tailCount = arg1;
            tailPtr = sp + tailCount;
            sp = tailPtr + arg2;
@@ -524,47 +894,57 @@ int IntTaskData::SwitchToPoly()
            if (tailCount < 2) Crash("Invalid argument\n");
            for (; tailCount > 0; tailCount--) *(--sp) = *(--tailPtr);
            pc = (*sp++).AsCodePtr(); /* Pop the original return address. */
+           tos = *sp;
            /* And drop through. */
 
-        case INSTR_call_closure: /* Closure call. */
+        CASE(INSTR_call_closure): /* Closure call. */
         {
-            PolyObject *closure = (*sp).AsObjPtr();
-            POLYCODEPTR newPc = (*sp).AsObjPtr()->Get(0).AsCodePtr();
-            sp--;
-            *sp = sp[1];      /* Move closure up. */
-            sp[1] = PolyWord::FromCodePtr(pc); /* Save return address. */
+            POLYCODEPTR newPc = tos.AsObjPtr()->Get(0).AsCodePtr();
+            *sp-- = PolyWord::FromCodePtr(pc); /* Save return address.  The closure moves up and stays in tos. */
             pc = newPc;    /* Get entry point. */
+#ifdef INTERPRETER_JIT
+            JitCode jitCode = countInstructions ? 0 : jit.Lookup(pc);
+            if (jitCode != 0)
+            {
+                JitState state;
+                state.sp = sp;
+                state.tos = tos;
+                state.sl = sl;
+                pc = jitCode(&state);
+                sp = state.sp;
+                tos = state.tos;
+            }
+#endif
             this->taskPc = pc; // Update in case we're profiling
-            break;
+            NEXT_INSTR;
         }
 
-        case INSTR_return_w:
+        CASE(INSTR_return_w):
             returnCount = arg1; /* Get no. of args to remove. */
 
             RETURN: /* Common code for return. */
             {
-                PolyWord result = *sp++; /* Result */
-                sp++; /* Remove the link/closure */
-                pc = (*sp++).AsCodePtr(); /* Return address */
-                sp += returnCount; /* Add on number of args. */
+                // The result is in tos.  Remove the link/closure, the return
+                // address and the arguments and put the result in place of the last.
+                pc = sp[2].AsCodePtr(); /* Return address */
+                sp += returnCount + 2;
                 if (pc == SPECIAL_PC_END_THREAD.AsCodePtr())
                     exitThread(this); // This thread is exiting.
-                *(--sp) = result; /* Result */
                 this->taskPc = pc; // Update in case we're profiling
             }
-            break;
+            NEXT_INSTR;
 
-        case INSTR_return_b: returnCount = *pc; goto RETURN;
-        case INSTR_return_0: returnCount = 0; goto RETURN;
-        case INSTR_return_1: returnCount = 1; goto RETURN;
-        case INSTR_return_2: returnCount = 2; goto RETURN;
-        case INSTR_return_3: returnCount = 3; goto RETURN;
+        CASE(INSTR_return_b): returnCount = *pc; goto RETURN;
+        CASE(INSTR_return_0): returnCount = 0; goto RETURN;
+        CASE(INSTR_return_1): returnCount = 1; goto RETURN;
+        CASE(INSTR_return_2): returnCount = 2; goto RETURN;
+        CASE(INSTR_return_3): returnCount = 3; goto RETURN;
 
-        case INSTR_stackSize8:
+        CASE(INSTR_stackSize8):
             stackCheck = *pc++;
             goto STACKCHECK;
 
-        case INSTR_stackSize16:
+        CASE(INSTR_stackSize16):
         {
             stackCheck = arg1; pc += 2;
         STACKCHECK:
@@ -572,9 +952,9 @@ int IntTaskData::SwitchToPoly()
             if (sp - stackCheck < sl)
             {
                 uintptr_t min_size = (this->stack->top - (PolyWord*)sp) + OVERFLOW_STACK_SIZE + stackCheck;
-                SaveInterpreterState(pc, sp);
+                SaveInterpreterState(pc, sp, tos);
                 CheckAndGrowStack(this, min_size);
-                LoadInterpreterState(pc, sp);
+                LoadInterpreterState(pc, sp, tos);
                 sl = (PolyWord*)this->stack->stack() + OVERFLOW_STACK_SIZE;
             }
             // Also check for interrupts
@@ -582,1223 +962,1331 @@ int IntTaskData::SwitchToPoly()
             {
                 // Check for interrupts
                 this->interrupt_requested = false;
-                SaveInterpreterState(pc, sp);
+                SaveInterpreterState(pc, sp, tos);
                 return -1;
             }
-            break;
+            NEXT_INSTR;
         }
 
-        case INSTR_pad: /* No-op */ break;
+        CASE(INSTR_pad): /* No-op */ NEXT_INSTR;
 
-        case INSTR_raise_ex:
+        CASE(INSTR_raise_ex):
         {
             RAISE_EXCEPTION:
             this->raiseException = false;
-            PolyException *exn = (PolyException*)((*sp).AsObjPtr());
+            PolyException *exn = (PolyException*)(tos.AsObjPtr());
             this->exception_arg = exn; /* Get exception data */
             sp = this->hr;
             if (*sp == SPECIAL_PC_END_THREAD)
                 exitThread(this);  // Default handler for thread.
             pc = (*sp++).AsCodePtr();
             this->hr = (*sp++).AsStackAddr();
-            break;
+            tos = *sp;
+            NEXT_INSTR;
         }
 
-        case INSTR_get_store_w:
+        CASE(INSTR_get_store_w):
         // Get_store is now only used for mutually recursive closures.  It allocates mutable store
         // initialised to zero.
         {
             storeWords = arg1;
             pc += 2;
             GET_STORE:
-            PolyObject *p = this->allocateMemory(storeWords, pc, sp);
+            PolyObject *p = this->allocateMemory(storeWords, pc, sp, tos);
             if (p == 0) goto RAISE_EXCEPTION;
             p->SetLengthWord(storeWords, F_MUTABLE_BIT);
             for(; storeWords > 0; ) p->Set(--storeWords, TAGGED(0)); /* Must initialise store! */
-            *(--sp) = (PolyWord)p;
-            break;
+            *sp-- = tos;
+            tos = (PolyWord)p;
+            NEXT_INSTR;
         }
 
-        case INSTR_get_store_2: storeWords = 2; goto GET_STORE;
-        case INSTR_get_store_3: storeWords = 3; goto GET_STORE;
-        case INSTR_get_store_4: storeWords = 4; goto GET_STORE;
-        case INSTR_get_store_b: storeWords = *pc; pc++; goto GET_STORE;
+        CASE(INSTR_get_store_2): storeWords = 2; goto GET_STORE;
+        CASE(INSTR_get_store_3): storeWords = 3; goto GET_STORE;
+        CASE(INSTR_get_store_4): storeWords = 4; goto GET_STORE;
+        CASE(INSTR_get_store_b): storeWords = *pc; pc++; goto GET_STORE;
 
-        case INSTR_tuple_w:
+        CASE(INSTR_tuple_w):
         {
             storeWords = arg1; pc += 2;
         TUPLE: /* Common code for tupling. */
-            PolyObject *p = this->allocateMemory(storeWords, pc, sp);
+            PolyObject *p = this->allocateMemory(storeWords, pc, sp, tos);
             if (p == 0) goto RAISE_EXCEPTION; // Exception
             p->SetLengthWord(storeWords, 0);
-            for(; storeWords > 0; ) p->Set(--storeWords, *sp++);
-            *(--sp) = (PolyWord)p;
-            break;
+            // The last field is in tos.  The tuple replaces the first.
+            p->Set(--storeWords, tos);
+            for(; storeWords > 0; ) p->Set(--storeWords, *(++sp));
+            tos = (PolyWord)p;
+            NEXT_INSTR;
         }
 
-        case INSTR_tuple_2: storeWords = 2; goto TUPLE;
-        case INSTR_tuple_3: storeWords = 3; goto TUPLE;
-        case INSTR_tuple_4: storeWords = 4; goto TUPLE;
-        case INSTR_tuple_b: storeWords = *pc; pc++; goto TUPLE;
+        CASE(INSTR_tuple_2): storeWords = 2; goto TUPLE;
+        CASE(INSTR_tuple_3): storeWords = 3; goto TUPLE;
+        CASE(INSTR_tuple_4): storeWords = 4; goto TUPLE;
+        CASE(INSTR_tuple_b): storeWords = *pc; pc++; goto TUPLE;
 
-        case INSTR_local_w:
+        CASE(INSTR_local_w):
             {
-                PolyWord u = sp[arg1];
-                *(--sp) = u;
+                // Store tos first because the local may be the top of the stack.
+                *sp = tos;
+                tos = sp[arg1];
+                sp--;
                 pc += 2;
-                break;
+                NEXT_INSTR;
             }
 
-        case INSTR_indirect_w:
-            *sp = (*sp).AsObjPtr()->Get(arg1); pc += 2; break;
+        CASE(INSTR_indirect_w):
+            tos = tos.AsObjPtr()->Get(arg1); pc += 2; NEXT_INSTR;
 
-        case INSTR_move_to_vec_w:
+        CASE(INSTR_move_to_vec_w):
             {
-                PolyWord u = *sp++;
-                (*sp).AsObjPtr()->Set(arg1, u);
+                PolyWord u = tos;
+                tos = *(++sp);
+                tos.AsObjPtr()->Set(arg1, u);
                 pc += 2;
-                break;
+                NEXT_INSTR;
             }
 
-        case INSTR_set_stack_val_w:
+        CASE(INSTR_set_stack_val_w):
             {
-                PolyWord u = *sp++;
+                PolyWord u = tos;
+                sp++;
                 sp[arg1-1] = u;
+                tos = *sp;
                 pc += 2;
-                break;
+                NEXT_INSTR;
             }
 
-        case INSTR_reset_w: sp += arg1; pc += 2; break;
+        CASE(INSTR_reset_w): sp += arg1; tos = *sp; pc += 2; NEXT_INSTR;
 
-        case INSTR_reset_r_w:
-            {
-                PolyWord u = *sp;
-                sp += arg1;
-                *sp = u;
-                pc += 2;
-                break;
-            }
+        CASE(INSTR_reset_r_w): // The result stays in tos.
+            sp += arg1;
+            pc += 2;
+            NEXT_INSTR;
 
-        case INSTR_constAddr8:
-            *(--sp) = *(PolyWord*)(pc + pc[0] + 1); pc += 1; break;
+        CASE(INSTR_constAddr8):
+            *sp-- = tos; tos = *(PolyWord*)(pc + pc[0] + 1); pc += 1; NEXT_INSTR;
 
-        case INSTR_constAddr16:
-            *(--sp) = *(PolyWord*)(pc + arg1 + 2); pc += 2; break;
+        CASE(INSTR_constAddr16):
+            *sp-- = tos; tos = *(PolyWord*)(pc + arg1 + 2); pc += 2; NEXT_INSTR;
 
-        case INSTR_constAddr32:
+        CASE(INSTR_constAddr32):
         {
             POLYUNSIGNED offset = pc[0] + (pc[1] << 8) + (pc[2] << 16) + (pc[3] << 24);
-            *(--sp) = *(PolyWord*)(pc + offset + 4);
+            *sp-- = tos;
+            tos = *(PolyWord*)(pc + offset + 4);
             pc += 4;
-            break;
+            NEXT_INSTR;
         }
 
-        case INSTR_const_int_w: *(--sp) = TAGGED(arg1); pc += 2; break;
+        CASE(INSTR_const_int_w): *sp-- = tos; tos = TAGGED(arg1); pc += 2; NEXT_INSTR;
 
-        case INSTR_jump_back8:
+        CASE(INSTR_jump_back8):
             pc -= *pc + 1;
             if (this->interrupt_requested)
             {
                 // Check for interrupt in case we're in a loop
                 this->interrupt_requested = false;
-                SaveInterpreterState(pc, sp);
+                SaveInterpreterState(pc, sp, tos);
                 return -1;
             }
-            break;
+            NEXT_INSTR;
 
-        case INSTR_jump_back16:
+        CASE(INSTR_jump_back16):
             pc -= arg1 + 1;
             if (this->interrupt_requested)
             {
                 // Check for interrupt in case we're in a loop
                 this->interrupt_requested = false;
-                SaveInterpreterState(pc, sp);
+                SaveInterpreterState(pc, sp, tos);
                 return -1;
             }
-            break;
+            NEXT_INSTR;
 
-        case INSTR_lock:
+        CASE(INSTR_lock):
             {
-                PolyObject *obj = (*sp).AsObjPtr();
+                PolyObject *obj = tos.AsObjPtr();
                 obj->SetLengthWord(obj->LengthWord() & ~_OBJ_MUTABLE_BIT);
-                break;
+                NEXT_INSTR;
             }
 
-        case INSTR_ldexc: *(--sp) = this->exception_arg; break;
+        CASE(INSTR_ldexc): *sp-- = tos; tos = this->exception_arg; NEXT_INSTR;
+
+        CASE(INSTR_local_b): { *sp = tos; tos = sp[*pc]; sp--; pc += 1; NEXT_INSTR; }
+
+        CASE(INSTR_localLocal):
+            {
+                *sp = tos;
+                PolyWord u = sp[pc[0]]; *(--sp) = u;
+                tos = sp[pc[1]]; sp--;
+                pc += 2; NEXT_INSTR;
+            }
 
-        case INSTR_local_b: { PolyWord u = sp[*pc]; *(--sp) = u; pc += 1; break; }
+        CASE(INSTR_localIndirect):
+            { *sp = tos; tos = sp[pc[0]].AsObjPtr()->Get(pc[1]); sp--; pc += 2; NEXT_INSTR; }
 
-        case INSTR_indirect_b:
-            *sp = (*sp).AsObjPtr()->Get(*pc); pc += 1; break;
+        CASE(INSTR_indirect_b):
+            tos = tos.AsObjPtr()->Get(*pc); pc += 1; NEXT_INSTR;
 
-        case INSTR_move_to_vec_b:
-            { PolyWord u = *sp++; (*sp).AsObjPtr()->Set(*pc, u); pc += 1; break; }
+        CASE(INSTR_move_to_vec_b):
+            { PolyWord u = tos; tos = *(++sp); tos.AsObjPtr()->Set(*pc, u); pc += 1; NEXT_INSTR; }
 
-        case INSTR_set_stack_val_b:
-            { PolyWord u = *sp++; sp[*pc-1] = u; pc += 1; break; }
+        CASE(INSTR_set_stack_val_b):
+            { PolyWord u = tos; sp++; sp[*pc-1] = u; tos = *sp; pc += 1; NEXT_INSTR; }
 
-        case INSTR_reset_b: sp += *pc; pc += 1; break;
+        CASE(INSTR_reset_b): sp += *pc; tos = *sp; pc += 1; NEXT_INSTR;
 
-        case INSTR_reset_r_b:
-            { PolyWord u = *sp; sp += *pc; *sp = u; pc += 1; break; }
+        CASE(INSTR_reset_r_b): sp += *pc; pc += 1; NEXT_INSTR;
 
-        case INSTR_const_int_b: *(--sp) = TAGGED(*pc); pc += 1; break;
+        CASE(INSTR_const_int_b): *sp-- = tos; tos = TAGGED(*pc); pc += 1; NEXT_INSTR;
 
-        case INSTR_local_0: { PolyWord u = sp[0]; *(--sp) = u; break; }
-        case INSTR_local_1: { PolyWord u = sp[1]; *(--sp) = u; break; }
-        case INSTR_local_2: { PolyWord u = sp[2]; *(--sp) = u; break; }
-        case INSTR_local_3: { PolyWord u = sp[3]; *(--sp) = u; break; }
-        case INSTR_local_4: { PolyWord u = sp[4]; *(--sp) = u; break; }
-        case INSTR_local_5: { PolyWord u = sp[5]; *(--sp) = u; break; }
-        case INSTR_local_6: { PolyWord u = sp[6]; *(--sp) = u; break; }
-        case INSTR_local_7: { PolyWord u = sp[7]; *(--sp) = u; break; }
-        case INSTR_local_8: { PolyWord u = sp[8]; *(--sp) = u; break; }
-        case INSTR_local_9: { PolyWord u = sp[9]; *(--sp) = u; break; }
-        case INSTR_local_10: { PolyWord u = sp[10]; *(--sp) = u; break; }
-        case INSTR_local_11: { PolyWord u = sp[11]; *(--sp) = u; break; }
+        CASE(INSTR_local_0): { *sp-- = tos; NEXT_INSTR; }
+        CASE(INSTR_local_1): { *sp = tos; tos = sp[1]; sp--; NEXT_INSTR; }
+        CASE(INSTR_local_2): { *sp = tos; tos = sp[2]; sp--; NEXT_INSTR; }
+        CASE(INSTR_local_3): { *sp = tos; tos = sp[3]; sp--; NEXT_INSTR; }
+        CASE(INSTR_local_4): { *sp = tos; tos = sp[4]; sp--; NEXT_INSTR; }
+        CASE(INSTR_local_5): { *sp = tos; tos = sp[5]; sp--; NEXT_INSTR; }
+        CASE(INSTR_local_6): { *sp = tos; tos = sp[6]; sp--; NEXT_INSTR; }
+        CASE(INSTR_local_7): { *sp = tos; tos = sp[7]; sp--; NEXT_INSTR; }
+        CASE(INSTR_local_8): { *sp = tos; tos = sp[8]; sp--; NEXT_INSTR; }
+        CASE(INSTR_local_9): { *sp = tos; tos = sp[9]; sp--; NEXT_INSTR; }
+        CASE(INSTR_local_10): { *sp = tos; tos = sp[10]; sp--; NEXT_INSTR; }
+        CASE(INSTR_local_11): { *sp = tos; tos = sp[11]; sp--; NEXT_INSTR; }
 
-        case INSTR_indirect_0:
-            *sp = (*sp).AsObjPtr()->Get(0); break;
+        CASE(INSTR_indirect_0):
+            tos = tos.AsObjPtr()->Get(0); NEXT_INSTR;
 
-        case INSTR_indirect_1:
-            *sp = (*sp).AsObjPtr()->Get(1); break;
+        CASE(INSTR_indirect_1):
+            tos = tos.AsObjPtr()->Get(1); NEXT_INSTR;
 
-        case INSTR_indirect_2:
-            *sp = (*sp).AsObjPtr()->Get(2); break;
+        CASE(INSTR_indirect_2):
+            tos = tos.AsObjPtr()->Get(2); NEXT_INSTR;
 
-        case INSTR_indirect_3:
-            *sp = (*sp).AsObjPtr()->Get(3); break;
+        CASE(INSTR_indirect_3):
+            tos = tos.AsObjPtr()->Get(3); NEXT_INSTR;
 
-        case INSTR_indirect_4:
-            *sp = (*sp).AsObjPtr()->Get(4); break;
+        CASE(INSTR_indirect_4):
+            tos = tos.AsObjPtr()->Get(4); NEXT_INSTR;
 
-        case INSTR_indirect_5:
-            *sp = (*sp).AsObjPtr()->Get(5); break;
+        CASE(INSTR_indirect_5):
+            tos = tos.AsObjPtr()->Get(5); NEXT_INSTR;
 
-        case INSTR_const_0: *(--sp) = Zero; break;
-        case INSTR_const_1: *(--sp) = TAGGED(1); break;
-        case INSTR_const_2: *(--sp) = TAGGED(2); break;
-        case INSTR_const_3: *(--sp) = TAGGED(3); break;
-        case INSTR_const_4: *(--sp) = TAGGED(4); break;
-        case INSTR_const_10: *(--sp) = TAGGED(10); break;
+        CASE(INSTR_const_0): *sp-- = tos; tos = Zero; NEXT_INSTR;
+        CASE(INSTR_const_1): *sp-- = tos; tos = TAGGED(1); NEXT_INSTR;
+        CASE(INSTR_const_2): *sp-- = tos; tos = TAGGED(2); NEXT_INSTR;
+        CASE(INSTR_const_3): *sp-- = tos; tos = TAGGED(3); NEXT_INSTR;
+        CASE(INSTR_const_4): *sp-- = tos; tos = TAGGED(4); NEXT_INSTR;
+        CASE(INSTR_const_10): *sp-- = tos; tos = TAGGED(10); NEXT_INSTR;
 
             // Move-to-vec is now only used for closures.
-        case INSTR_move_to_vec_0: { PolyWord u = *sp++; (*sp).AsObjPtr()->Set(0, u); break; }
-        case INSTR_move_to_vec_1: { PolyWord u = *sp++; (*sp).AsObjPtr()->Set(1, u); break; }
-        case INSTR_move_to_vec_2: { PolyWord u = *sp++; (*sp).AsObjPtr()->Set(2, u); break; }
-        case INSTR_move_to_vec_3: { PolyWord u = *sp++; (*sp).AsObjPtr()->Set(3, u); break; }
-        case INSTR_move_to_vec_4: { PolyWord u = *sp++; (*sp).AsObjPtr()->Set(4, u); break; }
-        case INSTR_move_to_vec_5: { PolyWord u = *sp++; (*sp).AsObjPtr()->Set(5, u); break; }
-        case INSTR_move_to_vec_6: { PolyWord u = *sp++; (*sp).AsObjPtr()->Set(6, u); break; }
-        case INSTR_move_to_vec_7: { PolyWord u = *sp++; (*sp).AsObjPtr()->Set(7, u); break; }
+        CASE(INSTR_move_to_vec_0): { PolyWord u = tos; tos = *(++sp); tos.AsObjPtr()->Set(0, u); NEXT_INSTR; }
+        CASE(INSTR_move_to_vec_1): { PolyWord u = tos; tos = *(++sp); tos.AsObjPtr()->Set(1, u); NEXT_INSTR; }
+        CASE(INSTR_move_to_vec_2): { PolyWord u = tos; tos = *(++sp); tos.AsObjPtr()->Set(2, u); NEXT_INSTR; }
+        CASE(INSTR_move_to_vec_3): { PolyWord u = tos; tos = *(++sp); tos.AsObjPtr()->Set(3, u); NEXT_INSTR; }
+        CASE(INSTR_move_to_vec_4): { PolyWord u = tos; tos = *(++sp); tos.AsObjPtr()->Set(4, u); NEXT_INSTR; }
+        CASE(INSTR_move_to_vec_5): { PolyWord u = tos; tos = *(++sp); tos.AsObjPtr()->Set(5, u); NEXT_INSTR; }
+        CASE(INSTR_move_to_vec_6): { PolyWord u = tos; tos = *(++sp); tos.AsObjPtr()->Set(6, u); NEXT_INSTR; }
+        CASE(INSTR_move_to_vec_7): { PolyWord u = tos; tos = *(++sp); tos.AsObjPtr()->Set(7, u); NEXT_INSTR; }
 
-        case INSTR_reset_r_1: { PolyWord u = *sp; sp += 1; *sp = u; break; }
-        case INSTR_reset_r_2: { PolyWord u = *sp; sp += 2; *sp = u; break; }
-        case INSTR_reset_r_3: { PolyWord u = *sp; sp += 3; *sp = u; break; }
+        // The result stays in tos.
+        CASE(INSTR_reset_r_1): sp += 1; NEXT_INSTR;
+        CASE(INSTR_reset_r_2): sp += 2; NEXT_INSTR;
+        CASE(INSTR_reset_r_3): sp += 3; NEXT_INSTR;
 
-        case INSTR_reset_1: sp += 1; break;
-        case INSTR_reset_2: sp += 2; break;
+        CASE(INSTR_reset_1): sp += 1; tos = *sp; NEXT_INSTR;
+        CASE(INSTR_reset_2): sp += 2; tos = *sp; NEXT_INSTR;
 
-        case INSTR_stack_container:
+        CASE(INSTR_stack_container):
         {
             POLYUNSIGNED words = arg1; pc += 2;
+            *sp = tos;
             while (words-- > 0) *(--sp) = Zero;
+            tos = PolyWord::FromStackAddr(sp);
             sp--;
-            *sp = PolyWord::FromStackAddr(sp + 1);
-            break;
+            NEXT_INSTR;
         }
 
-        case INSTR_tuple_container: /* Create a tuple from a container. */
+        CASE(INSTR_tuple_container): /* Create a tuple from a container. */
             {
                 storeWords = arg1;
-                PolyObject *t = this->allocateMemory(storeWords, pc, sp);
+                PolyObject *t = this->allocateMemory(storeWords, pc, sp, tos);
                 if (t == 0) goto RAISE_EXCEPTION;
                 t->SetLengthWord(storeWords, 0);
                 for(; storeWords > 0; )
                 {
                     storeWords--;
-                    t->Set(storeWords, (*sp).AsObjPtr()->Get(storeWords));
+                    t->Set(storeWords, tos.AsObjPtr()->Get(storeWords));
                 }
-                *sp = t;
+                tos = t;
                 pc += 2;
-                break;
+                NEXT_INSTR;
             }
 
-        case INSTR_callFastRTS0:
+        // In the calls the result replaces the last argument to be popped.
+        CASE(INSTR_callFastRTS0):
             {
-                callFastRts0 doCall = *(callFastRts0*)(*sp++).AsObjPtr();
+                callFastRts0 doCall = *(callFastRts0*)tos.AsObjPtr();
                 POLYUNSIGNED result = doCall();
-                *(--sp) = PolyWord::FromUnsigned(result);
-                break;
+                tos = PolyWord::FromUnsigned(result);
+                NEXT_INSTR;
             }
 
-        case INSTR_callFastRTS1:
+        CASE(INSTR_callFastRTS1):
             {
-                callFastRts1 doCall = *(callFastRts1*)(*sp++).AsObjPtr();
-                intptr_t rtsArg1 = (*sp++).AsSigned();
+                callFastRts1 doCall = *(callFastRts1*)tos.AsObjPtr();
+                intptr_t rtsArg1 = (*(++sp)).AsSigned();
                 POLYUNSIGNED result = doCall(rtsArg1);
-                *(--sp) = PolyWord::FromUnsigned(result);
-                break;
+                tos = PolyWord::FromUnsigned(result);
+                NEXT_INSTR;
             }
 
-        case INSTR_callFastRTS2:
+        CASE(INSTR_callFastRTS2):
             {
-                callFastRts2 doCall = *(callFastRts2*)(*sp++).AsObjPtr();
-                intptr_t rtsArg2 = (*sp++).AsSigned(); // Pop off the args, last arg first.
-                intptr_t rtsArg1 = (*sp++).AsSigned();
+                callFastRts2 doCall = *(callFastRts2*)tos.AsObjPtr();
+                intptr_t rtsArg2 = (*(++sp)).AsSigned(); // Pop off the args, last arg first.
+                intptr_t rtsArg1 = (*(++sp)).AsSigned();
                 POLYUNSIGNED result = doCall(rtsArg1, rtsArg2);
-                *(--sp) = PolyWord::FromUnsigned(result);
-                break;
+                tos = PolyWord::FromUnsigned(result);
+                NEXT_INSTR;
             }
 
-        case INSTR_callFastRTS3:
+        CASE(INSTR_callFastRTS3):
             {
-                callFastRts3 doCall = *(callFastRts3*)(*sp++).AsObjPtr();
-                intptr_t rtsArg3 = (*sp++).AsSigned(); // Pop off the args, last arg first.
-                intptr_t rtsArg2 = (*sp++).AsSigned();
-                intptr_t rtsArg1 = (*sp++).AsSigned();
+                callFastRts3 doCall = *(callFastRts3*)tos.AsObjPtr();
+                intptr_t rtsArg3 = (*(++sp)).AsSigned(); // Pop off the args, last arg first.
+                intptr_t rtsArg2 = (*(++sp)).AsSigned();
+                intptr_t rtsArg1 = (*(++sp)).AsSigned();
                 POLYUNSIGNED result = doCall(rtsArg1, rtsArg2, rtsArg3);
-                *(--sp) = PolyWord::FromUnsigned(result);
-                break;
+                tos = PolyWord::FromUnsigned(result);
+                NEXT_INSTR;
             }
 
-        case INSTR_callFastRTS4:
+        CASE(INSTR_callFastRTS4):
             {
-                callFastRts4 doCall = *(callFastRts4*)(*sp++).AsObjPtr();
-                intptr_t rtsArg4 = (*sp++).AsSigned(); // Pop off the args, last arg first.
-                intptr_t rtsArg3 = (*sp++).AsSigned();
-                intptr_t rtsArg2 = (*sp++).AsSigned();
-                intptr_t rtsArg1 = (*sp++).AsSigned();
+                callFastRts4 doCall = *(callFastRts4*)tos.AsObjPtr();
+                intptr_t rtsArg4 = (*(++sp)).AsSigned(); // Pop off the args, last arg first.
+                intptr_t rtsArg3 = (*(++sp)).AsSigned();
+                intptr_t rtsArg2 = (*(++sp)).AsSigned();
+                intptr_t rtsArg1 = (*(++sp)).AsSigned();
                 POLYUNSIGNED result = doCall(rtsArg1, rtsArg2, rtsArg3, rtsArg4);
-                *(--sp) = PolyWord::FromUnsigned(result);
-                break;
+                tos = PolyWord::FromUnsigned(result);
+                NEXT_INSTR;
             }
 
-        case INSTR_callFastRTS5:
+        CASE(INSTR_callFastRTS5):
             {
-                callFastRts5 doCall = *(callFastRts5*)(*sp++).AsObjPtr();
-                intptr_t rtsArg5 = (*sp++).AsSigned(); // Pop off the args, last arg first.
-                intptr_t rtsArg4 = (*sp++).AsSigned();
-                intptr_t rtsArg3 = (*sp++).AsSigned();
-                intptr_t rtsArg2 = (*sp++).AsSigned();
-                intptr_t rtsArg1 = (*sp++).AsSigned();
+                callFastRts5 doCall = *(callFastRts5*)tos.AsObjPtr();
+                intptr_t rtsArg5 = (*(++sp)).AsSigned(); // Pop off the args, last arg first.
+                intptr_t rtsArg4 = (*(++sp)).AsSigned();
+                intptr_t rtsArg3 = (*(++sp)).AsSigned();
+                intptr_t rtsArg2 = (*(++sp)).AsSigned();
+                intptr_t rtsArg1 = (*(++sp)).AsSigned();
                 POLYUNSIGNED result = doCall(rtsArg1, rtsArg2, rtsArg3, rtsArg4, rtsArg5);
-                *(--sp) = PolyWord::FromUnsigned(result);
-                break;
+                tos = PolyWord::FromUnsigned(result);
+                NEXT_INSTR;
             }
 
-        case INSTR_callFullRTS0:
+        // A full call may look at the stack or switch to another one so the
+        // arguments are removed before the state is saved and the result pushed after.
+        CASE(INSTR_callFullRTS0):
             {
-                callFullRts0 doCall = *(callFullRts0*)(*sp++).AsObjPtr();
+                callFullRts0 doCall = *(callFullRts0*)tos.AsObjPtr();
+                tos = *(++sp);
                 this->raiseException = false;
-                SaveInterpreterState(pc, sp);
+                SaveInterpreterState(pc, sp, tos);
                 POLYUNSIGNED result = doCall(this->threadObject);
-                LoadInterpreterState(pc, sp);
+                LoadInterpreterState(pc, sp, tos);
+                CHECK_INSTRUCTION_PROFILE(); // In case this turned profiling on or off.
                 // If this raised an exception 
                 if (this->raiseException) goto RAISE_EXCEPTION;
-                *(--sp)= PolyWord::FromUnsigned(result);
-                break;
+                *sp-- = tos;
+                tos = PolyWord::FromUnsigned(result);
+                NEXT_INSTR;
             }
 
-        case INSTR_callFullRTS1:
+        CASE(INSTR_callFullRTS1):
             {
-                callFullRts1 doCall = *(callFullRts1*)(*sp++).AsObjPtr();
-                intptr_t rtsArg1 = (*sp++).AsSigned();
+                callFullRts1 doCall = *(callFullRts1*)tos.AsObjPtr();
+                intptr_t rtsArg1 = (*(++sp)).AsSigned();
+                tos = *(++sp);
                 this->raiseException = false;
-                SaveInterpreterState(pc, sp);
+                SaveInterpreterState(pc, sp, tos);
                 POLYUNSIGNED result = doCall(this->threadObject, rtsArg1);
-                LoadInterpreterState(pc, sp);
+                LoadInterpreterState(pc, sp, tos);
+                CHECK_INSTRUCTION_PROFILE(); // In case this turned profiling on or off.
                 // If this raised an exception 
                 if (this->raiseException) goto RAISE_EXCEPTION;
-                *(--sp) = PolyWord::FromUnsigned(result);
-                break;
+                *sp-- = tos;
+                tos = PolyWord::FromUnsigned(result);
+                NEXT_INSTR;
             }
 
-        case INSTR_callFullRTS2:
+        CASE(INSTR_callFullRTS2):
             {
-                callFullRts2 doCall = *(callFullRts2*)(*sp++).AsObjPtr();
-                intptr_t rtsArg2 = (*sp++).AsSigned(); // Pop off the args, last arg first.
-                intptr_t rtsArg1 = (*sp++).AsSigned();
+                callFullRts2 doCall = *(callFullRts2*)tos.AsObjPtr();
+                intptr_t rtsArg2 = (*(++sp)).AsSigned(); // Pop off the args, last arg first.
+                intptr_t rtsArg1 = (*(++sp)).AsSigned();
+                tos = *(++sp);
                 this->raiseException = false;
-                SaveInterpreterState(pc, sp);
+                SaveInterpreterState(pc, sp, tos);
                 POLYUNSIGNED result = doCall(this->threadObject, rtsArg1, rtsArg2);
-                LoadInterpreterState(pc, sp);
+                LoadInterpreterState(pc, sp, tos);
+                CHECK_INSTRUCTION_PROFILE(); // In case this turned profiling on or off.
                 // If this raised an exception 
                 if (this->raiseException) goto RAISE_EXCEPTION;
-                *(--sp) = PolyWord::FromUnsigned(result);
-                break;
+                *sp-- = tos;
+                tos = PolyWord::FromUnsigned(result);
+                NEXT_INSTR;
             }
 
-        case INSTR_callFullRTS3:
+        CASE(INSTR_callFullRTS3):
             {
-                callFullRts3 doCall = *(callFullRts3*)(*sp++).AsObjPtr();
-                intptr_t rtsArg3 = (*sp++).AsSigned(); // Pop off the args, last arg first.
-                intptr_t rtsArg2 = (*sp++).AsSigned();
-                intptr_t rtsArg1 = (*sp++).AsSigned();
+                callFullRts3 doCall = *(callFullRts3*)tos.AsObjPtr();
+                intptr_t rtsArg3 = (*(++sp)).AsSigned(); // Pop off the args, last arg first.
+                intptr_t rtsArg2 = (*(++sp)).AsSigned();
+                intptr_t rtsArg1 = (*(++sp)).AsSigned();
+                tos = *(++sp);
                 this->raiseException = false;
-                SaveInterpreterState(pc, sp);
+                SaveInterpreterState(pc, sp, tos);
                 POLYUNSIGNED result = doCall(this->threadObject, rtsArg1, rtsArg2, rtsArg3);
-                LoadInterpreterState(pc, sp);
+                LoadInterpreterState(pc, sp, tos);
+                CHECK_INSTRUCTION_PROFILE(); // In case this turned profiling on or off.
                 // If this raised an exception 
                 if (this->raiseException) goto RAISE_EXCEPTION;
-                *(--sp) = PolyWord::FromUnsigned(result);
-                break;
+                *sp-- = tos;
+                tos = PolyWord::FromUnsigned(result);
+                NEXT_INSTR;
             }
 
-        case INSTR_callFastRtoR:
+        // The floating point calls leave the first argument on the stack while
+        // the result is boxed and then replace it with the result.
+        CASE(INSTR_callFastRtoR):
             {
                 // Floating point call.  The call itself does not allocate but we
                 // need to put the result into a "box".
-                callRTSRtoR doCall = *(callRTSRtoR*)(*sp++).AsObjPtr();
-                PolyWord rtsArg1 = *sp++;
-                double argument = unboxDouble(rtsArg1);
+                callRTSRtoR doCall = *(callRTSRtoR*)tos.AsObjPtr();
+                tos = *(++sp); // rtsArg1
+                double argument = unboxDouble(tos);
                 // Allocate memory for the result.
                 double result = doCall(argument);
-                PolyObject *t = boxDouble(result, pc, sp);
+                PolyObject *t = boxDouble(result, pc, sp, tos);
                 if (t == 0) goto RAISE_EXCEPTION;
-                *(--sp) = (PolyWord)t;
-                break;
+                tos = (PolyWord)t;
+                NEXT_INSTR;
             }
 
-        case INSTR_callFastRRtoR:
+        CASE(INSTR_callFastRRtoR):
         {
             // Floating point call.
-            PolyWord rtsCall = (*sp++).AsObjPtr()->Get(0); // Value holds address.
-            PolyWord rtsArg2 = *sp++;
-            PolyWord rtsArg1 = *sp++;
+            PolyWord rtsCall = tos.AsObjPtr()->Get(0); // Value holds address.
+            PolyWord rtsArg2 = *(++sp);
+            tos = *(++sp); // rtsArg1
             callRTSRRtoR doCall = (callRTSRRtoR)rtsCall.AsCodePtr();
-            double argument1 = unboxDouble(rtsArg1);
+            double argument1 = unboxDouble(tos);
             double argument2 = unboxDouble(rtsArg2);
             // Allocate memory for the result.
             double result = doCall(argument1, argument2);
-            PolyObject *t = boxDouble(result, pc, sp);
+            PolyObject *t = boxDouble(result, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *(--sp) = t;
-            break;
+            tos = t;
+            NEXT_INSTR;
         }
 
-        case INSTR_callFastGtoR:
+        CASE(INSTR_callFastGtoR):
             {
                 // Call that takes a POLYUNSIGNED argument and returns a double.
-                callRTSGtoR doCall = *(callRTSGtoR*)(*sp++).AsObjPtr();
-                intptr_t rtsArg1 = (*sp++).AsSigned();
+                callRTSGtoR doCall = *(callRTSGtoR*)tos.AsObjPtr();
+                tos = *(++sp); // rtsArg1
+                intptr_t rtsArg1 = tos.AsSigned();
                 // Allocate memory for the result.
                 double result = doCall(rtsArg1);
-                PolyObject *t = boxDouble(result, pc, sp);
+                PolyObject *t = boxDouble(result, pc, sp, tos);
                 if (t == 0) goto RAISE_EXCEPTION;
-                *(--sp) = (PolyWord)t;
-                break;
+                tos = (PolyWord)t;
+                NEXT_INSTR;
             }
 
-        case INSTR_callFastRGtoR:
+        CASE(INSTR_callFastRGtoR):
         {
             // Call that takes a POLYUNSIGNED argument and returns a double.
-            PolyWord rtsCall = (*sp++).AsObjPtr()->Get(0); // Value holds address.
-            intptr_t rtsArg2 = (*sp++).AsSigned();
-            PolyWord rtsArg1 = *sp++;
+            PolyWord rtsCall = tos.AsObjPtr()->Get(0); // Value holds address.
+            intptr_t rtsArg2 = (*(++sp)).AsSigned();
+            tos = *(++sp); // rtsArg1
             callRTSRGtoR doCall = (callRTSRGtoR)rtsCall.AsCodePtr();
-            double argument1 = unboxDouble(rtsArg1);
+            double argument1 = unboxDouble(tos);
             // Allocate memory for the result.
             double result = doCall(argument1, rtsArg2);
-            PolyObject *t = boxDouble(result, pc, sp);
+            PolyObject *t = boxDouble(result, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *(--sp) = t;
-            break;
+            tos = t;
+            NEXT_INSTR;
         }
 
-        case INSTR_callFastFtoF:
+        CASE(INSTR_callFastFtoF):
         {
             // Floating point call.  The call itself does not allocate but we
             // need to put the result into a "box".
-            PolyWord rtsCall = (*sp++).AsObjPtr()->Get(0); // Value holds address.
-            PolyWord rtsArg1 = *sp++;
+            PolyWord rtsCall = tos.AsObjPtr()->Get(0); // Value holds address.
+            tos = *(++sp); // rtsArg1
             callRTSFtoF doCall = (callRTSFtoF)rtsCall.AsCodePtr();
-            float argument = unboxFloat(rtsArg1);
+            float argument = unboxFloat(tos);
             // Allocate memory for the result.
             float result = doCall(argument);
-            PolyObject *t = boxFloat(result, pc, sp);
+            PolyObject *t = boxFloat(result, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *(--sp) = t;
-            break;
+            tos = t;
+            NEXT_INSTR;
         }
 
-        case INSTR_callFastFFtoF:
+        CASE(INSTR_callFastFFtoF):
         {
             // Floating point call.
-            PolyWord rtsCall = (*sp++).AsObjPtr()->Get(0); // Value holds address.
-            PolyWord rtsArg2 = *sp++;
-            PolyWord rtsArg1 = *sp++;
+            PolyWord rtsCall = tos.AsObjPtr()->Get(0); // Value holds address.
+            PolyWord rtsArg2 = *(++sp);
+            tos = *(++sp); // rtsArg1
             callRTSFFtoF doCall = (callRTSFFtoF)rtsCall.AsCodePtr();
-            float argument1 = unboxFloat(rtsArg1);
+            float argument1 = unboxFloat(tos);
             float argument2 = unboxFloat(rtsArg2);
             // Allocate memory for the result.
             float result = doCall(argument1, argument2);
-            PolyObject *t = boxFloat(result, pc, sp);
+            PolyObject *t = boxFloat(result, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *(--sp) = t;
-            break;
+            tos = t;
+            NEXT_INSTR;
         }
 
-        case INSTR_callFastGtoF:
+        CASE(INSTR_callFastGtoF):
         {
             // Call that takes a POLYUNSIGNED argument and returns a double.
-            PolyWord rtsCall = (*sp++).AsObjPtr()->Get(0); // Value holds address.
-            intptr_t rtsArg1 = (*sp++).AsSigned();
+            PolyWord rtsCall = tos.AsObjPtr()->Get(0); // Value holds address.
+            tos = *(++sp); // rtsArg1
+            intptr_t rtsArg1 = tos.AsSigned();
             callRTSGtoF doCall = (callRTSGtoF)rtsCall.AsCodePtr();
             // Allocate memory for the result.
             float result = doCall(rtsArg1);
-            PolyObject *t = boxFloat(result, pc, sp);
+            PolyObject *t = boxFloat(result, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *(--sp) = t;
-            break;
+            tos = t;
+            NEXT_INSTR;
         }
 
-        case INSTR_callFastFGtoF:
+        CASE(INSTR_callFastFGtoF):
         {
             // Call that takes a POLYUNSIGNED argument and returns a double.
-            PolyWord rtsCall = (*sp++).AsObjPtr()->Get(0); // Value holds address.
-            intptr_t rtsArg2 = (*sp++).AsSigned();
-            PolyWord rtsArg1 = *sp++;
+            PolyWord rtsCall = tos.AsObjPtr()->Get(0); // Value holds address.
+            intptr_t rtsArg2 = (*(++sp)).AsSigned();
+            tos = *(++sp); // rtsArg1
             callRTSFGtoF doCall = (callRTSFGtoF)rtsCall.AsCodePtr();
-            float argument1 = unboxFloat(rtsArg1);
+            float argument1 = unboxFloat(tos);
             // Allocate memory for the result.
             float result = doCall(argument1, rtsArg2);
-            PolyObject *t = boxFloat(result, pc, sp);
+            PolyObject *t = boxFloat(result, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *(--sp) = t;
-            break;
+            tos = t;
+            NEXT_INSTR;
         }
 
-        case INSTR_notBoolean:
-            *sp = ((*sp) == True) ? False : True; break;
+        CASE(INSTR_notBoolean):
+            tos = (tos == True) ? False : True; NEXT_INSTR;
 
-        case INSTR_isTagged:
-            *sp = (*sp).IsTagged() ? True : False; break;
+        CASE(INSTR_isTagged):
+            tos = tos.IsTagged() ? True : False; NEXT_INSTR;
 
-        case INSTR_cellLength:
+        CASE(INSTR_cellLength):
             /* Return the length word. */
-            *sp = TAGGED((*sp).AsObjPtr()->Length());
-            break;
+            tos = TAGGED(tos.AsObjPtr()->Length());
+            NEXT_INSTR;
 
-        case INSTR_cellFlags:
+        CASE(INSTR_cellFlags):
         {
-            PolyObject *p = (*sp).AsObjPtr();
+            PolyObject *p = tos.AsObjPtr();
             POLYUNSIGNED f = (p->LengthWord()) >> OBJ_PRIVATE_FLAGS_SHIFT;
-            *sp = TAGGED(f);
-            break;
+            tos = TAGGED(f);
+            NEXT_INSTR;
         }
 
-        case INSTR_clearMutable:
+        CASE(INSTR_clearMutable):
         {
-            PolyObject *obj = (*sp).AsObjPtr();
+            PolyObject *obj = tos.AsObjPtr();
             POLYUNSIGNED lengthW = obj->LengthWord();
             /* Clear the mutable bit. */
             obj->SetLengthWord(lengthW & ~_OBJ_MUTABLE_BIT);
-            *sp = Zero;
-            break;
+            tos = Zero;
+            NEXT_INSTR;
         }
 
-        case INSTR_stringLength: // Now replaced by loadUntagged
-            *sp = TAGGED(((PolyStringObject*)(*sp).AsObjPtr())->length);
-            break;
+        CASE(INSTR_stringLength): // Now replaced by loadUntagged
+            tos = TAGGED(((PolyStringObject*)tos.AsObjPtr())->length);
+            NEXT_INSTR;
 
-        case INSTR_atomicIncr:
+        CASE(INSTR_atomicIncr):
         {
-            PLocker l(&mutexLock);
-            PolyObject *p = (*sp).AsObjPtr();
-            PolyWord newValue = TAGGED(UNTAGGED(p->Get(0))+1);
-            p->Set(0, newValue);
-            *sp = newValue;
-            break;
+            {
+                PLocker l(&mutexLock);
+                PolyObject *p = tos.AsObjPtr();
+                PolyWord newValue = TAGGED(UNTAGGED(p->Get(0))+1);
+                p->Set(0, newValue);
+                tos = newValue;
+            }
+            NEXT_INSTR;
         }
 
-        case INSTR_atomicDecr:
+        CASE(INSTR_atomicDecr):
         {
-            PLocker l(&mutexLock);
-            PolyObject *p = (*sp).AsObjPtr();
-            PolyWord newValue = TAGGED(UNTAGGED(p->Get(0))-1);
-            p->Set(0, newValue);
-            *sp = newValue;
-            break;
+            {
+                PLocker l(&mutexLock);
+                PolyObject *p = tos.AsObjPtr();
+                PolyWord newValue = TAGGED(UNTAGGED(p->Get(0))-1);
+                p->Set(0, newValue);
+                tos = newValue;
+            }
+            NEXT_INSTR;
         }
 
-        case INSTR_atomicReset:
+        CASE(INSTR_atomicReset):
         {
             // This is needed in the interpreted version otherwise there
             // is a chance that we could set the value to zero while another
             // thread is between getting the old value and setting it to the new value.
-            PLocker l(&mutexLock);
-            PolyObject *p = (*sp).AsObjPtr();
-            p->Set(0, TAGGED(1)); // Set this to released.
-            *sp = TAGGED(0); // Push the unit result
-            break;
+            {
+                PLocker l(&mutexLock);
+                PolyObject *p = tos.AsObjPtr();
+                p->Set(0, TAGGED(1)); // Set this to released.
+                tos = TAGGED(0); // Push the unit result
+            }
+            NEXT_INSTR;
         }
 
-        case INSTR_longWToTagged:
+        CASE(INSTR_longWToTagged):
         {
             // Extract the first word and return it as a tagged value.  This loses the top-bit
-            POLYUNSIGNED wx = (*sp).AsObjPtr()->Get(0).AsUnsigned();
-            *sp = TAGGED(wx);
-            break;
+            POLYUNSIGNED wx = tos.AsObjPtr()->Get(0).AsUnsigned();
+            tos = TAGGED(wx);
+            NEXT_INSTR;
         }
 
-        case INSTR_signedToLongW:
+        CASE(INSTR_signedToLongW):
         {
             // Shift the tagged value to remove the tag and put it into the first word.
             // The original sign bit is copied in the shift.
-            intptr_t wx = (*sp).UnTagged();
-            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp);
+            intptr_t wx = tos.UnTagged();
+            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
             t->SetLengthWord(LGWORDSIZE, F_BYTE_OBJ);
             *(intptr_t*)t = wx;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_unsignedToLongW:
+        CASE(INSTR_unsignedToLongW):
         {
             // As with the above except the value is treated as an unsigned
             // value and the top bit is zero.
-            uintptr_t wx = (*sp).UnTaggedUnsigned();
-            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp);
+            uintptr_t wx = tos.UnTaggedUnsigned();
+            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
             t->SetLengthWord(LGWORDSIZE, F_BYTE_OBJ);
             *(uintptr_t*)t = wx;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_realAbs:
+        CASE(INSTR_realAbs):
         {
-            PolyObject *t = this->boxDouble(fabs(unboxDouble(*sp)), pc, sp);
+            PolyObject *t = this->boxDouble(fabs(unboxDouble(tos)), pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_realNeg:
+        CASE(INSTR_realNeg):
         {
-            PolyObject *t = this->boxDouble(-(unboxDouble(*sp)), pc, sp);
+            PolyObject *t = this->boxDouble(-(unboxDouble(tos)), pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_floatAbs:
+        CASE(INSTR_floatAbs):
         {
-            PolyObject *t = this->boxFloat(fabs(unboxFloat(*sp)), pc, sp);
+            PolyObject *t = this->boxFloat(fabs(unboxFloat(tos)), pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *sp = t;
-            break;
+            tos = t;
+            NEXT_INSTR;
         }
 
-        case INSTR_floatNeg:
+        CASE(INSTR_floatNeg):
         {
-            PolyObject *t = this->boxFloat(-(unboxFloat(*sp)), pc, sp);
+            PolyObject *t = this->boxFloat(-(unboxFloat(tos)), pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *sp = t;
-            break;
+            tos = t;
+            NEXT_INSTR;
         }
 
-        case INSTR_fixedIntToReal:
+        CASE(INSTR_fixedIntToReal):
         {
-            POLYSIGNED u = UNTAGGED(*sp);
-            PolyObject *t = this->boxDouble((double)u, pc, sp);
+            POLYSIGNED u = UNTAGGED(tos);
+            PolyObject *t = this->boxDouble((double)u, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_fixedIntToFloat:
+        CASE(INSTR_fixedIntToFloat):
         {
-            POLYSIGNED u = UNTAGGED(*sp);
-            PolyObject *t = this->boxFloat((float)u, pc, sp);
+            POLYSIGNED u = UNTAGGED(tos);
+            PolyObject *t = this->boxFloat((float)u, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *sp = t;
-            break;
+            tos = t;
+            NEXT_INSTR;
         }
 
-        case INSTR_floatToReal:
+        CASE(INSTR_floatToReal):
         {
-            float u = unboxFloat(*sp);
-            PolyObject *t = this->boxDouble((double)u, pc, sp);
+            float u = unboxFloat(tos);
+            PolyObject *t = this->boxDouble((double)u, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *sp = t;
-            break;
+            tos = t;
+            NEXT_INSTR;
         }
 
-        case INSTR_equalWord:
+        CASE(INSTR_equalWord):
         {
-            PolyWord u = *sp++;
-            *sp = u == (*sp) ? True : False;
-            break;
+            PolyWord u = tos;
+            tos = *(++sp);
+            tos = u == tos ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_lessSigned:
+        CASE(INSTR_lessSigned):
         {
-            PolyWord u = *sp++;
-            *sp = ((*sp).AsSigned() < u.AsSigned()) ? True : False;
-            break;
+            PolyWord u = tos;
+            tos = *(++sp);
+            tos = (tos.AsSigned() < u.AsSigned()) ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_lessUnsigned:
+        CASE(INSTR_lessUnsigned):
         {
-            PolyWord u = *sp++;
-            *sp = ((*sp).AsUnsigned() < u.AsUnsigned()) ? True : False;
-            break;
+            PolyWord u = tos;
+            tos = *(++sp);
+            tos = (tos.AsUnsigned() < u.AsUnsigned()) ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_lessEqSigned:
+        CASE(INSTR_lessEqSigned):
         {
-            PolyWord u = *sp++;
-            *sp = ((*sp).AsSigned() <= u.AsSigned()) ? True : False;
-            break;
+            PolyWord u = tos;
+            tos = *(++sp);
+            tos = (tos.AsSigned() <= u.AsSigned()) ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_lessEqUnsigned:
+        CASE(INSTR_lessEqUnsigned):
         {
-            PolyWord u = *sp++;
-            *sp = ((*sp).AsUnsigned() <= u.AsUnsigned()) ? True : False;
-            break;
+            PolyWord u = tos;
+            tos = *(++sp);
+            tos = (tos.AsUnsigned() <= u.AsUnsigned()) ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_greaterSigned:
+        CASE(INSTR_greaterSigned):
         {
-            PolyWord u = *sp++;
-            *sp = ((*sp).AsSigned() > u.AsSigned()) ? True : False;
-            break;
+            PolyWord u = tos;
+            tos = *(++sp);
+            tos = (tos.AsSigned() > u.AsSigned()) ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_greaterUnsigned:
+        CASE(INSTR_greaterUnsigned):
         {
-            PolyWord u = *sp++;
-            *sp = ((*sp).AsUnsigned() > u.AsUnsigned()) ? True : False;
-            break;
+            PolyWord u = tos;
+            tos = *(++sp);
+            tos = (tos.AsUnsigned() > u.AsUnsigned()) ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_greaterEqSigned:
+        CASE(INSTR_greaterEqSigned):
         {
-            PolyWord u = *sp++;
-            *sp = ((*sp).AsSigned() >= u.AsSigned()) ? True : False;
-            break;
+            PolyWord u = tos;
+            tos = *(++sp);
+            tos = (tos.AsSigned() >= u.AsSigned()) ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_greaterEqUnsigned:
+        CASE(INSTR_greaterEqUnsigned):
         {
-            PolyWord u = *sp++;
-            *sp = ((*sp).AsUnsigned() >= u.AsUnsigned()) ? True : False;
-            break;
+            PolyWord u = tos;
+            tos = *(++sp);
+            tos = (tos.AsUnsigned() >= u.AsUnsigned()) ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_fixedAdd:
+        CASE(INSTR_fixedAdd):
         {
-            PolyWord x = *sp++;
-            PolyWord y = (*sp);
+            PolyWord x = tos;
+            tos = *(++sp);
+            PolyWord y = tos;
             POLYSIGNED t = UNTAGGED(x) + UNTAGGED(y);
             if (t <= MAXTAGGED && t >= -MAXTAGGED-1)
-                *sp = TAGGED(t);
+                tos = TAGGED(t);
             else
             {
-                *(--sp) = (PolyWord)overflowPacket;
+                tos = (PolyWord)overflowPacket;
                 goto RAISE_EXCEPTION;
             }
-            break;
+            NEXT_INSTR;
         }
 
-        case INSTR_fixedSub:
+        CASE(INSTR_fixedSub):
         {
-            PolyWord x = *sp++;
-            PolyWord y = (*sp);
+            PolyWord x = tos;
+            tos = *(++sp);
+            PolyWord y = tos;
             POLYSIGNED t = UNTAGGED(y) - UNTAGGED(x);
             if (t <= MAXTAGGED && t >= -MAXTAGGED-1)
-                *sp = TAGGED(t);
+                tos = TAGGED(t);
             else
             {
-                *(--sp) = (PolyWord)overflowPacket;
+                tos = (PolyWord)overflowPacket;
                 goto RAISE_EXCEPTION;
             }
-            break;
+            NEXT_INSTR;
         }
 
-        case INSTR_fixedMult:
+        CASE(INSTR_fixedMult):
         {
             // We need to detect overflow.  There doesn't seem to be any convenient way to do
             // this so we use the arbitrary precision package and check whether the result is short.
             // Clang and GCC 5.0 have __builtin_mul_overflow which will do this but GCC 5.0 is not
             // currently (July 2016) in Debian stable.
+            // mult_longc allocates and may garbage collect so the stack must be saved.
             Handle reset = this->saveVec.mark();
-            Handle pushedArg1 = this->saveVec.push(*sp++);
-            Handle pushedArg2 = this->saveVec.push(*sp);
+            Handle pushedArg1 = this->saveVec.push(tos);
+            tos = *(++sp);
+            Handle pushedArg2 = this->saveVec.push(tos);
+            SaveInterpreterState(pc, sp, tos);
             Handle result = mult_longc(this, pushedArg2, pushedArg1);
+            LoadInterpreterState(pc, sp, tos);
             PolyWord res = result->Word();
             this->saveVec.reset(reset);
             if (! res.IsTagged()) 
             {
-                *(--sp) = (PolyWord)overflowPacket;
+                tos = (PolyWord)overflowPacket;
                 goto RAISE_EXCEPTION;
             }
-            *sp = res;
-            break;
+            tos = res;
+            NEXT_INSTR;
         }
 
-        case INSTR_fixedQuot:
+        CASE(INSTR_fixedQuot):
         {
             // Zero and overflow are checked for in ML.
-            POLYSIGNED u = UNTAGGED(*sp++);
-            PolyWord y = (*sp);
-            *sp = TAGGED(UNTAGGED(y) / u);
-            break;
+            POLYSIGNED u = UNTAGGED(tos);
+            tos = *(++sp);
+            PolyWord y = tos;
+            tos = TAGGED(UNTAGGED(y) / u);
+            NEXT_INSTR;
         }
 
-        case INSTR_fixedRem:
+        CASE(INSTR_fixedRem):
         {
             // Zero and overflow are checked for in ML.
-            POLYSIGNED u = UNTAGGED(*sp++);
-            PolyWord y = (*sp);
-            *sp = TAGGED(UNTAGGED(y) % u);
-            break;
+            POLYSIGNED u = UNTAGGED(tos);
+            tos = *(++sp);
+            PolyWord y = tos;
+            tos = TAGGED(UNTAGGED(y) % u);
+            NEXT_INSTR;
         }
 
-        case INSTR_wordAdd:
+        CASE(INSTR_wordAdd):
         {
-            PolyWord u = *sp++;
+            PolyWord u = tos;
+            tos = *(++sp);
             // Because we're not concerned with overflow we can just add the values and subtract the tag.
-            *sp = PolyWord::FromUnsigned((*sp).AsUnsigned() + u.AsUnsigned() - TAGGED(0).AsUnsigned());
-            break;
+            tos = PolyWord::FromUnsigned(tos.AsUnsigned() + u.AsUnsigned() - TAGGED(0).AsUnsigned());
+            NEXT_INSTR;
         }
 
-        case INSTR_wordSub:
+        CASE(INSTR_wordSub):
         {
-            PolyWord u = *sp++;
-            *sp = PolyWord::FromUnsigned((*sp).AsUnsigned() - u.AsUnsigned() + TAGGED(0).AsUnsigned());
-            break;
+            PolyWord u = tos;
+            tos = *(++sp);
+            tos = PolyWord::FromUnsigned(tos.AsUnsigned() - u.AsUnsigned() + TAGGED(0).AsUnsigned());
+            NEXT_INSTR;
         }
 
-        case INSTR_wordMult:
+        CASE(INSTR_wordMult):
         {
-            PolyWord u = *sp++;
-            *sp = TAGGED(UNTAGGED_UNSIGNED(*sp) * UNTAGGED_UNSIGNED(u));
-            break;
+            PolyWord u = tos;
+            tos = *(++sp);
+            tos = TAGGED(UNTAGGED_UNSIGNED(tos) * UNTAGGED_UNSIGNED(u));
+            NEXT_INSTR;
         }
 
-        case INSTR_wordDiv:
+        CASE(INSTR_wordDiv):
         {
-            POLYUNSIGNED u = UNTAGGED_UNSIGNED(*sp++);
+            POLYUNSIGNED u = UNTAGGED_UNSIGNED(tos);
+            tos = *(++sp);
             // Detection of zero is done in ML
-            *sp = TAGGED(UNTAGGED_UNSIGNED(*sp) / u); break;
+            tos = TAGGED(UNTAGGED_UNSIGNED(tos) / u); NEXT_INSTR;
         }
 
-        case INSTR_wordMod:
+        CASE(INSTR_wordMod):
         {
-            POLYUNSIGNED u = UNTAGGED_UNSIGNED(*sp++);
-            *sp = TAGGED(UNTAGGED_UNSIGNED(*sp) % u);
-            break;
+            POLYUNSIGNED u = UNTAGGED_UNSIGNED(tos);
+            tos = *(++sp);
+            tos = TAGGED(UNTAGGED_UNSIGNED(tos) % u);
+            NEXT_INSTR;
         }
 
-        case INSTR_wordAnd:
+        CASE(INSTR_wordAnd):
         {
-            PolyWord u = *sp++;
+            PolyWord u = tos;
+            tos = *(++sp);
             // Since both of these should be tagged the tag bit will be preserved.
-            *sp = PolyWord::FromUnsigned((*sp).AsUnsigned() & u.AsUnsigned());
-            break;
+            tos = PolyWord::FromUnsigned(tos.AsUnsigned() & u.AsUnsigned());
+            NEXT_INSTR;
         }
 
-        case INSTR_wordOr:
+        CASE(INSTR_wordOr):
         {
-            PolyWord u = *sp++;
+            PolyWord u = tos;
+            tos = *(++sp);
             // Since both of these should be tagged the tag bit will be preserved.
-            *sp = PolyWord::FromUnsigned((*sp).AsUnsigned() | u.AsUnsigned());
-            break;
+            tos = PolyWord::FromUnsigned(tos.AsUnsigned() | u.AsUnsigned());
+            NEXT_INSTR;
         }
 
-        case INSTR_wordXor:
+        CASE(INSTR_wordXor):
         {
-            PolyWord u = *sp++;
+            PolyWord u = tos;
+            tos = *(++sp);
             // This will remove the tag bit so it has to be reinstated.
-            *sp = PolyWord::FromUnsigned(((*sp).AsUnsigned() ^ u.AsUnsigned()) | TAGGED(0).AsUnsigned());
-            break;
+            tos = PolyWord::FromUnsigned((tos.AsUnsigned() ^ u.AsUnsigned()) | TAGGED(0).AsUnsigned());
+            NEXT_INSTR;
         }
 
-        case INSTR_wordShiftLeft:
+        CASE(INSTR_wordShiftLeft):
         {
             // ML requires shifts greater than a word to return zero. 
             // That's dealt with at the higher level.
-            PolyWord u = *sp++;
-            *sp = TAGGED(UNTAGGED_UNSIGNED(*sp) << UNTAGGED_UNSIGNED(u));
-            break;
+            PolyWord u = tos;
+            tos = *(++sp);
+            tos = TAGGED(UNTAGGED_UNSIGNED(tos) << UNTAGGED_UNSIGNED(u));
+            NEXT_INSTR;
         }
 
-        case INSTR_wordShiftRLog:
+        CASE(INSTR_wordShiftRLog):
         {
-            PolyWord u = *sp++;
-            *sp = TAGGED(UNTAGGED_UNSIGNED(*sp) >> UNTAGGED_UNSIGNED(u));
-            break;
+            PolyWord u = tos;
+            tos = *(++sp);
+            tos = TAGGED(UNTAGGED_UNSIGNED(tos) >> UNTAGGED_UNSIGNED(u));
+            NEXT_INSTR;
         }
 
-        case INSTR_wordShiftRArith:
+        CASE(INSTR_wordShiftRArith):
         {
-            PolyWord u = *sp++;
+            PolyWord u = tos;
+            tos = *(++sp);
             // Strictly speaking, C does not require that this uses
             // arithmetic shifting so we really ought to set the
             // high-order bits explicitly.
-            *sp = TAGGED(UNTAGGED(*sp) >> UNTAGGED(u));
-            break;
+            tos = TAGGED(UNTAGGED(tos) >> UNTAGGED(u));
+            NEXT_INSTR;
         }
 
-        case INSTR_allocByteMem:
+        CASE(INSTR_allocByteMem):
         {
             // Allocate byte segment.  This does not need to be initialised.
-            POLYUNSIGNED flags = UNTAGGED_UNSIGNED(*sp++);
-            POLYUNSIGNED length = UNTAGGED_UNSIGNED(*sp);
-            PolyObject *t = this->allocateMemory(length, pc, sp);
+            POLYUNSIGNED flags = UNTAGGED_UNSIGNED(tos);
+            tos = *(++sp);
+            POLYUNSIGNED length = UNTAGGED_UNSIGNED(tos);
+            PolyObject *t = this->allocateMemory(length, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION; // Exception
             t->SetLengthWord(length, (byte)flags);
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_lgWordEqual:
+        CASE(INSTR_lgWordEqual):
         {
-            uintptr_t wx = *(uintptr_t*)((*sp++).AsObjPtr());
-            uintptr_t wy = *(uintptr_t*)((*sp).AsObjPtr());
-            *sp = wx == wy ? True : False;
-            break;
+            uintptr_t wx = *(uintptr_t*)(tos.AsObjPtr());
+            tos = *(++sp);
+            uintptr_t wy = *(uintptr_t*)(tos.AsObjPtr());
+            tos = wx == wy ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_lgWordLess:
+        CASE(INSTR_lgWordLess):
         {
-            uintptr_t wx = *(uintptr_t*)((*sp++).AsObjPtr());
-            uintptr_t wy = *(uintptr_t*)((*sp).AsObjPtr());
-            *sp = (wy < wx) ? True : False;
-            break;
+            uintptr_t wx = *(uintptr_t*)(tos.AsObjPtr());
+            tos = *(++sp);
+            uintptr_t wy = *(uintptr_t*)(tos.AsObjPtr());
+            tos = (wy < wx) ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_lgWordLessEq:
+        CASE(INSTR_lgWordLessEq):
         {
-            uintptr_t wx = *(uintptr_t*)((*sp++).AsObjPtr());
-            uintptr_t wy = *(uintptr_t*)((*sp).AsObjPtr());
-            *sp = (wy <= wx) ? True : False;
-            break;
+            uintptr_t wx = *(uintptr_t*)(tos.AsObjPtr());
+            tos = *(++sp);
+            uintptr_t wy = *(uintptr_t*)(tos.AsObjPtr());
+            tos = (wy <= wx) ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_lgWordGreater:
+        CASE(INSTR_lgWordGreater):
         {
-            uintptr_t wx = *(uintptr_t*)((*sp++).AsObjPtr());
-            uintptr_t wy = *(uintptr_t*)((*sp).AsObjPtr());
-            *sp = (wy > wx) ? True : False;
-            break;
+            uintptr_t wx = *(uintptr_t*)(tos.AsObjPtr());
+            tos = *(++sp);
+            uintptr_t wy = *(uintptr_t*)(tos.AsObjPtr());
+            tos = (wy > wx) ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_lgWordGreaterEq:
+        CASE(INSTR_lgWordGreaterEq):
         {
-            uintptr_t wx = *(uintptr_t*)((*sp++).AsObjPtr());
-            uintptr_t wy = *(uintptr_t*)((*sp).AsObjPtr());
-            *sp = (wy >= wx) ? True : False;
-            break;
+            uintptr_t wx = *(uintptr_t*)(tos.AsObjPtr());
+            tos = *(++sp);
+            uintptr_t wy = *(uintptr_t*)(tos.AsObjPtr());
+            tos = (wy >= wx) ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_lgWordAdd:
+        CASE(INSTR_lgWordAdd):
         {
-            uintptr_t wx = *(uintptr_t*)((*sp++).AsObjPtr());
-            uintptr_t wy = *(uintptr_t*)((*sp).AsObjPtr());
-            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp);
+            uintptr_t wx = *(uintptr_t*)(tos.AsObjPtr());
+            tos = *(++sp);
+            uintptr_t wy = *(uintptr_t*)(tos.AsObjPtr());
+            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
             t->SetLengthWord(LGWORDSIZE, F_BYTE_OBJ);
             *(uintptr_t*)t = wy+wx;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_lgWordSub:
+        CASE(INSTR_lgWordSub):
         {
-            uintptr_t wx = *(uintptr_t*)((*sp++).AsObjPtr());
-            uintptr_t wy = *(uintptr_t*)((*sp).AsObjPtr());
-            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp);
+            uintptr_t wx = *(uintptr_t*)(tos.AsObjPtr());
+            tos = *(++sp);
+            uintptr_t wy = *(uintptr_t*)(tos.AsObjPtr());
+            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
             t->SetLengthWord(LGWORDSIZE, F_BYTE_OBJ);
             *(uintptr_t*)t = wy-wx;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_lgWordMult:
+        CASE(INSTR_lgWordMult):
         {
-            uintptr_t wx = *(uintptr_t*)((*sp++).AsObjPtr());
-            uintptr_t wy = *(uintptr_t*)((*sp).AsObjPtr());
-            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp);
+            uintptr_t wx = *(uintptr_t*)(tos.AsObjPtr());
+            tos = *(++sp);
+            uintptr_t wy = *(uintptr_t*)(tos.AsObjPtr());
+            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
             t->SetLengthWord(LGWORDSIZE, F_BYTE_OBJ);
             *(uintptr_t*)t = wy*wx;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_lgWordDiv:
+        CASE(INSTR_lgWordDiv):
          {
-            uintptr_t wx = *(uintptr_t*)((*sp++).AsObjPtr());
-            uintptr_t wy = *(uintptr_t*)((*sp).AsObjPtr());
-            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp);
+            uintptr_t wx = *(uintptr_t*)(tos.AsObjPtr());
+            tos = *(++sp);
+            uintptr_t wy = *(uintptr_t*)(tos.AsObjPtr());
+            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
             t->SetLengthWord(LGWORDSIZE, F_BYTE_OBJ);
             *(uintptr_t*)t = wy/wx;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_lgWordMod:
+        CASE(INSTR_lgWordMod):
         {
-            uintptr_t wx = *(uintptr_t*)((*sp++).AsObjPtr());
-            uintptr_t wy = *(uintptr_t*)((*sp).AsObjPtr());
-            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp);
+            uintptr_t wx = *(uintptr_t*)(tos.AsObjPtr());
+            tos = *(++sp);
+            uintptr_t wy = *(uintptr_t*)(tos.AsObjPtr());
+            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
             t->SetLengthWord(LGWORDSIZE, F_BYTE_OBJ);
             *(uintptr_t*)t = wy%wx;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_lgWordAnd:
+        CASE(INSTR_lgWordAnd):
         {
-            uintptr_t wx = *(uintptr_t*)((*sp++).AsObjPtr());
-            uintptr_t wy = *(uintptr_t*)((*sp).AsObjPtr());
-            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp);
+            uintptr_t wx = *(uintptr_t*)(tos.AsObjPtr());
+            tos = *(++sp);
+            uintptr_t wy = *(uintptr_t*)(tos.AsObjPtr());
+            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
             t->SetLengthWord(LGWORDSIZE, F_BYTE_OBJ);
             *(uintptr_t*)t = wy&wx;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_lgWordOr:
+        CASE(INSTR_lgWordOr):
         {
-            uintptr_t wx = *(uintptr_t*)((*sp++).AsObjPtr());
-            uintptr_t wy = *(uintptr_t*)((*sp).AsObjPtr());
-            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp);
+            uintptr_t wx = *(uintptr_t*)(tos.AsObjPtr());
+            tos = *(++sp);
+            uintptr_t wy = *(uintptr_t*)(tos.AsObjPtr());
+            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
             t->SetLengthWord(LGWORDSIZE, F_BYTE_OBJ);
             *(uintptr_t*)t = wy|wx;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_lgWordXor:
+        CASE(INSTR_lgWordXor):
         {
-            uintptr_t wx = *(uintptr_t*)((*sp++).AsObjPtr());
-            uintptr_t wy = *(uintptr_t*)((*sp).AsObjPtr());
-            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp);
+            uintptr_t wx = *(uintptr_t*)(tos.AsObjPtr());
+            tos = *(++sp);
+            uintptr_t wy = *(uintptr_t*)(tos.AsObjPtr());
+            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
             t->SetLengthWord(LGWORDSIZE, F_BYTE_OBJ);
             *(uintptr_t*)t = wy^wx;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_lgWordShiftLeft:
+        CASE(INSTR_lgWordShiftLeft):
         {
             // The shift amount is a tagged word not a boxed large word
-            POLYUNSIGNED wx = UNTAGGED_UNSIGNED(*sp++);
-            uintptr_t wy = *(uintptr_t*)((*sp).AsObjPtr());
-            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp);
+            POLYUNSIGNED wx = UNTAGGED_UNSIGNED(tos);
+            tos = *(++sp);
+            uintptr_t wy = *(uintptr_t*)(tos.AsObjPtr());
+            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
             t->SetLengthWord(LGWORDSIZE, F_BYTE_OBJ);
             *(uintptr_t*)t = wy << wx;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_lgWordShiftRLog:
+        CASE(INSTR_lgWordShiftRLog):
         {
             // The shift amount is a tagged word not a boxed large word
-            POLYUNSIGNED wx = UNTAGGED_UNSIGNED(*sp++);
-            uintptr_t wy = *(uintptr_t*)((*sp).AsObjPtr());
-            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp);
+            POLYUNSIGNED wx = UNTAGGED_UNSIGNED(tos);
+            tos = *(++sp);
+            uintptr_t wy = *(uintptr_t*)(tos.AsObjPtr());
+            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
             t->SetLengthWord(LGWORDSIZE, F_BYTE_OBJ);
             *(uintptr_t*)t = wy >> wx;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_lgWordShiftRArith:
+        CASE(INSTR_lgWordShiftRArith):
         {
             // The shift amount is a tagged word not a boxed large word
-            POLYUNSIGNED wx = UNTAGGED_UNSIGNED(*sp++);
-            intptr_t wy = *(intptr_t*)((*sp).AsObjPtr());
-            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp);
+            POLYUNSIGNED wx = UNTAGGED_UNSIGNED(tos);
+            tos = *(++sp);
+            intptr_t wy = *(intptr_t*)(tos.AsObjPtr());
+            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
             t->SetLengthWord(LGWORDSIZE, F_BYTE_OBJ);
             *(intptr_t*)t = wy >> wx;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_realEqual:
+        CASE(INSTR_realEqual):
         {
-            double u = unboxDouble(*sp++);
-            *sp = u == unboxDouble(*sp) ? True: False;
-            break;
+            double u = unboxDouble(tos);
+            tos = *(++sp);
+            tos = u == unboxDouble(tos) ? True: False;
+            NEXT_INSTR;
         }
 
-        case INSTR_realLess:
+        CASE(INSTR_realLess):
         {
-            double u = unboxDouble(*sp++);
-            *sp =  unboxDouble(*sp) < u ? True: False;
-            break;
+            double u = unboxDouble(tos);
+            tos = *(++sp);
+            tos =  unboxDouble(tos) < u ? True: False;
+            NEXT_INSTR;
         }
 
-        case INSTR_realLessEq:
+        CASE(INSTR_realLessEq):
         {
-            double u = unboxDouble(*sp++);
-            *sp =  unboxDouble(*sp) <= u ? True: False;
-            break;
+            double u = unboxDouble(tos);
+            tos = *(++sp);
+            tos =  unboxDouble(tos) <= u ? True: False;
+            NEXT_INSTR;
         }
 
-        case INSTR_realGreater:
+        CASE(INSTR_realGreater):
         {
-            double u = unboxDouble(*sp++);
-            *sp =  unboxDouble(*sp) > u ? True: False;
-            break;
+            double u = unboxDouble(tos);
+            tos = *(++sp);
+            tos =  unboxDouble(tos) > u ? True: False;
+            NEXT_INSTR;
         }
 
-        case INSTR_realGreaterEq:
+        CASE(INSTR_realGreaterEq):
         {
-            double u = unboxDouble(*sp++);
-            *sp =  unboxDouble(*sp) >= u ? True: False;
-            break;
+            double u = unboxDouble(tos);
+            tos = *(++sp);
+            tos =  unboxDouble(tos) >= u ? True: False;
+            NEXT_INSTR;
         }
 
-        case INSTR_realUnordered:
+        CASE(INSTR_realUnordered):
         {
-            double u = unboxDouble(*sp++);
-            double v = unboxDouble(*sp);
-            *sp = (std::isnan(u) || std::isnan(v)) ? True : False;
-            break;
+            double u = unboxDouble(tos);
+            tos = *(++sp);
+            double v = unboxDouble(tos);
+            tos = (std::isnan(u) || std::isnan(v)) ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_realAdd:
+        CASE(INSTR_realAdd):
         {
-            double u = unboxDouble(*sp++);
-            double v = unboxDouble(*sp);
-            PolyObject *t = this->boxDouble(v+u, pc, sp);
+            double u = unboxDouble(tos);
+            tos = *(++sp);
+            double v = unboxDouble(tos);
+            PolyObject *t = this->boxDouble(v+u, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_realSub:
+        CASE(INSTR_realSub):
         {
-            double u = unboxDouble(*sp++);
-            double v = unboxDouble(*sp);
-            PolyObject *t = this->boxDouble(v-u, pc, sp);
+            double u = unboxDouble(tos);
+            tos = *(++sp);
+            double v = unboxDouble(tos);
+            PolyObject *t = this->boxDouble(v-u, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_realMult:
+        CASE(INSTR_realMult):
         {
-            double u = unboxDouble(*sp++);
-            double v = unboxDouble(*sp);
-            PolyObject *t = this->boxDouble(v*u, pc, sp);
+            double u = unboxDouble(tos);
+            tos = *(++sp);
+            double v = unboxDouble(tos);
+            PolyObject *t = this->boxDouble(v*u, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_realDiv:
+        CASE(INSTR_realDiv):
         {
-            double u = unboxDouble(*sp++);
-            double v = unboxDouble(*sp);
-            PolyObject *t = this->boxDouble(v/u, pc, sp);
+            double u = unboxDouble(tos);
+            tos = *(++sp);
+            double v = unboxDouble(tos);
+            PolyObject *t = this->boxDouble(v/u, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_floatEqual:
+        CASE(INSTR_floatEqual):
         {
-            float u = unboxFloat(*sp++);
-            *sp = u == unboxFloat(*sp) ? True : False;
-            break;
+            float u = unboxFloat(tos);
+            tos = *(++sp);
+            tos = u == unboxFloat(tos) ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_floatLess:
+        CASE(INSTR_floatLess):
         {
-            float u = unboxFloat(*sp++);
-            *sp = unboxFloat(*sp) < u ? True : False;
-            break;
+            float u = unboxFloat(tos);
+            tos = *(++sp);
+            tos = unboxFloat(tos) < u ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_floatLessEq:
+        CASE(INSTR_floatLessEq):
         {
-            float u = unboxFloat(*sp++);
-            *sp = unboxFloat(*sp) <= u ? True : False;
-            break;
+            float u = unboxFloat(tos);
+            tos = *(++sp);
+            tos = unboxFloat(tos) <= u ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_floatGreater:
+        CASE(INSTR_floatGreater):
         {
-            float u = unboxFloat(*sp++);
-            *sp = unboxFloat(*sp) > u ? True : False;
-            break;
+            float u = unboxFloat(tos);
+            tos = *(++sp);
+            tos = unboxFloat(tos) > u ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_floatGreaterEq:
+        CASE(INSTR_floatGreaterEq):
         {
-            float u = unboxFloat(*sp++);
-            *sp = unboxFloat(*sp) >= u ? True : False;
-            break;
+            float u = unboxFloat(tos);
+            tos = *(++sp);
+            tos = unboxFloat(tos) >= u ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_floatUnordered:
+        CASE(INSTR_floatUnordered):
         {
-            float u = unboxFloat(*sp++);
-            float v = unboxFloat(*sp);
-            *sp = (std::isnan(u) || std::isnan(v)) ? True : False;
-            break;
+            float u = unboxFloat(tos);
+            tos = *(++sp);
+            float v = unboxFloat(tos);
+            tos = (std::isnan(u) || std::isnan(v)) ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_floatAdd:
+        CASE(INSTR_floatAdd):
         {
-            float u = unboxFloat(*sp++);
-            float v = unboxFloat(*sp);
-            PolyObject *t = this->boxFloat(v + u, pc, sp);
+            float u = unboxFloat(tos);
+            tos = *(++sp);
+            float v = unboxFloat(tos);
+            PolyObject *t = this->boxFloat(v + u, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *sp = t;
-            break;
+            tos = t;
+            NEXT_INSTR;
         }
 
-        case INSTR_floatSub:
+        CASE(INSTR_floatSub):
         {
-            float u = unboxFloat(*sp++);
-            float v = unboxFloat(*sp);
-            PolyObject *t = this->boxFloat(v - u, pc, sp);
+            float u = unboxFloat(tos);
+            tos = *(++sp);
+            float v = unboxFloat(tos);
+            PolyObject *t = this->boxFloat(v - u, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *sp = t;
-            break;
+            tos = t;
+            NEXT_INSTR;
         }
 
-        case INSTR_floatMult:
+        CASE(INSTR_floatMult):
         {
-            float u = unboxFloat(*sp++);
-            float v = unboxFloat(*sp);
-            PolyObject *t = this->boxFloat(v*u, pc, sp);
+            float u = unboxFloat(tos);
+            tos = *(++sp);
+            float v = unboxFloat(tos);
+            PolyObject *t = this->boxFloat(v*u, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *sp = t;
-            break;
+            tos = t;
+            NEXT_INSTR;
         }
 
-        case INSTR_floatDiv:
+        CASE(INSTR_floatDiv):
         {
-            float u = unboxFloat(*sp++);
-            float v = unboxFloat(*sp);
-            PolyObject *t = this->boxFloat(v / u, pc, sp);
+            float u = unboxFloat(tos);
+            tos = *(++sp);
+            float v = unboxFloat(tos);
+            PolyObject *t = this->boxFloat(v / u, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *sp = t;
-            break;
+            tos = t;
+            NEXT_INSTR;
         }
 
-        case INSTR_realToFloat:
+        CASE(INSTR_realToFloat):
         {
             // Convert a double to a float.  It's complicated because it depends on the rounding mode.
             int rMode = *pc++;
@@ -1807,21 +2295,21 @@ int IntTaskData::SwitchToPoly()
             // Don't call unboxDouble until we're set the rounding.  GCC seems to convert it
             // before the actual float cast.
             if (rMode < 4) setrounding(rMode);
-            double d = unboxDouble(*sp);
+            double d = unboxDouble(tos);
             float v = (float)d; // Convert with the appropriate rounding.
             setrounding(current);
-            PolyObject *t = this->boxFloat(v, pc, sp);
+            PolyObject *t = this->boxFloat(v, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *sp = t;
-            break;
+            tos = t;
+            NEXT_INSTR;
         }
 
-        case INSTR_realToInt:
-            dv = unboxDouble(*sp);
+        CASE(INSTR_realToInt):
+            dv = unboxDouble(tos);
             goto realtoint;
 
-        case INSTR_floatToInt:
-            dv = (double)unboxFloat(*sp);
+        CASE(INSTR_floatToInt):
+            dv = (double)unboxFloat(tos);
             realtoint:
         {
             // Convert a double or a float to a tagged integer.
@@ -1832,7 +2320,7 @@ int IntTaskData::SwitchToPoly()
             if (dv > (double)(MAXTAGGED + MAXTAGGED / 2) ||
                 dv < -(double)(MAXTAGGED + MAXTAGGED / 2))
             {
-                *(--sp) = overflowPacket;
+                tos = overflowPacket;
                 goto RAISE_EXCEPTION;
             }
             POLYSIGNED p;
@@ -1856,325 +2344,391 @@ int IntTaskData::SwitchToPoly()
             // Check that the value can be tagged.
             if (p > MAXTAGGED || p < -MAXTAGGED - 1)
             {
-                *(--sp) = overflowPacket;
+                tos = overflowPacket;
                 goto RAISE_EXCEPTION;
             }
-            *sp = TAGGED(p);
-            break;
+            tos = TAGGED(p);
+            NEXT_INSTR;
         }
 
-        case INSTR_getThreadId:
-            *(--sp) = (PolyWord)this->threadObject;
-            break;
+        CASE(INSTR_getThreadId):
+            *sp-- = tos;
+            tos = (PolyWord)this->threadObject;
+            NEXT_INSTR;
 
-        case INSTR_allocWordMemory:
+        CASE(INSTR_allocWordMemory):
         {
             // Allocate word segment.  This must be initialised.
             // We mustn't pop the initialiser until after any potential GC.
             POLYUNSIGNED length = UNTAGGED_UNSIGNED(sp[2]);
-            PolyObject *t = this->allocateMemory(length, pc, sp);
+            PolyObject *t = this->allocateMemory(length, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            PolyWord initialiser = *sp++;
-            POLYUNSIGNED flags = UNTAGGED_UNSIGNED(*sp++);
+            PolyWord initialiser = tos;
+            POLYUNSIGNED flags = UNTAGGED_UNSIGNED(sp[1]);
+            sp += 2;
             t->SetLengthWord(length, (byte)flags);
-            *sp = (PolyWord)t;
+            tos = (PolyWord)t;
             // Have to initialise the data.
             for (; length > 0; ) t->Set(--length, initialiser);
-            break;
+            NEXT_INSTR;
         }
 
-        case INSTR_alloc_ref:
+        CASE(INSTR_alloc_ref):
         {
             // Allocate a single word mutable cell.  This is more common than allocWordMemory on its own.
-            PolyObject *t = this->allocateMemory(1, pc, sp);
+            PolyObject *t = this->allocateMemory(1, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            PolyWord initialiser = (*sp);
+            PolyWord initialiser = tos;
             t->SetLengthWord(1, F_MUTABLE_BIT);
             t->Set(0, initialiser);
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_loadMLWord:
+        CASE(INSTR_loadMLWord):
         {
             // The values on the stack are base, index and offset.
-            POLYUNSIGNED offset = UNTAGGED(*sp++);
-            POLYUNSIGNED index = UNTAGGED(*sp++);
-            PolyObject *p = (PolyObject*)((*sp).AsCodePtr() + offset);
-            *sp = p->Get(index);
-            break;
+            POLYUNSIGNED offset = UNTAGGED(tos);
+            POLYUNSIGNED index = UNTAGGED(*(++sp));
+            tos = *(++sp);
+            PolyObject *p = (PolyObject*)(tos.AsCodePtr() + offset);
+            tos = p->Get(index);
+            NEXT_INSTR;
         }
 
-        case INSTR_loadMLByte:
+        CASE(INSTR_loadMLByte):
         {
             // The values on the stack are base and index.
-            POLYUNSIGNED index = UNTAGGED(*sp++);
-            POLYCODEPTR p = (*sp).AsCodePtr();
-            *sp = TAGGED(p[index]); // Have to tag the result
-            break;
+            POLYUNSIGNED index = UNTAGGED(tos);
+            tos = *(++sp);
+            POLYCODEPTR p = tos.AsCodePtr();
+            tos = TAGGED(p[index]); // Have to tag the result
+            NEXT_INSTR;
         }
 
-        case INSTR_loadC8:
+        CASE(INSTR_loadC8):
         {
             // This is similar to loadMLByte except that the base address is a boxed large-word.
             // Also the index is SIGNED.
-            POLYSIGNED index = UNTAGGED(*sp++);
-            POLYCODEPTR p = *((byte **)((*sp).AsObjPtr()));
-            *sp = TAGGED(p[index]); // Have to tag the result
-            break;
+            POLYSIGNED index = UNTAGGED(tos);
+            tos = *(++sp);
+            POLYCODEPTR p = *((byte **)(tos.AsObjPtr()));
+            tos = TAGGED(p[index]); // Have to tag the result
+            NEXT_INSTR;
         }
 
-        case INSTR_loadC16:
+        CASE(INSTR_loadC16):
         {
             // This and the other loads are similar to loadMLWord with separate
             // index and offset values.
-            POLYSIGNED offset = UNTAGGED(*sp++);
-            POLYSIGNED index = UNTAGGED(*sp++);
-            POLYCODEPTR p = *((byte **)((*sp).AsObjPtr())) + offset;
+            POLYSIGNED offset = UNTAGGED(tos);
+            POLYSIGNED index = UNTAGGED(*(++sp));
+            tos = *(++sp);
+            POLYCODEPTR p = *((byte **)(tos.AsObjPtr())) + offset;
             POLYUNSIGNED r = ((uint16_t*)p)[index];
-            *sp = TAGGED(r);
-            break;
+            tos = TAGGED(r);
+            NEXT_INSTR;
         }
 
-        case INSTR_loadC32:
+        CASE(INSTR_loadC32):
         {
-            POLYSIGNED offset = UNTAGGED(*sp++);
-            POLYSIGNED index = UNTAGGED(*sp++);
-            POLYCODEPTR p = *((byte **)((*sp).AsObjPtr())) + offset;
+            POLYSIGNED offset = UNTAGGED(tos);
+            POLYSIGNED index = UNTAGGED(*(++sp));
+            tos = *(++sp);
+            POLYCODEPTR p = *((byte **)(tos.AsObjPtr())) + offset;
             uintptr_t r = ((uint32_t*)p)[index];
 #ifdef IS64BITS
             // This is tagged in 64-bit mode
-            *sp = TAGGED(r);
+            tos = TAGGED(r);
 #else
             // But boxed in 32-bit mode.
-            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp);
+            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
             t->SetLengthWord(LGWORDSIZE, F_BYTE_OBJ);
             *(uintptr_t*)t = r;
-            *sp = (PolyWord)t;
+            tos = (PolyWord)t;
 #endif
-            break;
+            NEXT_INSTR;
         }
 
 #if (defined(IS64BITS))
-        case INSTR_loadC64:
+        CASE(INSTR_loadC64):
         {
-            POLYSIGNED offset = UNTAGGED(*sp++);
-            POLYSIGNED index = UNTAGGED(*sp++);
-            POLYCODEPTR p = *((byte **)((*sp).AsObjPtr())) + offset;
+            POLYSIGNED offset = UNTAGGED(tos);
+            POLYSIGNED index = UNTAGGED(*(++sp));
+            tos = *(++sp);
+            POLYCODEPTR p = *((byte **)(tos.AsObjPtr())) + offset;
             uintptr_t r = ((uint64_t*)p)[index];
             // This must be boxed.
-            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp);
+            PolyObject *t = this->allocateMemory(LGWORDSIZE, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
             t->SetLengthWord(LGWORDSIZE, F_BYTE_OBJ);
             *(uintptr_t*)t = r;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 #endif
 
-        case INSTR_loadCFloat:
+        CASE(INSTR_loadCFloat):
         {
-            POLYSIGNED offset = UNTAGGED(*sp++);
-            POLYSIGNED index = UNTAGGED(*sp++);
-            POLYCODEPTR p = *((byte **)((*sp).AsObjPtr())) + offset;
+            POLYSIGNED offset = UNTAGGED(tos);
+            POLYSIGNED index = UNTAGGED(*(++sp));
+            tos = *(++sp);
+            POLYCODEPTR p = *((byte **)(tos.AsObjPtr())) + offset;
             double r = ((float*)p)[index];
             // This must be boxed.
-            PolyObject *t = this->boxDouble(r, pc, sp);
+            PolyObject *t = this->boxDouble(r, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_loadCDouble:
+        CASE(INSTR_loadCDouble):
         {
-            POLYSIGNED offset = UNTAGGED(*sp++);
-            POLYSIGNED index = UNTAGGED(*sp++);
-            POLYCODEPTR p = *((byte **)((*sp).AsObjPtr())) + offset;
+            POLYSIGNED offset = UNTAGGED(tos);
+            POLYSIGNED index = UNTAGGED(*(++sp));
+            tos = *(++sp);
+            POLYCODEPTR p = *((byte **)(tos.AsObjPtr())) + offset;
             double r = ((double*)p)[index];
             // This must be boxed.
-            PolyObject *t = this->boxDouble(r, pc, sp);
+            PolyObject *t = this->boxDouble(r, pc, sp, tos);
             if (t == 0) goto RAISE_EXCEPTION;
-            *sp = (PolyWord)t;
-            break;
+            tos = (PolyWord)t;
+            NEXT_INSTR;
         }
 
-        case INSTR_loadUntagged:
+        CASE(INSTR_loadUntagged):
         {
             // The values on the stack are base, index and offset.
-            POLYUNSIGNED offset = UNTAGGED(*sp++);
-            POLYUNSIGNED index = UNTAGGED(*sp++);
-            PolyObject *p = (PolyObject*)((*sp).AsCodePtr() + offset);
-            *sp = TAGGED(p->Get(index).AsUnsigned());
-            break;
+            POLYUNSIGNED offset = UNTAGGED(tos);
+            POLYUNSIGNED index = UNTAGGED(*(++sp));
+            tos = *(++sp);
+            PolyObject *p = (PolyObject*)(tos.AsCodePtr() + offset);
+            tos = TAGGED(p->Get(index).AsUnsigned());
+            NEXT_INSTR;
         }
 
-        case INSTR_storeMLWord: 
+        CASE(INSTR_storeMLWord): 
         {
-            PolyWord toStore = *sp++;
-            POLYUNSIGNED offset = UNTAGGED(*sp++);
-            POLYUNSIGNED index = UNTAGGED(*sp++);
-            PolyObject *p = (PolyObject*)((*sp).AsCodePtr() + offset);
+            PolyWord toStore = tos;
+            POLYUNSIGNED offset = UNTAGGED(*(++sp));
+            POLYUNSIGNED index = UNTAGGED(*(++sp));
+            tos = *(++sp);
+            PolyObject *p = (PolyObject*)(tos.AsCodePtr() + offset);
             p->Set(index, toStore);
-            *sp = Zero;
-            break;
+            tos = Zero;
+            NEXT_INSTR;
         }
 
-        case INSTR_storeMLByte: 
+        CASE(INSTR_storeMLByte): 
         {
-            POLYUNSIGNED toStore = UNTAGGED(*sp++);
-            POLYUNSIGNED index = UNTAGGED(*sp++);
-            POLYCODEPTR p = (*sp).AsCodePtr();
+            POLYUNSIGNED toStore = UNTAGGED(tos);
+            POLYUNSIGNED index = UNTAGGED(*(++sp));
+            tos = *(++sp);
+            POLYCODEPTR p = tos.AsCodePtr();
             p[index] = (byte)toStore;
-            *sp = Zero;
-            break; 
+            tos = Zero;
+            NEXT_INSTR; 
         }
 
-        case INSTR_storeC8: 
+        CASE(INSTR_storeC8): 
         {
             // Similar to storeMLByte except that the base address is a boxed large-word.
-            POLYUNSIGNED toStore = UNTAGGED(*sp++);
-            POLYSIGNED index = UNTAGGED(*sp++);
-            POLYCODEPTR p = *((byte **)((*sp).AsObjPtr()));
+            POLYUNSIGNED toStore = UNTAGGED(tos);
+            POLYSIGNED index = UNTAGGED(*(++sp));
+            tos = *(++sp);
+            POLYCODEPTR p = *((byte **)(tos.AsObjPtr()));
             p[index] = (byte)toStore;
-            *sp = Zero;
-            break; 
+            tos = Zero;
+            NEXT_INSTR; 
         }
 
-        case INSTR_storeC16:
+        CASE(INSTR_storeC16):
         {
-            uint16_t toStore = (uint16_t)UNTAGGED(*sp++);
-            POLYSIGNED offset = UNTAGGED(*sp++);
-            POLYSIGNED index = UNTAGGED(*sp++);
-            POLYCODEPTR p = *((byte **)((*sp).AsObjPtr())) + offset;
+            uint16_t toStore = (uint16_t)UNTAGGED(tos);
+            POLYSIGNED offset = UNTAGGED(*(++sp));
+            POLYSIGNED index = UNTAGGED(*(++sp));
+            tos = *(++sp);
+            POLYCODEPTR p = *((byte **)(tos.AsObjPtr())) + offset;
             ((uint16_t*)p)[index] = toStore;
-            *sp = Zero;
-            break;
+            tos = Zero;
+            NEXT_INSTR;
         }
 
-        case INSTR_storeC32:
+        CASE(INSTR_storeC32):
         {
 #ifdef IS64BITS
             // This is a tagged value in 64-bit mode.
-            uint32_t toStore = (uint32_t)UNTAGGED(*sp++);
+            uint32_t toStore = (uint32_t)UNTAGGED(tos);
 #else
             // but a boxed value in 32-bit mode.
-            uint32_t toStore = (uint32_t)(*(uintptr_t*)((*sp++).AsObjPtr()));
+            uint32_t toStore = (uint32_t)(*(uintptr_t*)(tos.AsObjPtr()));
 #endif
-            POLYSIGNED offset = UNTAGGED(*sp++);
-            POLYSIGNED index = UNTAGGED(*sp++);
-            POLYCODEPTR p = *((byte **)((*sp).AsObjPtr())) + offset;
+            POLYSIGNED offset = UNTAGGED(*(++sp));
+            POLYSIGNED index = UNTAGGED(*(++sp));
+            tos = *(++sp);
+            POLYCODEPTR p = *((byte **)(tos.AsObjPtr())) + offset;
             ((uint32_t*)p)[index] = toStore;
-            *sp = Zero;
-            break;
+            tos = Zero;
+            NEXT_INSTR;
         }
 
 #if (defined(IS64BITS))
-        case INSTR_storeC64:
+        CASE(INSTR_storeC64):
         {
             // This is a boxed value.
-            uint64_t toStore = *(uintptr_t*)((*sp++).AsObjPtr());
-            POLYSIGNED offset = UNTAGGED(*sp++);
-            POLYSIGNED index = UNTAGGED(*sp++);
-            POLYCODEPTR p = *((byte **)((*sp).AsObjPtr())) + offset;
+            uint64_t toStore = *(uintptr_t*)(tos.AsObjPtr());
+            POLYSIGNED offset = UNTAGGED(*(++sp));
+            POLYSIGNED index = UNTAGGED(*(++sp));
+            tos = *(++sp);
+            POLYCODEPTR p = *((byte **)(tos.AsObjPtr())) + offset;
             ((uint64_t*)p)[index] = toStore;
-            *sp = Zero;
-            break;
+            tos = Zero;
+            NEXT_INSTR;
         }
 #endif
 
-        case INSTR_storeCFloat:
+        CASE(INSTR_storeCFloat):
         {
             // This is a boxed value.
-            float toStore = (float)unboxDouble(*sp++);
-            POLYSIGNED offset = UNTAGGED(*sp++);
-            POLYSIGNED index = UNTAGGED(*sp++);
-            POLYCODEPTR p = *((byte **)((*sp).AsObjPtr())) + offset;
+            float toStore = (float)unboxDouble(tos);
+            POLYSIGNED offset = UNTAGGED(*(++sp));
+            POLYSIGNED index = UNTAGGED(*(++sp));
+            tos = *(++sp);
+            POLYCODEPTR p = *((byte **)(tos.AsObjPtr())) + offset;
             ((float*)p)[index] = toStore;
-            *sp = Zero;
-            break;
+            tos = Zero;
+            NEXT_INSTR;
         }
 
-        case INSTR_storeCDouble:
+        CASE(INSTR_storeCDouble):
         {
             // This is a boxed value.
-            double toStore = unboxDouble(*sp++);
-            POLYSIGNED offset = UNTAGGED(*sp++);
-            POLYSIGNED index = UNTAGGED(*sp++);
-            POLYCODEPTR p = *((byte **)((*sp).AsObjPtr())) + offset;
+            double toStore = unboxDouble(tos);
+            POLYSIGNED offset = UNTAGGED(*(++sp));
+            POLYSIGNED index = UNTAGGED(*(++sp));
+            tos = *(++sp);
+            POLYCODEPTR p = *((byte **)(tos.AsObjPtr())) + offset;
             ((double*)p)[index] = toStore;
-            *sp = Zero;
-            break;
+            tos = Zero;
+            NEXT_INSTR;
         }
 
-        case INSTR_storeUntagged: 
+        CASE(INSTR_storeUntagged): 
         {
-            PolyWord toStore = PolyWord::FromUnsigned(UNTAGGED_UNSIGNED(*sp++));
-            POLYUNSIGNED offset = UNTAGGED(*sp++);
-            POLYUNSIGNED index = UNTAGGED(*sp++);
-            PolyObject *p = (PolyObject*)((*sp).AsCodePtr() + offset);
+            PolyWord toStore = PolyWord::FromUnsigned(UNTAGGED_UNSIGNED(tos));
+            POLYUNSIGNED offset = UNTAGGED(*(++sp));
+            POLYUNSIGNED index = UNTAGGED(*(++sp));
+            tos = *(++sp);
+            PolyObject *p = (PolyObject*)(tos.AsCodePtr() + offset);
             p->Set(index, toStore);
-            *sp = Zero;
-            break;
+            tos = Zero;
+            NEXT_INSTR;
         }
 
-        case INSTR_blockMoveWord:
+        CASE(INSTR_blockMoveWord):
         {
             // The offsets are byte counts but the the indexes are in words.
-            POLYUNSIGNED length = UNTAGGED_UNSIGNED(*sp++);
-            POLYUNSIGNED destOffset = UNTAGGED_UNSIGNED(*sp++);
-            POLYUNSIGNED destIndex = UNTAGGED_UNSIGNED(*sp++);
-            PolyObject *dest = (PolyObject*)((*sp++).AsCodePtr() + destOffset);
-            POLYUNSIGNED srcOffset = UNTAGGED_UNSIGNED(*sp++);
-            POLYUNSIGNED srcIndex = UNTAGGED_UNSIGNED(*sp++);
-            PolyObject *src = (PolyObject*)((*sp).AsCodePtr() + srcOffset);
+            POLYUNSIGNED length = UNTAGGED_UNSIGNED(tos);
+            POLYUNSIGNED destOffset = UNTAGGED_UNSIGNED(*(++sp));
+            POLYUNSIGNED destIndex = UNTAGGED_UNSIGNED(*(++sp));
+            PolyObject *dest = (PolyObject*)((*(++sp)).AsCodePtr() + destOffset);
+            POLYUNSIGNED srcOffset = UNTAGGED_UNSIGNED(*(++sp));
+            POLYUNSIGNED srcIndex = UNTAGGED_UNSIGNED(*(++sp));
+            tos = *(++sp);
+            PolyObject *src = (PolyObject*)(tos.AsCodePtr() + srcOffset);
             for (POLYUNSIGNED u = 0; u < length; u++) dest->Set(destIndex+u, src->Get(srcIndex+u));
-            *sp = Zero;
-            break;
+            tos = Zero;
+            NEXT_INSTR;
         }
 
-        case INSTR_blockMoveByte:
+        CASE(INSTR_blockMoveByte):
         {
-            POLYUNSIGNED length = UNTAGGED_UNSIGNED(*sp++);
-            POLYUNSIGNED destOffset = UNTAGGED_UNSIGNED(*sp++);
-            POLYCODEPTR dest = (*sp++).AsCodePtr();
-            POLYUNSIGNED srcOffset = UNTAGGED_UNSIGNED(*sp++);
-            POLYCODEPTR src = (*sp).AsCodePtr();
+            POLYUNSIGNED length = UNTAGGED_UNSIGNED(tos);
+            POLYUNSIGNED destOffset = UNTAGGED_UNSIGNED(*(++sp));
+            POLYCODEPTR dest = (*(++sp)).AsCodePtr();
+            POLYUNSIGNED srcOffset = UNTAGGED_UNSIGNED(*(++sp));
+            tos = *(++sp);
+            POLYCODEPTR src = tos.AsCodePtr();
             memcpy(dest+destOffset, src+srcOffset, length);
-            *sp = Zero;
-            break;
+            tos = Zero;
+            NEXT_INSTR;
         }
 
-        case INSTR_blockEqualByte:
+        CASE(INSTR_blockEqualByte):
         {
-            POLYUNSIGNED length = UNTAGGED_UNSIGNED(*sp++);
-            POLYUNSIGNED arg2Offset = UNTAGGED_UNSIGNED(*sp++);
-            POLYCODEPTR arg2Ptr = (*sp++).AsCodePtr();
-            POLYUNSIGNED arg1Offset = UNTAGGED_UNSIGNED(*sp++);
-            POLYCODEPTR arg1Ptr = (*sp).AsCodePtr();
-            *sp = memcmp(arg1Ptr+arg1Offset, arg2Ptr+arg2Offset, length) == 0 ? True : False;
-            break;
+            POLYUNSIGNED length = UNTAGGED_UNSIGNED(tos);
+            POLYUNSIGNED arg2Offset = UNTAGGED_UNSIGNED(*(++sp));
+            POLYCODEPTR arg2Ptr = (*(++sp)).AsCodePtr();
+            POLYUNSIGNED arg1Offset = UNTAGGED_UNSIGNED(*(++sp));
+            tos = *(++sp);
+            POLYCODEPTR arg1Ptr = tos.AsCodePtr();
+            tos = memcmp(arg1Ptr+arg1Offset, arg2Ptr+arg2Offset, length) == 0 ? True : False;
+            NEXT_INSTR;
         }
 
-        case INSTR_blockCompareByte:
+        CASE(INSTR_blockCompareByte):
         {
-            POLYUNSIGNED length = UNTAGGED_UNSIGNED(*sp++);
-            POLYUNSIGNED arg2Offset = UNTAGGED_UNSIGNED(*sp++);
-            POLYCODEPTR arg2Ptr = (*sp++).AsCodePtr();
-            POLYUNSIGNED arg1Offset = UNTAGGED_UNSIGNED(*sp++);
-            POLYCODEPTR arg1Ptr = (*sp).AsCodePtr();
+            POLYUNSIGNED length = UNTAGGED_UNSIGNED(tos);
+            POLYUNSIGNED arg2Offset = UNTAGGED_UNSIGNED(*(++sp));
+            POLYCODEPTR arg2Ptr = (*(++sp)).AsCodePtr();
+            POLYUNSIGNED arg1Offset = UNTAGGED_UNSIGNED(*(++sp));
+            tos = *(++sp);
+            POLYCODEPTR arg1Ptr = tos.AsCodePtr();
             int result = memcmp(arg1Ptr+arg1Offset, arg2Ptr+arg2Offset, length);
-            *sp = result == 0 ? TAGGED(0) : result < 0 ? TAGGED(-1) : TAGGED(1);
-            break;
+            tos = result == 0 ? TAGGED(0) : result < 0 ? TAGGED(-1) : TAGGED(1);
+            NEXT_INSTR;
         }
 
-        default: Crash("Unknown instruction %x\n", pc[-1]);
+#ifdef USE_COMPUTED_GOTO
+        lbl_countInstruction:
+            CountInstruction(pc-1);
+            goto *dispatchTable[pc[-1]];
+#endif
+
+        DEFAULT_CASE: Crash("Unknown instruction %x\n", pc[-1]);
 
         } /* switch */
      } /* for */
      return 0;
 } /* MD_switch_to_poly */
 
+// Called on entry to the interpreter and after an RTS call that might have
+// turned instruction profiling on or off.  The count for the current
+// function is discarded when profiling is off so that it does not appear
+// in the next profile.
+bool IntTaskData::CheckInstructionProfile()
+{
+    if (profileMode == kProfileInstructions)
+        return true;
+    profileCount = 0;
+    return false;
+}
+
+// Count an instruction.  The count for each function is only added to its
+// profile count when execution moves to a different code object.  As with
+// the other profiles the counts are not locked and may lose updates if
+// several threads are running.
+void IntTaskData::CountInstruction(POLYCODEPTR pc)
+{
+    instructionCounts[*pc]++;
+    if (pc < profileStart || pc >= profileEnd)
+    {
+        if (profileCount != 0)
+            add_count(this, profileStart, profileCount);
+        profileCount = 0;
+        PolyObject *code = gMem.FindCodeObject(pc);
+        if (code == 0)
+            profileStart = profileEnd = 0;
+        else
+        {
+            profileStart = (POLYCODEPTR)code;
+            profileEnd = (POLYCODEPTR)((PolyWord*)code + code->Length());
+        }
+    }
+    profileCount++;
+}
+
 void IntTaskData::GarbageCollect(ScanAddress *process)
 {
     TaskData::GarbageCollect(process);
@@ -2182,6 +2736,12 @@ void IntTaskData::GarbageCollect(ScanAddress *process)
     overflowPacket = process->ScanObjectAddress(overflowPacket);
     dividePacket = process->ScanObjectAddress(dividePacket);
 
+#ifdef INTERPRETER_JIT
+    // A minor GC does not free any code.
+    if (mainThreadPhase != MTP_GCQUICK)
+        jit.Flush();
+#endif
+
     if (stack != 0)
     {
         StackSpace *stackSpace = stack;
@@ -2343,6 +2903,468 @@ bool IntTaskData::AddTimeProfileCount(SIGNALCONTEXT *context)
     return false;
 }
 
+#ifdef INTERPRETER_PROFILE_SEQUENCES
+class SequenceProfile: public RtsModule
+{
+public:
+    virtual void Stop(void);
+private:
+    void PrintCounts(const char *title, std::vector<std::pair<POLYUNSIGNED, unsigned> > &counts, unsigned opcodes);
+};
+
+// Declare this.  It will be automatically added to the table.
+static SequenceProfile sequenceProfileModule;
+
+void SequenceProfile::PrintCounts(const char *title, std::vector<std::pair<POLYUNSIGNED, unsigned> > &counts, unsigned opcodes)
+{
+    POLYUNSIGNED total = 0;
+    for (std::vector<std::pair<POLYUNSIGNED, unsigned> >::iterator i = counts.begin(); i != counts.end(); i++)
+        total += i->first;
+    if (total == 0) return;
+    size_t toPrint = counts.size() < 50 ? counts.size() : 50;
+    std::partial_sort(counts.begin(), counts.begin() + toPrint, counts.end(),
+        std::greater<std::pair<POLYUNSIGNED, unsigned> >());
+    fprintf(polyStderr, "%s: %" POLYUFMT " in total\n", title, total);
+    for (size_t j = 0; j < toPrint; j++)
+    {
+        unsigned seq = counts[j].second;
+        for (unsigned k = opcodes; k > 0; k--)
+            fprintf(polyStderr, "0x%02x ", (seq >> ((k-1)*8)) & 0xff);
+        fprintf(polyStderr, "%12" POLYUFMT " %5.2f%%\n", counts[j].first, (double)counts[j].first * 100.0 / (double)total);
+    }
+}
+
+// Print the most frequent sequences.  Opcode values are in int_opcodes.h.
+void SequenceProfile::Stop(void)
+{
+    std::vector<std::pair<POLYUNSIGNED, unsigned> > counts;
+    for (unsigned i = 0; i < 256*256; i++)
+        if (pairCounts[i] != 0) counts.push_back(std::pair<POLYUNSIGNED, unsigned>(pairCounts[i], i));
+    PrintCounts("Instruction pairs", counts, 2);
+    if (tripleCounts == 0) return;
+    counts.clear();
+    for (unsigned i = 0; i < 256*256*256; i++)
+        if (tripleCounts[i] != 0) counts.push_back(std::pair<POLYUNSIGNED, unsigned>(tripleCounts[i], i));
+    PrintCounts("Instruction triples", counts, 3);
+}
+#endif
+
+#ifdef INTERPRETER_JIT
+// Generate the X86-64 code for a function.  While the compiled code is running
+// rdi points to the JitState, rdx holds sp and rax holds tos.  rcx is a scratch
+// register.  All of these are caller-save and the code makes no calls.
+class JitCompiler {
+public:
+    JitCompiler(volatile bool *interrupt): interruptFlag(interrupt), instructions(0) {}
+
+    bool CompileFunction(POLYCODEPTR entry);
+    std::vector<byte> code;
+
+private:
+    POLYCODEPTR CompileInstruction(POLYCODEPTR pc);
+
+    void Emit(unsigned b1) { code.push_back((byte)b1); }
+    void Emit(unsigned b1, unsigned b2) { Emit(b1); Emit(b2); }
+    void Emit(unsigned b1, unsigned b2, unsigned b3) { Emit(b1, b2); Emit(b3); }
+    void Emit(unsigned b1, unsigned b2, unsigned b3, unsigned b4) { Emit(b1, b2); Emit(b3, b4); }
+    void Emit32(uint32_t v) { for (unsigned i = 0; i < 4; i++) Emit((v >> (i*8)) & 0xff); }
+    void Emit64(uint64_t v) { for (unsigned i = 0; i < 8; i++) Emit((v >> (i*8)) & 0xff); }
+    void Patch32(size_t offset, uint32_t v) { for (unsigned i = 0; i < 4; i++) code[offset+i] = (v >> (i*8)) & 0xff; }
+
+    // Templates used by several instructions.
+    void PushTos() { Emit(0x48, 0x89, 0x02); Emit(0x48, 0x83, 0xea, 0x08); } // mov [rdx],rax; sub rdx,8
+    void StoreTos() { Emit(0x48, 0x89, 0x02); } // mov [rdx],rax
+    void LoadTos(int32_t offset) { Emit(0x48, 0x8b, 0x82); Emit32(offset); } // mov rax,[rdx+offset]
+    void AddSp(int32_t offset) { Emit(0x48, 0x81, 0xc2); Emit32(offset); } // add rdx,offset
+    void LeaSp(int32_t offset) { Emit(0x48, 0x8d, 0x92); Emit32(offset); } // lea rdx,[rdx+offset]: Leaves the flags.
+    void Indirect(int32_t offset) { Emit(0x48, 0x8b, 0x80); Emit32(offset); } // mov rax,[rax+offset]
+    void LoadConst(PolyWord w) { Emit(0x48, 0xb8); Emit64(w.AsUnsigned()); } // mov rax,w
+    // Pop the top of the stack into rcx.  The new top goes into rax.
+    void PopToRcx() { Emit(0x48, 0x89, 0xc1); LoadTos(8); AddSp(8); } // mov rcx,rax
+    // Replace rax with True if condition code cc is set and False otherwise.
+    void SetBoolean(unsigned cc)
+    {
+        Emit(0x0f, 0x90+cc, 0xc1); // setcc cl
+        Emit(0x0f, 0xb6, 0xc1); // movzx eax,cl
+        Emit(0x48, 0x8d, 0x44, 0x00); Emit(0x01); // lea rax,[rax+rax+1]
+    }
+
+    // Jump to an instruction.  cc is the condition or CC_ALWAYS.
+    void Jump(unsigned cc, POLYCODEPTR target);
+    // Return to the interpreter, leaving the state as it was at the start of the instruction.
+    void ExitIf(unsigned cc, POLYCODEPTR pc);
+    void Exit(POLYCODEPTR pc);
+
+    volatile bool *interruptFlag;
+    unsigned instructions; // Number of instructions compiled.
+    std::map<POLYCODEPTR, size_t> labels; // Offsets in the code of each instruction.
+    std::vector<POLYCODEPTR> pending; // Jump targets still to compile.
+    std::vector<std::pair<size_t, POLYCODEPTR> > jumps, exits; // Offsets of jumps to fix up.
+};
+
+// The X86 condition codes.
+#define CC_O        0x0
+#define CC_B        0x2
+#define CC_AE       0x3
+#define CC_E        0x4
+#define CC_NE       0x5
+#define CC_BE       0x6
+#define CC_A        0x7
+#define CC_L        0xc
+#define CC_GE       0xd
+#define CC_LE       0xe
+#define CC_G        0xf
+#define CC_ALWAYS   0x10
+
+// Limits on the size of a function.  Larger functions are left to the interpreter.
+#define JIT_MAX_CODE    16384
+// A function whose compiled code is very short is not worth running.
+#define JIT_MIN_INSTRUCTIONS    4
+
+void JitCompiler::Jump(unsigned cc, POLYCODEPTR target)
+{
+    if (cc == CC_ALWAYS) Emit(0xe9); // jmp rel32
+    else Emit(0x0f, 0x80+cc); // jcc rel32
+    jumps.push_back(std::pair<size_t, POLYCODEPTR>(code.size(), target));
+    Emit32(0);
+    pending.push_back(target);
+}
+
+void JitCompiler::ExitIf(unsigned cc, POLYCODEPTR pc)
+{
+    Emit(0x0f, 0x80+cc); // jcc rel32
+    exits.push_back(std::pair<size_t, POLYCODEPTR>(code.size(), pc));
+    Emit32(0);
+}
+
+void JitCompiler::Exit(POLYCODEPTR pc)
+{
+    Emit(0x48, 0x89, 0x17); // mov [rdi],rdx
+    Emit(0x48, 0x89, 0x47, 0x08); // mov [rdi+8],rax
+    Emit(0x48, 0xb8); Emit64((uintptr_t)pc); // mov rax,pc
+    Emit(0xc3); // ret
+}
+
+// Compile one instruction.  Returns the address of the next instruction to
+// compile or zero if this is the end of the sequence.
+POLYCODEPTR JitCompiler::CompileInstruction(POLYCODEPTR pc)
+{
+    unsigned n;
+    switch (pc[0])
+    {
+    case INSTR_stackSize8:
+    case INSTR_stackSize16:
+        // Return to the interpreter if the stack has to be grown or there is an interrupt.
+        n = pc[0] == INSTR_stackSize8 ? pc[1] : pc[1] + pc[2]*256;
+        Emit(0x48, 0x8d, 0x8a); Emit32(-(int32_t)(n*sizeof(PolyWord))); // lea rcx,[rdx-n*8]
+        Emit(0x48, 0x3b, 0x4f, 0x10); // cmp rcx,[rdi+16]
+        ExitIf(CC_B, pc);
+        Emit(0x48, 0xb9); Emit64((uintptr_t)interruptFlag); // mov rcx,interruptFlag
+        Emit(0x80, 0x39, 0x00); // cmp byte [rcx],0
+        ExitIf(CC_NE, pc);
+        return pc + (pc[0] == INSTR_stackSize8 ? 2 : 3);
+
+    case INSTR_pad:
+        return pc + 1;
+
+    case INSTR_local_0:
+        PushTos();
+        return pc + 1;
+
+    case INSTR_local_1: case INSTR_local_2: case INSTR_local_3: case INSTR_local_4:
+    case INSTR_local_5: case INSTR_local_6: case INSTR_local_7: case INSTR_local_8:
+    case INSTR_local_9: case INSTR_local_10: case INSTR_local_11:
+        StoreTos();
+        LoadTos((pc[0] - INSTR_local_0) * sizeof(PolyWord));
+        AddSp(-(int32_t)sizeof(PolyWord));
+        return pc + 1;
+
+    case INSTR_local_b:
+    case INSTR_local_w:
+        n = pc[0] == INSTR_local_b ? pc[1] : pc[1] + pc[2]*256;
+        StoreTos();
+        LoadTos(n * sizeof(PolyWord));
+        AddSp(-(int32_t)sizeof(PolyWord));
+        return pc + (pc[0] == INSTR_local_b ? 2 : 3);
+
+    case INSTR_localLocal:
+        StoreTos();
+        Emit(0x48, 0x8b, 0x8a); Emit32(pc[1] * sizeof(PolyWord)); // mov rcx,[rdx+n*8]
+        Emit(0x48, 0x89, 0x4a, 0xf8); // mov [rdx-8],rcx
+        AddSp(-(int32_t)sizeof(PolyWord));
+        LoadTos(pc[2] * sizeof(PolyWord));
+        AddSp(-(int32_t)sizeof(PolyWord));
+        return pc + 3;
+
+    case INSTR_localIndirect:
+        StoreTos();
+        LoadTos(pc[1] * sizeof(PolyWord));
+        Indirect(pc[2] * sizeof(PolyWord));
+        AddSp(-(int32_t)sizeof(PolyWord));
+        return pc + 3;
+
+    case INSTR_indirect_0: case INSTR_indirect_1: case INSTR_indirect_2:
+    case INSTR_indirect_3: case INSTR_indirect_4: case INSTR_indirect_5:
+        Indirect((pc[0] - INSTR_indirect_0) * sizeof(PolyWord));
+        return pc + 1;
+
+    case INSTR_indirect_b:
+        Indirect(pc[1] * sizeof(PolyWord));
+        return pc + 2;
+
+    case INSTR_indirect_w:
+        Indirect((pc[1] + pc[2]*256) * sizeof(PolyWord));
+        return pc + 3;
+
+    case INSTR_const_0: PushTos(); LoadConst(Zero); return pc + 1;
+    case INSTR_const_1: PushTos(); LoadConst(TAGGED(1)); return pc + 1;
+    case INSTR_const_2: PushTos(); LoadConst(TAGGED(2)); return pc + 1;
+    case INSTR_const_3: PushTos(); LoadConst(TAGGED(3)); return pc + 1;
+    case INSTR_const_4: PushTos(); LoadConst(TAGGED(4)); return pc + 1;
+    case INSTR_const_10: PushTos(); LoadConst(TAGGED(10)); return pc + 1;
+    case INSTR_const_int_b: PushTos(); LoadConst(TAGGED(pc[1])); return pc + 2;
+    case INSTR_const_int_w: PushTos(); LoadConst(TAGGED(pc[1] + pc[2]*256)); return pc + 3;
+
+    case INSTR_constAddr8:
+    case INSTR_constAddr16:
+    {
+        // The constant may be moved by the GC so it is loaded each time from the code.
+        POLYCODEPTR addr =
+            pc[0] == INSTR_constAddr8 ? pc + pc[1] + 2 : pc + pc[1] + pc[2]*256 + 3;
+        PushTos();
+        Emit(0x48, 0xb9); Emit64((uintptr_t)addr); // mov rcx,addr
+        Emit(0x48, 0x8b, 0x01); // mov rax,[rcx]
+        return pc + (pc[0] == INSTR_constAddr8 ? 2 : 3);
+    }
+
+    case INSTR_reset_1: case INSTR_reset_2: case INSTR_reset_b: case INSTR_reset_w:
+        n = pc[0] == INSTR_reset_1 ? 1 : pc[0] == INSTR_reset_2 ? 2 :
+            pc[0] == INSTR_reset_b ? pc[1] : pc[1] + pc[2]*256;
+        AddSp(n * sizeof(PolyWord));
+        LoadTos(0);
+        return pc + (pc[0] == INSTR_reset_b ? 2 : pc[0] == INSTR_reset_w ? 3 : 1);
+
+    case INSTR_reset_r_1: case INSTR_reset_r_2: case INSTR_reset_r_3:
+        AddSp((pc[0] - INSTR_reset_r_1 + 1) * sizeof(PolyWord));
+        return pc + 1;
+
+    case INSTR_reset_r_b:
+        AddSp(pc[1] * sizeof(PolyWord));
+        return pc + 2;
+
+    case INSTR_reset_r_w:
+        AddSp((pc[1] + pc[2]*256) * sizeof(PolyWord));
+        return pc + 3;
+
+    case INSTR_set_stack_val_b:
+    case INSTR_set_stack_val_w:
+        n = pc[0] == INSTR_set_stack_val_b ? pc[1] : pc[1] + pc[2]*256;
+        AddSp(sizeof(PolyWord));
+        Emit(0x48, 0x89, 0x82); Emit32((n-1) * sizeof(PolyWord)); // mov [rdx+(n-1)*8],rax
+        LoadTos(0);
+        return pc + (pc[0] == INSTR_set_stack_val_b ? 2 : 3);
+
+    case INSTR_move_to_vec_0: case INSTR_move_to_vec_1: case INSTR_move_to_vec_2:
+    case INSTR_move_to_vec_3: case INSTR_move_to_vec_4: case INSTR_move_to_vec_5:
+    case INSTR_move_to_vec_6: case INSTR_move_to_vec_7:
+        PopToRcx();
+        Emit(0x48, 0x89, 0x88); Emit32((pc[0] - INSTR_move_to_vec_0) * sizeof(PolyWord)); // mov [rax+n*8],rcx
+        return pc + 1;
+
+    case INSTR_isTagged:
+        Emit(0x48, 0x83, 0xe0, 0x01); // and rax,1
+        Emit(0x48, 0x8d, 0x44, 0x00); Emit(0x01); // lea rax,[rax+rax+1]
+        return pc + 1;
+
+    case INSTR_notBoolean:
+        Emit(0x48, 0x83, 0xf0, 0x02); // xor rax,2: Exchanges TAGGED(0) and TAGGED(1)
+        return pc + 1;
+
+    case INSTR_equalWord: case INSTR_lessSigned: case INSTR_lessUnsigned:
+    case INSTR_lessEqSigned: case INSTR_lessEqUnsigned: case INSTR_greaterSigned:
+    case INSTR_greaterUnsigned: case INSTR_greaterEqSigned: case INSTR_greaterEqUnsigned:
+    {
+        unsigned cc;
+        switch (pc[0])
+        {
+        case INSTR_equalWord: cc = CC_E; break;
+        case INSTR_lessSigned: cc = CC_L; break;
+        case INSTR_lessUnsigned: cc = CC_B; break;
+        case INSTR_lessEqSigned: cc = CC_LE; break;
+        case INSTR_lessEqUnsigned: cc = CC_BE; break;
+        case INSTR_greaterSigned: cc = CC_G; break;
+        case INSTR_greaterUnsigned: cc = CC_A; break;
+        case INSTR_greaterEqSigned: cc = CC_GE; break;
+        default: cc = CC_AE; break;
+        }
+        PopToRcx();
+        Emit(0x48, 0x39, 0xc8); // cmp rax,rcx
+        SetBoolean(cc);
+        return pc + 1;
+    }
+
+    case INSTR_wordAdd:
+        PopToRcx();
+        Emit(0x48, 0x8d, 0x44, 0x08); Emit(0xff); // lea rax,[rax+rcx-1]
+        return pc + 1;
+
+    case INSTR_wordSub:
+        PopToRcx();
+        Emit(0x48, 0x29, 0xc8); // sub rax,rcx
+        Emit(0x48, 0x83, 0xc0, 0x01); // add rax,1
+        return pc + 1;
+
+    case INSTR_wordAnd:
+        PopToRcx();
+        Emit(0x48, 0x21, 0xc8); // and rax,rcx
+        return pc + 1;
+
+    case INSTR_wordOr:
+        PopToRcx();
+        Emit(0x48, 0x09, 0xc8); // or rax,rcx
+        return pc + 1;
+
+    case INSTR_wordXor:
+        PopToRcx();
+        Emit(0x48, 0x31, 0xc8); // xor rax,rcx
+        Emit(0x48, 0x83, 0xc8, 0x01); // or rax,1
+        return pc + 1;
+
+    case INSTR_fixedAdd:
+        // The interpreter raises Overflow if the result does not fit.
+        Emit(0x48, 0x8b, 0x4a, 0x08); // mov rcx,[rdx+8]
+        Emit(0x48, 0x83, 0xe9, 0x01); // sub rcx,1
+        Emit(0x48, 0x01, 0xc1); // add rcx,rax
+        ExitIf(CC_O, pc);
+        Emit(0x48, 0x89, 0xc8); // mov rax,rcx
+        AddSp(sizeof(PolyWord));
+        return pc + 1;
+
+    case INSTR_fixedSub:
+        Emit(0x48, 0x8b, 0x4a, 0x08); // mov rcx,[rdx+8]
+        Emit(0x48, 0x29, 0xc1); // sub rcx,rax
+        ExitIf(CC_O, pc);
+        Emit(0x48, 0x83, 0xc1, 0x01); // add rcx,1
+        Emit(0x48, 0x89, 0xc8); // mov rax,rcx
+        AddSp(sizeof(PolyWord));
+        return pc + 1;
+
+    case INSTR_jump8:
+        return pc + pc[1] + 2;
+
+    case INSTR_jump16:
+        return pc + pc[1] + pc[2]*256 + 3;
+
+    case INSTR_jump8false:
+    case INSTR_jump16false:
+        Emit(0x48, 0x89, 0xc1); // mov rcx,rax
+        LoadTos(8);
+        LeaSp(8);
+        Emit(0x48, 0x83, 0xf9, (unsigned)True.AsUnsigned()); // cmp rcx,True
+        if (pc[0] == INSTR_jump8false)
+        {
+            Jump(CC_NE, pc + pc[1] + 2);
+            return pc + 2;
+        }
+        Jump(CC_NE, pc + pc[1] + pc[2]*256 + 3);
+        return pc + 3;
+
+    case INSTR_jump8NEq:
+        Emit(0x48, 0x8b, 0x4a, 0x08); // mov rcx,[rdx+8]
+        Emit(0x48, 0x39, 0xc1); // cmp rcx,rax
+        LoadTos(16);
+        LeaSp(16);
+        Jump(CC_NE, pc + pc[1] + 2);
+        return pc + 2;
+
+    case INSTR_jump8NEqConst:
+        Emit(0x48, 0x3d); Emit32((uint32_t)TAGGED(pc[1]).AsUnsigned()); // cmp rax,TAGGED(n)
+        LoadTos(8);
+        LeaSp(8);
+        Jump(CC_NE, pc + pc[2] + 3);
+        return pc + 3;
+
+    case INSTR_jump8True:
+        Emit(0x48, 0x83, 0xf8, (unsigned)True.AsUnsigned()); // cmp rax,True
+        LoadTos(8);
+        LeaSp(8);
+        Jump(CC_E, pc + pc[1] + 2);
+        return pc + 2;
+
+    case INSTR_jump8Tagged:
+        Emit(0xa8, 0x01); // test al,1
+        LoadTos(8);
+        LeaSp(8);
+        Jump(CC_NE, pc + pc[1] + 2);
+        return pc + 2;
+
+    default:
+        // Everything else is interpreted.
+        Exit(pc);
+        return 0;
+    }
+}
+
+bool JitCompiler::CompileFunction(POLYCODEPTR entry)
+{
+    Emit(0x48, 0x8b, 0x17); // mov rdx,[rdi]
+    Emit(0x48, 0x8b, 0x47, 0x08); // mov rax,[rdi+8]
+    pending.push_back(entry);
+    while (! pending.empty())
+    {
+        POLYCODEPTR pc = pending.back();
+        pending.pop_back();
+        if (labels.find(pc) != labels.end()) continue;
+        // Compile a sequence until it reaches an instruction that is not
+        // compiled or one that has already been compiled.
+        while (pc != 0)
+        {
+            if (code.size() > JIT_MAX_CODE) return false;
+            if (labels.find(pc) != labels.end())
+            {
+                Jump(CC_ALWAYS, pc);
+                break;
+            }
+            labels[pc] = code.size();
+            pc = CompileInstruction(pc);
+            if (pc != 0) instructions++;
+        }
+    }
+    if (instructions < JIT_MIN_INSTRUCTIONS) return false;
+
+    // All the jump targets have now been compiled.  Jumps are relative to the end of the jump.
+    for (std::vector<std::pair<size_t, POLYCODEPTR> >::iterator i = jumps.begin(); i != jumps.end(); i++)
+        Patch32(i->first, (uint32_t)(labels[i->second] - (i->first + 4)));
+    // Add the exits for failed checks at the end.
+    std::map<POLYCODEPTR, size_t> exitLabels;
+    for (std::vector<std::pair<size_t, POLYCODEPTR> >::iterator i = exits.begin(); i != exits.end(); i++)
+    {
+        if (exitLabels.find(i->second) == exitLabels.end())
+        {
+            exitLabels[i->second] = code.size();
+            Exit(i->second);
+        }
+        Patch32(i->first, (uint32_t)(exitLabels[i->second] - (i->first + 4)));
+    }
+    return true;
+}
+
+JitCode InterpreterJit::Compile(POLYCODEPTR entry)
+{
+    JitCompiler compiler(interruptFlag);
+    if (! compiler.CompileFunction(entry)) return 0;
+    // Put the code into a code cell.  The last word is the number of constants
+    // which is zero so the GC does not look at the code.
+    POLYUNSIGNED codeWords = (compiler.code.size() + sizeof(PolyWord) - 1) / sizeof(PolyWord);
+    PolyObject *cell = gMem.AllocCodeSpace(codeWords + 1);
+    if (cell == 0) return 0;
+    memcpy(cell, &compiler.code[0], compiler.code.size());
+    cell->Set(codeWords, PolyWord::FromUnsigned(0));
+    cell->SetLengthWord(codeWords + 1, F_CODE_OBJ);
+    machineDependent->FlushInstructionCache(cell, (codeWords + 1) * sizeof(PolyWord));
+    return (JitCode)cell;
+}
+#endif
 
 static Interpreter interpreterObject;
 
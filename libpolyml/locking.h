@@ -120,4 +120,15 @@ private:
 #endif
 };
 
+// Full memory barrier.  Used where threads communicate through shared
+// variables without holding a lock.
+inline void PMemoryBarrier(void)
+{
+#ifdef _MSC_VER
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+}
+
 #endif
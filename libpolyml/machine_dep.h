@@ -28,6 +28,7 @@ class TaskData;
 class SaveVecEntry;
 typedef SaveVecEntry *Handle;
 class StackSpace;
+class FiberState;
 
 // Machine architecture values.
 typedef enum {
@@ -54,6 +55,8 @@ public:
         { ScanConstantsWithinCode(addr, addr, addr->Length(), process); } // Common case
 
     virtual void FlushInstructionCache(void *p, POLYUNSIGNED bytes) {}
+    // Scan the stack of a fiber that is not currently running.
+    virtual void ScanFiberStack(ScanAddress *process, FiberState *fiber) = 0;
     virtual Architectures MachineArchitecture(void) = 0; 
 };
 
@@ -100,12 +100,21 @@
 #include <sys/select.h>
 #endif
 
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
 #ifndef HAVE_SOCKLEN_T
 typedef int socklen_t;
 #endif
 
 #if (defined(_WIN32) && ! defined(__CYGWIN__))
 #include <winsock2.h>
+#include <ws2tcpip.h>
 #else
 typedef int SOCKET;
 #endif
@@ -120,6 +129,17 @@ typedef int SOCKET;
 #endif
 
 #include <new>
+#include <vector>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+
+#if ((!defined(_WIN32) || defined(__CYGWIN__)) && defined(HAVE_LIBPTHREAD) && defined(HAVE_PTHREAD_H))
+#define HAVE_PTHREAD 1
+#include <pthread.h>
+#include <signal.h>
+#endif
 
 #include "globals.h"
 #include "gc.h"
@@ -137,6 +157,7 @@ typedef int SOCKET;
 #include "errors.h"
 #include "rtsentry.h"
 #include "timing.h"
+#include "locking.h"
 
 extern "C" {
     POLYEXTERNALSYMBOL POLYUNSIGNED PolyNetworkGeneral(PolyObject *threadId, PolyWord code, PolyWord arg);
@@ -342,6 +363,86 @@ static Handle selectCall(TaskData *taskData, Handle args, int blockType);
 #endif
 
 
+#ifdef USE_EPOLL_REACTOR
+// Linux: Build a poll vector and wait using the IO reactor.  This provides the
+// same interface as the version using select below but is not limited to
+// descriptors less than FD_SETSIZE.
+class WaitSelect: public Waiter
+{
+public:
+    WaitSelect(unsigned maxMillisecs=(unsigned)-1):
+        selectResult(0), errorResult(0), maxTime(maxMillisecs) {}
+    virtual void Wait(unsigned maxMillisecs);
+    void SetRead(SOCKET fd) { AddEvents(fd, POLLIN); }
+    void SetWrite(SOCKET fd) { AddEvents(fd, POLLOUT); }
+    void SetExcept(SOCKET fd) { AddEvents(fd, POLLPRI); }
+    // As with select an error or hang-up is reported as readable and writable.
+    bool IsSetRead(SOCKET fd) { return TestEvents(fd, POLLIN|POLLERR|POLLHUP); }
+    bool IsSetWrite(SOCKET fd) { return TestEvents(fd, POLLOUT|POLLERR|POLLHUP); }
+    bool IsSetExcept(SOCKET fd) { return TestEvents(fd, POLLPRI); }
+    // Save the result of the select call and any associated error
+    int SelectResult(void) { return selectResult; }
+    int SelectError(void) { return errorResult; }
+private:
+    void AddEvents(SOCKET fd, short events);
+    bool TestEvents(SOCKET fd, short events);
+    // A descriptor may appear more than once.  After the wait pollVec is
+    // sorted by descriptor so that the results can be found quickly.
+    std::vector<struct pollfd> pollVec;
+    int selectResult;
+    int errorResult;
+    unsigned maxTime;
+};
+
+static bool comparePollFd(const struct pollfd &a, const struct pollfd &b)
+{
+    return a.fd < b.fd;
+}
+
+void WaitSelect::AddEvents(SOCKET fd, short events)
+{
+    struct pollfd entry;
+    entry.fd = fd;
+    entry.events = events;
+    entry.revents = 0;
+    pollVec.push_back(entry);
+}
+
+bool WaitSelect::TestEvents(SOCKET fd, short events)
+{
+    struct pollfd key;
+    key.fd = fd;
+    std::vector<struct pollfd>::iterator i =
+        std::lower_bound(pollVec.begin(), pollVec.end(), key, comparePollFd);
+    for (; i != pollVec.end() && i->fd == fd; ++i)
+    {
+        if (i->revents & events) return true;
+    }
+    return false;
+}
+
+// The reactor wakes this thread if it is interrupted so we can wait for the
+// full time rather than the time given by ThreadPauseForIO.
+void WaitSelect::Wait(unsigned /*maxMillisecs*/)
+{
+    selectResult = processes->ReactorPoll(pollVec.size() == 0 ? 0 : &pollVec[0], (unsigned)pollVec.size(), maxTime);
+    if (selectResult < 0) errorResult = GETERROR;
+    else
+    {
+        // select fails with EBADF if any descriptor is invalid.
+        for (size_t i = 0; i < pollVec.size(); i++)
+        {
+            if (pollVec[i].revents & POLLNVAL)
+            {
+                selectResult = -1;
+                errorResult = EBADF;
+            }
+        }
+    }
+    std::sort(pollVec.begin(), pollVec.end(), comparePollFd);
+}
+
+#else
 // Wait until "select" returns.  In Windows this is used only for networking.
 class WaitSelect: public Waiter
 {
@@ -383,6 +484,7 @@ void WaitSelect::Wait(unsigned maxMillisecs)
     selectResult = select(FD_SETSIZE, &readSet, &writeSet, &exceptSet, &toWait);
     if (selectResult < 0) errorResult = GETERROR;
 }
+#endif
 
 class WaitNet: public WaitSelect {
 public:
@@ -486,6 +588,329 @@ static Handle wrapStreamSocket(TaskData *taskData, SOCKET skt)
 }
 #endif
 
+#if (!(defined(_WIN32) && ! defined(__CYGWIN__)))
+// Send part of a file to a socket without copying it through the ML heap.
+// On Linux sendfile copies directly from the page cache.  If that isn't
+// available or the file can't be used with it we read through a buffer
+// on the C stack.  Returns the number sent or -1 with the error in errno.
+static ssize_t sendFileToSocket(SOCKET sock, int fd, off_t offset, size_t length)
+{
+#ifdef __linux__
+    ssize_t sent = sendfile(sock, fd, &offset, length);
+    if (sent >= 0 || (errno != EINVAL && errno != ENOSYS))
+        return sent;
+#endif
+    char buffer[16384];
+    if (length > sizeof(buffer)) length = sizeof(buffer);
+    ssize_t haveRead = pread(fd, buffer, length, offset);
+    if (haveRead <= 0) return haveRead;
+    // If the socket is full we have to read the data again next time.
+    return send(sock, buffer, haveRead, 0);
+}
+#endif
+
+// The maximum number of datagrams sent or received in a single call.
+#define MAX_DATAGRAM_BATCH  256
+
+// A buffer for a datagram and, when sending, the destination address.
+struct DatagramBuffer {
+    char *base;
+    size_t length;
+    struct sockaddr_storage addr;
+    socklen_t addrLen;
+};
+
+// Receive as many datagrams as are available, up to n, in a single system call
+// if possible.  Returns the number received, with the lengths and sender's
+// addresses set in the buffers, or SOCKET_ERROR if nothing could be received.
+// If some datagrams have been received a subsequent error is ignored; it will
+// be reported again on the next call.
+static int recvDatagrams(SOCKET sock, DatagramBuffer *bufs, int n)
+{
+#if (defined(__linux__) && defined(MSG_WAITFORONE))
+    struct mmsghdr msgs[MAX_DATAGRAM_BATCH];
+    struct iovec iovs[MAX_DATAGRAM_BATCH];
+    memset(msgs, 0, n * sizeof(struct mmsghdr));
+    for (int i = 0; i < n; i++)
+    {
+        iovs[i].iov_base = bufs[i].base;
+        iovs[i].iov_len = bufs[i].length;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &bufs[i].addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(bufs[i].addr);
+    }
+    int recvd = recvmmsg(sock, msgs, n, 0, NULL);
+    if (recvd >= 0)
+    {
+        for (int i = 0; i < recvd; i++)
+        {
+            bufs[i].length = msgs[i].msg_len;
+            bufs[i].addrLen = msgs[i].msg_hdr.msg_namelen;
+        }
+        return recvd;
+    }
+    if (errno != ENOSYS) return SOCKET_ERROR;
+#endif
+    // Otherwise receive them one at a time.
+    for (int i = 0; i < n; i++)
+    {
+        bufs[i].addrLen = sizeof(bufs[i].addr);
+        int recvd = (int)recvfrom(sock, bufs[i].base, (int)bufs[i].length, 0,
+                            (struct sockaddr *)&bufs[i].addr, &bufs[i].addrLen);
+        if (recvd == SOCKET_ERROR) return i == 0 ? SOCKET_ERROR : i;
+        if ((size_t)recvd < bufs[i].length) bufs[i].length = recvd;
+    }
+    return n;
+}
+
+// Send up to n datagrams.  Returns the number sent or SOCKET_ERROR if none
+// could be sent.
+static int sendDatagrams(SOCKET sock, DatagramBuffer *bufs, int n)
+{
+#if (defined(__linux__) && defined(MSG_WAITFORONE))
+    struct mmsghdr msgs[MAX_DATAGRAM_BATCH];
+    struct iovec iovs[MAX_DATAGRAM_BATCH];
+    memset(msgs, 0, n * sizeof(struct mmsghdr));
+    for (int i = 0; i < n; i++)
+    {
+        iovs[i].iov_base = bufs[i].base;
+        iovs[i].iov_len = bufs[i].length;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &bufs[i].addr;
+        msgs[i].msg_hdr.msg_namelen = bufs[i].addrLen;
+    }
+    int sent = sendmmsg(sock, msgs, n, 0);
+    if (sent >= 0 || errno != ENOSYS) return sent;
+#endif
+    for (int i = 0; i < n; i++)
+    {
+        if (sendto(sock, bufs[i].base, (int)bufs[i].length, 0,
+                (struct sockaddr *)&bufs[i].addr, bufs[i].addrLen) == SOCKET_ERROR)
+            return i == 0 ? SOCKET_ERROR : i;
+    }
+    return n;
+}
+
+// Host name resolution with getaddrinfo.  A lookup may have to wait for a
+// DNS server so it is run on a small pool of threads and the ML thread waits
+// in ThreadPauseForIO, leaving the GC and other ML threads free to run.  The
+// results, including "not found", are cached for resolverCacheSecs.  A request
+// for a name that is already being looked up waits for the same result.
+
+// Maximum number of resolver threads.
+#define RESOLVER_THREADS        4
+// The cache is purged of unused entries when it reaches this size.
+#define RESOLVER_CACHE_SIZE     1024
+
+class ResolverWaiter;
+
+class ResolverEntry
+{
+public:
+    ResolverEntry(const std::string &n): name(n), pending(false), error(0), expires(0), users(0) {}
+    std::string name;
+    bool pending;           // A lookup is queued or in progress.
+    int error;              // Error from getaddrinfo or zero.
+    // The IPv4 and IPv6 addresses as 4 or 16 bytes in network order.
+    std::vector<std::string> addresses;
+    time_t expires;         // Time when the result should be looked up again.
+    unsigned users;         // Number of ML threads waiting for this entry.
+    std::vector<ResolverWaiter*> waiters;
+};
+
+static PLock resolverLock("Resolver");
+static std::map<std::string, ResolverEntry*> resolverCache;
+static time_t resolverCacheSecs = 30;
+
+// The time in seconds used for expiry.  Use a monotonic clock if possible.
+static time_t resolverNow(void)
+{
+#if (defined(_WIN32) && ! defined(__CYGWIN__))
+    return (time_t)(GetTickCount64() / 1000);
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return ts.tv_sec;
+    return time(NULL);
+#else
+    return time(NULL);
+#endif
+}
+
+// The ML thread waits on its own condition variable since the Windows
+// version of PCondVar does not allow more than one waiting thread.
+class ResolverWaiter: public Waiter
+{
+public:
+    ResolverWaiter(ResolverEntry *e): entry(e) {}
+    virtual void Wait(unsigned maxMillisecs);
+    PCondVar wakeUp;
+private:
+    ResolverEntry *entry;
+};
+
+void ResolverWaiter::Wait(unsigned maxMillisecs)
+{
+    PLocker lock(&resolverLock);
+    if (! entry->pending) return;
+    entry->waiters.push_back(this);
+    wakeUp.WaitFor(&resolverLock, maxMillisecs);
+    entry->waiters.erase(std::find(entry->waiters.begin(), entry->waiters.end(), this));
+}
+
+// Run getaddrinfo and record the result.  Called without the lock.
+static void resolveEntry(ResolverEntry *entry)
+{
+    struct addrinfo hints, *res = 0;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    // Ask for one socket type to avoid each address being returned for
+    // stream, datagram and raw sockets.
+    hints.ai_socktype = SOCK_STREAM;
+    int err = getaddrinfo(entry->name.c_str(), NULL, &hints, &res);
+    std::vector<std::string> addresses;
+    if (err == 0)
+    {
+        for (struct addrinfo *ai = res; ai != 0; ai = ai->ai_next)
+        {
+            std::string addr;
+            if (ai->ai_family == AF_INET)
+                addr.assign((char*)&((struct sockaddr_in *)ai->ai_addr)->sin_addr, 4);
+#ifdef AF_INET6
+            else if (ai->ai_family == AF_INET6)
+                addr.assign((char*)&((struct sockaddr_in6 *)ai->ai_addr)->sin6_addr, 16);
+#endif
+            else continue;
+            if (std::find(addresses.begin(), addresses.end(), addr) == addresses.end())
+                addresses.push_back(addr);
+        }
+        freeaddrinfo(res);
+    }
+#ifdef EAI_NODATA
+    if (err == EAI_NODATA) err = 0; // The name exists but has no addresses.
+#endif
+    if (err == EAI_NONAME) err = 0; // Not found: return an empty list.
+
+    PLocker lock(&resolverLock);
+    entry->addresses = addresses;
+    entry->error = err;
+    entry->pending = false;
+    // Don't cache temporary failures.
+    entry->expires = err == 0 ? resolverNow() + resolverCacheSecs : 0;
+    for (std::vector<ResolverWaiter*>::iterator i = entry->waiters.begin(); i != entry->waiters.end(); i++)
+        (*i)->wakeUp.Signal();
+}
+
+#ifdef HAVE_PTHREAD
+static std::deque<ResolverEntry*> resolverQueue;
+// This is allocated when the first thread is started and never deleted.
+// Destroying a condition variable at exit would block while the idle
+// threads are waiting on it.
+static PCondVar *resolverWork;
+static unsigned resolverThreads, resolverIdle;
+
+static void *resolverThread(void *)
+{
+    resolverLock.Lock();
+    while (true)
+    {
+        while (resolverQueue.empty())
+        {
+            resolverIdle++;
+            resolverWork->Wait(&resolverLock);
+            resolverIdle--;
+        }
+        ResolverEntry *entry = resolverQueue.front();
+        resolverQueue.pop_front();
+        resolverLock.Unlock();
+        resolveEntry(entry);
+        resolverLock.Lock();
+    }
+    return 0;
+}
+#endif
+
+// Remove entries that are not in use.  Expired entries are removed first.
+static void purgeResolverCache(bool all)
+{
+    time_t now = resolverNow();
+    for (std::map<std::string, ResolverEntry*>::iterator i = resolverCache.begin(); i != resolverCache.end(); )
+    {
+        ResolverEntry *entry = i->second;
+        if (entry->pending || entry->users != 0)
+            i++;
+        else if (all || now >= entry->expires)
+        {
+            delete(entry);
+            resolverCache.erase(i++);
+        }
+        else i++;
+    }
+}
+
+// Find or create the cache entry and start a lookup if there is no current
+// result.  The entry is marked as in use until releaseResolverEntry is called.
+static ResolverEntry *startResolverLookup(const char *name)
+{
+    PLocker lock(&resolverLock);
+    ResolverEntry *entry;
+    std::map<std::string, ResolverEntry*>::iterator i = resolverCache.find(name);
+    if (i != resolverCache.end())
+        entry = i->second;
+    else
+    {
+        if (resolverCache.size() >= RESOLVER_CACHE_SIZE)
+        {
+            purgeResolverCache(false);
+            if (resolverCache.size() >= RESOLVER_CACHE_SIZE)
+                purgeResolverCache(true);
+        }
+        entry = new ResolverEntry(name);
+        resolverCache[name] = entry;
+    }
+    entry->users++;
+    if (entry->pending || resolverNow() < entry->expires)
+        return entry;
+    entry->pending = true;
+#ifdef HAVE_PTHREAD
+    resolverQueue.push_back(entry);
+    if (resolverWork == 0) resolverWork = new PCondVar;
+    if (resolverQueue.size() > resolverIdle && resolverThreads < RESOLVER_THREADS)
+    {
+        // Block signals in the thread.  They are handled by the ML threads.
+        sigset_t allSigs, oldSigs;
+        sigfillset(&allSigs);
+        pthread_sigmask(SIG_SETMASK, &allSigs, &oldSigs);
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, resolverThread, 0) == 0)
+        {
+            pthread_detach(thread);
+            resolverThreads++;
+        }
+        pthread_sigmask(SIG_SETMASK, &oldSigs, NULL);
+    }
+    if (resolverThreads != 0)
+    {
+        resolverWork->Signal();
+        return entry;
+    }
+    resolverQueue.pop_back();
+#endif
+    // No threads: look it up in this thread.
+    resolverLock.Unlock();
+    resolveEntry(entry);
+    resolverLock.Lock();
+    return entry;
+}
+
+static void releaseResolverEntry(ResolverEntry *entry)
+{
+    PLocker lock(&resolverLock);
+    entry->users--;
+}
+
 static Handle Net_dispatch_c(TaskData *taskData, Handle args, Handle code)
 {
     unsigned c = get_C_unsigned(taskData, code->Word());
@@ -776,6 +1201,18 @@ TryAgain: // Used for various retries.
                 }
             }
 
+#if (!(defined(_WIN32) && ! defined(__CYGWIN__)))
+            {
+                // On Windows the new socket inherits non-blocking mode from the
+                // listening socket but on Unix it may not.
+                int onOff = 1;
+                if (ioctl(result, FIONBIO, &onOff) < 0)
+                {
+                    close(result);
+                    raise_syscall(taskData, "ioctl failed", GETERROR);
+                }
+            }
+#endif
             addrHandle = SAVE(C_string_to_Poly(taskData, (char*)&resultAddr, addrLen));
             // Return a pair of the new socket and the address.
             Handle resSkt = wrapStreamSocket(taskData, result);
@@ -1179,6 +1616,216 @@ TryAgain: // Used for various retries.
     case 66: /* Select call with non-zero timeout. */
         return selectCall(taskData, args, 0);
 
+    case 67: /* Send part of a file on a socket. */
+        // We should check for interrupts even if we're not going to block.
+        processes->TestAnyEvents(taskData);
+    case 68: /* Non-blocking send of part of a file. */
+#if (defined(_WIN32) && ! defined(__CYGWIN__))
+        /* Not implemented. */
+        raise_syscall(taskData, "sendFile not implemented", WSAEOPNOTSUPP);
+#else
+        {
+            SOCKET sock = getStreamSocket(taskData, DEREFHANDLE(args)->Get(0));
+            int fd = getStreamFileDescriptor(taskData, DEREFHANDLE(args)->Get(1));
+            off_t offset = (off_t)get_C_long(taskData, DEREFHANDLE(args)->Get(2));
+            size_t length = getPolyUnsigned(taskData, DEREFHANDLE(args)->Get(3));
+            if (length == 0)
+                return Make_arbitrary_precision(taskData, 0);
+
+            while (1)
+            {
+                ssize_t sent = sendFileToSocket(sock, fd, offset, length);
+                if (sent >= 0)
+                    return Make_arbitrary_precision(taskData, sent);
+                int err = GETERROR;
+                if ((err == WOULDBLOCK || err == INPROGRESS) && c == 67 /* blocking */)
+                {
+                    WaitNetSend waiter(sock);
+                    processes->ThreadPauseForIO(taskData, &waiter);
+                    // It is NOT safe to just loop here.  We may have GCed.
+                    taskData->saveVec.reset(hSave);
+                    goto TryAgain;
+                }
+                else if (err != CALLINTERRUPTED)
+                    raise_syscall(taskData, "sendfile failed", err);
+                /* else try again */
+            }
+        }
+#endif
+
+
+    case 69: /* Receive a batch of datagrams into arrays. */
+        // We should check for interrupts even if we're not going to block.
+        processes->TestAnyEvents(taskData);
+    case 70: /* Non-blocking receive of a batch. */
+        {
+            SOCKET sock = getStreamSocket(taskData, DEREFHANDLE(args)->Get(0));
+            std::vector<DatagramBuffer> bufs;
+            // The list contains (base, offset, length) for each array slice.
+            for (PolyWord p = DEREFHANDLE(args)->Get(1);
+                    !ML_Cons_Cell::IsNull(p) && bufs.size() < MAX_DATAGRAM_BATCH; p = ((ML_Cons_Cell*)p.AsObjPtr())->t)
+            {
+                PolyObject *entry = ((ML_Cons_Cell*)p.AsObjPtr())->h.AsObjPtr();
+                DatagramBuffer buf;
+                buf.base = (char*)entry->Get(0).AsObjPtr()->AsBytePtr() + getPolyUnsigned(taskData, entry->Get(1));
+                buf.length = getPolyUnsigned(taskData, entry->Get(2));
+                bufs.push_back(buf);
+            }
+            if (bufs.size() == 0)
+                return SAVE(ListNull);
+
+            while (1)
+            {
+                int recvd = recvDatagrams(sock, &bufs[0], (int)bufs.size());
+                if (recvd != SOCKET_ERROR)
+                {
+                    // Return a list of (length, address) pairs in the same order as the buffers.
+                    Handle list = SAVE(ListNull);
+                    for (int i = recvd; i > 0; i--)
+                    {
+                        Handle lengthHandle = Make_arbitrary_precision(taskData, bufs[i-1].length);
+                        Handle addrHandle = SAVE(C_string_to_Poly(taskData, (char*)&bufs[i-1].addr, bufs[i-1].addrLen));
+                        Handle pair = ALLOC(2);
+                        DEREFHANDLE(pair)->Set(0, lengthHandle->Word());
+                        DEREFHANDLE(pair)->Set(1, addrHandle->Word());
+                        Handle next = ALLOC(SIZEOF(ML_Cons_Cell));
+                        DEREFLISTHANDLE(next)->h = pair->Word();
+                        DEREFLISTHANDLE(next)->t = list->Word();
+                        list = next;
+                    }
+                    return list;
+                }
+                int err = GETERROR;
+                if ((err == WOULDBLOCK || err == INPROGRESS) && c == 69 /* blocking */)
+                {
+                    WaitNet waiter(sock);
+                    processes->ThreadPauseForIO(taskData, &waiter);
+                    // It is NOT safe to just loop here.  We may have GCed.
+                    taskData->saveVec.reset(hSave);
+                    goto TryAgain;
+                }
+                else if (err != CALLINTERRUPTED)
+                    raise_syscall(taskData, "recvfrom failed", err);
+                /* else try again */
+            }
+        }
+
+    case 71: /* Send a batch of datagrams. */
+        // We should check for interrupts even if we're not going to block.
+        processes->TestAnyEvents(taskData);
+    case 72: /* Non-blocking send of a batch. */
+        {
+            SOCKET sock = getStreamSocket(taskData, DEREFHANDLE(args)->Get(0));
+            std::vector<DatagramBuffer> bufs;
+            char singleBytes[MAX_DATAGRAM_BATCH];
+            // The list contains (address, base, offset, length) for each vector slice.
+            for (PolyWord p = DEREFHANDLE(args)->Get(1);
+                    !ML_Cons_Cell::IsNull(p) && bufs.size() < MAX_DATAGRAM_BATCH; p = ((ML_Cons_Cell*)p.AsObjPtr())->t)
+            {
+                PolyObject *entry = ((ML_Cons_Cell*)p.AsObjPtr())->h.AsObjPtr();
+                PolyStringObject *psAddr = (PolyStringObject *)entry->Get(0).AsObjPtr();
+                PolyWord pBase = entry->Get(1);
+                DatagramBuffer buf;
+                if (psAddr->length > sizeof(buf.addr))
+                    raise_syscall(taskData, "Invalid address", EINVAL);
+                memcpy(&buf.addr, psAddr->chars, psAddr->length);
+                buf.addrLen = (socklen_t)psAddr->length;
+                if (IS_INT(pBase)) {
+                    /* As with send, a single byte vector is represented by the byte itself. */
+                    singleBytes[bufs.size()] = (char)UNTAGGED(pBase);
+                    buf.base = &singleBytes[bufs.size()];
+                    buf.length = 1;
+                }
+                else
+                {
+                    buf.base = (char*)pBase.AsObjPtr()->AsBytePtr() + getPolyUnsigned(taskData, entry->Get(2));
+                    buf.length = getPolyUnsigned(taskData, entry->Get(3));
+                }
+                bufs.push_back(buf);
+            }
+            if (bufs.size() == 0)
+                return Make_arbitrary_precision(taskData, 0);
+
+            while (1)
+            {
+                int sent = sendDatagrams(sock, &bufs[0], (int)bufs.size());
+                if (sent != SOCKET_ERROR)
+                    return Make_arbitrary_precision(taskData, sent);
+                int err = GETERROR;
+                if ((err == WOULDBLOCK || err == INPROGRESS) && c == 71 /* blocking */)
+                {
+                    WaitNetSend waiter(sock);
+                    processes->ThreadPauseForIO(taskData, &waiter);
+                    // It is NOT safe to just loop here.  We may have GCed.
+                    taskData->saveVec.reset(hSave);
+                    goto TryAgain;
+                }
+                else if (err != CALLINTERRUPTED)
+                    raise_syscall(taskData, "sendto failed", err);
+                /* else try again */
+            }
+        }
+
+    case 73: /* Look up a host name with getaddrinfo.  Returns a list of IPv4 and IPv6
+                addresses as 4 or 16 byte vectors.  The list is empty if the name was
+                not found. */
+        {
+            TempCString hostName(Poly_string_to_C_alloc(args->Word()));
+            ResolverEntry *entry = startResolverLookup(hostName);
+            std::vector<std::string> addresses;
+            int err;
+            try {
+                while (true)
+                {
+                    {
+                        PLocker lock(&resolverLock);
+                        if (! entry->pending)
+                        {
+                            addresses = entry->addresses;
+                            err = entry->error;
+                            break;
+                        }
+                    }
+                    ResolverWaiter waiter(entry);
+                    processes->ThreadPauseForIO(taskData, &waiter);
+                }
+            }
+            catch (...) {
+                releaseResolverEntry(entry);
+                throw;
+            }
+            releaseResolverEntry(entry);
+            if (err != 0)
+                raise_syscall(taskData, gai_strerror(err), 0);
+            Handle list = SAVE(ListNull);
+            for (std::vector<std::string>::reverse_iterator i = addresses.rbegin(); i != addresses.rend(); i++)
+            {
+                Handle addr = SAVE(C_string_to_Poly(taskData, i->data(), i->size()));
+                Handle next = ALLOC(SIZEOF(ML_Cons_Cell));
+                DEREFLISTHANDLE(next)->h = addr->Word();
+                DEREFLISTHANDLE(next)->t = list->Word();
+                list = next;
+            }
+            return list;
+        }
+
+    case 74: /* Set the time in seconds that results are cached.  Zero disables the cache. */
+        {
+            time_t secs = get_C_unsigned(taskData, args->Word());
+            PLocker lock(&resolverLock);
+            resolverCacheSecs = secs;
+            return Make_fixed_precision(taskData, 0);
+        }
+
+    case 75: /* Clear the cache. */
+        {
+            PLocker lock(&resolverLock);
+            purgeResolverCache(true);
+            // Entries in use are kept but will be looked up again.
+            for (std::map<std::string, ResolverEntry*>::iterator i = resolverCache.begin(); i != resolverCache.end(); i++)
+                i->second->expires = 0;
+            return Make_fixed_precision(taskData, 0);
+        }
 
     default:
         {
@@ -1447,7 +2094,11 @@ static Handle selectCall(TaskData *taskData, Handle args, int blockType)
             break;
         }
         case 1: // Block until one of the descriptors is ready.
+#ifdef USE_EPOLL_REACTOR
+            maxMillisecs = (unsigned)-1; // The reactor wakes us if we're interrupted.
+#else
             maxMillisecs = 1000; // Max 1 second
+#endif
             break;
         case 2: // Just a simple poll
             maxMillisecs = 0;
@@ -1730,6 +2381,9 @@ POLYUNSIGNED PolyNetworkCloseSocket(PolyObject *threadId, PolyWord strm)
         }
         else raise_syscall(taskData, "Socket is closed", EBADF);
         *(int*)(pushedStream->WordP()) = 0; // Mark as closed
+#ifdef USE_EPOLL_REACTOR
+        processes->ReactorWakeFD(descr);
+#endif
 #endif
         result = Make_fixed_precision(taskData, 0);
     }
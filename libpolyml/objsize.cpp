@@ -44,6 +44,10 @@
 #include <string.h>
 #endif
 
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
 #ifdef HAVE_ASSERT_H
 #include <assert.h>
 #define ASSERT(x) assert(x)
@@ -65,11 +69,27 @@
 #include "mpoly.h"
 #include "processes.h"
 #include "rtsentry.h"
+#include "rts_module.h"
+#include "gc.h"
+#include "profiling.h"
+#include "sys.h"
+#include "../polyheapsnapshot.h"
+
+#include <vector>
+
+#if (defined(_WIN32) && ! defined(__CYGWIN__))
+#define NOMEMORY ERROR_NOT_ENOUGH_MEMORY
+#define ERRORNUMBER _doserrno
+#else
+#define NOMEMORY ENOMEM
+#define ERRORNUMBER errno
+#endif
 
 extern "C" {
     POLYEXTERNALSYMBOL POLYUNSIGNED PolyObjSize(PolyObject *threadId, PolyWord obj);
     POLYEXTERNALSYMBOL POLYUNSIGNED PolyShowSize(PolyObject *threadId, PolyWord obj);
     POLYEXTERNALSYMBOL POLYUNSIGNED PolyObjProfile(PolyObject *threadId, PolyWord obj);
+    POLYEXTERNALSYMBOL POLYUNSIGNED PolyHeapSnapshot(PolyObject *threadId, PolyWord fileName);
 }
 
 extern FILE *polyStdout;
@@ -422,11 +442,265 @@ POLYUNSIGNED PolyObjProfile(PolyObject *threadId, PolyWord obj)
     return result->Word().AsUnsigned();
 }
 
+// Collect the addresses in a single object.  This uses the general
+// ScanAddress code so that constants within code are found in the same way
+// as the GC finds them.
+class SnapshotObjectRefs: public ScanAddress
+{
+public:
+    virtual PolyObject *ScanObjectAddress(PolyObject *base) { refs.push_back(base); return base; }
+    virtual POLYUNSIGNED ScanCodeAddressAt(PolyObject **pt) { refs.push_back(*pt); return 0; }
+
+    std::vector<PolyObject*> refs;
+};
+
+// Write out every object reachable from the roots.  The objects are written
+// as they are visited so the only memory needed apart from the recursion
+// stack is the bitmaps to record the objects that have been visited.
+class HeapSnapshot: public RecursiveScanWithStack
+{
+public:
+    HeapSnapshot(FILE *f);
+    ~HeapSnapshot();
+
+    virtual PolyObject *ScanObjectAddress(PolyObject *base);
+    virtual void ScanRuntimeAddress(PolyObject **pt, RtsStrength weak);
+    virtual POLYUNSIGNED ScanCodeAddressAt(PolyObject **pt);
+
+    void WriteHeader(void);
+    void WriteEnd(void) { fputc(POLY_SNAP_END, snapFile); }
+
+    const char *errorMessage;
+
+protected:
+    virtual bool TestForScan(PolyWord *pt);
+    virtual void MarkAsScanning(PolyObject *obj);
+    virtual void StackOverflow(void) { errorMessage = "Insufficient memory"; }
+
+private:
+    VisitBitmap *FindBitmap(PolyObject *p);
+    void WriteWord(uintptr_t w) { fwrite(&w, sizeof(w), 1, snapFile); }
+    void WriteObject(PolyObject *obj);
+    void WriteCodeName(PolyObject *obj);
+
+    FILE *snapFile;
+    unsigned depth; // Zero when we are processing a root.
+    std::vector<VisitBitmap*> bitmaps;
+};
+
+HeapSnapshot::HeapSnapshot(FILE *f): errorMessage(0), snapFile(f), depth(0)
+{
+    // All the ML threads are stopped so the spaces cannot change.
+    for (std::vector<PermanentMemSpace*>::iterator i = gMem.pSpaces.begin(); i < gMem.pSpaces.end(); i++)
+        bitmaps.push_back(new VisitBitmap((*i)->bottom, (*i)->top));
+    for (std::vector<LocalMemSpace*>::iterator i = gMem.lSpaces.begin(); i < gMem.lSpaces.end(); i++)
+        bitmaps.push_back(new VisitBitmap((*i)->bottom, (*i)->top));
+    for (std::vector<CodeSpace *>::iterator i = gMem.cSpaces.begin(); i < gMem.cSpaces.end(); i++)
+        bitmaps.push_back(new VisitBitmap((*i)->bottom, (*i)->top));
+}
+
+HeapSnapshot::~HeapSnapshot()
+{
+    for (std::vector<VisitBitmap*>::iterator i = bitmaps.begin(); i < bitmaps.end(); i++)
+        delete(*i);
+}
+
+VisitBitmap *HeapSnapshot::FindBitmap(PolyObject *p)
+{
+    for (std::vector<VisitBitmap*>::iterator i = bitmaps.begin(); i < bitmaps.end(); i++)
+    {
+        if ((*i)->InRange((PolyWord*)p)) return *i;
+    }
+    return 0;
+}
+
+void HeapSnapshot::WriteHeader(void)
+{
+    fwrite(POLY_SNAP_MAGIC, 1, sizeof(POLY_SNAP_MAGIC)-1, snapFile);
+    uint32_t header[3] = { POLY_SNAP_VERSION, sizeof(uintptr_t), sizeof(PolyWord) };
+    fwrite(header, sizeof(header), 1, snapFile);
+}
+
+// Roots come in here.  So do constants in code objects but those are
+// reached while we are processing another object.
+PolyObject *HeapSnapshot::ScanObjectAddress(PolyObject *base)
+{
+    if (depth == 0)
+    {
+        fputc(POLY_SNAP_ROOT, snapFile);
+        WriteWord((uintptr_t)base);
+    }
+    depth++;
+    PolyObject *result = RecursiveScanWithStack::ScanObjectAddress(base);
+    depth--;
+    return result;
+}
+
+void HeapSnapshot::ScanRuntimeAddress(PolyObject **pt, RtsStrength weak)
+{
+    // Weak references from the RTS don't keep anything alive.
+    if (weak == STRENGTH_STRONG)
+        (void)ScanObjectAddress(*pt);
+}
+
+// The code address in a closure.  Push the code object to be processed later.
+POLYUNSIGNED HeapSnapshot::ScanCodeAddressAt(PolyObject **pt)
+{
+    PolyObject *code = *pt;
+    VisitBitmap *bm = FindBitmap(code);
+    if (bm != 0 && ! bm->AlreadyVisited(code))
+    {
+        MarkAsScanning(code);
+        PushToStack(code, (PolyWord*)code);
+    }
+    return 0;
+}
+
+bool HeapSnapshot::TestForScan(PolyWord *pt)
+{
+    PolyObject *obj = (*pt).AsObjPtr();
+    VisitBitmap *bm = FindBitmap(obj);
+    // Ignore it if it isn't in the heap.
+    return bm != 0 && ! bm->AlreadyVisited(obj);
+}
+
+// This is called exactly once for each object we will process.
+void HeapSnapshot::MarkAsScanning(PolyObject *obj)
+{
+    VisitBitmap *bm = FindBitmap(obj);
+    ASSERT(bm != 0);
+    if (bm->AlreadyVisited(obj))
+        return;
+    bm->SetVisited(obj);
+    WriteObject(obj);
+}
+
+void HeapSnapshot::WriteObject(PolyObject *obj)
+{
+    POLYUNSIGNED lengthWord = obj->LengthWord();
+    SnapshotObjectRefs refs;
+    if (! obj->IsByteObject())
+        refs.ScanAddressesInObject(obj, lengthWord);
+
+    fputc(POLY_SNAP_OBJECT, snapFile);
+    WriteWord((uintptr_t)obj);
+    WriteWord((uintptr_t)lengthWord);
+    WriteWord(refs.refs.size());
+    for (std::vector<PolyObject*>::iterator i = refs.refs.begin(); i < refs.refs.end(); i++)
+        WriteWord((uintptr_t)*i);
+
+    if (obj->IsCodeObject())
+        WriteCodeName(obj);
+}
+
+void HeapSnapshot::WriteCodeName(PolyObject *obj)
+{
+    PolyWord *consts = obj->ConstPtrForCode();
+    PolyWord name = consts[0];
+    if (name == TAGGED(0) || ! name.IsDataPtr())
+        return;
+    PolyStringObject *nameString = (PolyStringObject*)name.AsObjPtr();
+    if (! nameString->IsByteObject())
+        return;
+    PolyObject *profObject = getProfileObjectForCode(obj);
+    fputc(POLY_SNAP_CODENAME, snapFile);
+    WriteWord((uintptr_t)obj);
+    WriteWord((uintptr_t)profObject);
+    WriteWord(nameString->length);
+    fwrite(nameString->chars, 1, nameString->length, snapFile);
+}
+
+// The permanent mutable areas are roots.  This allows us to use
+// ScanAddressesInRegion to find each object in them.
+class SnapshotPermanentRoots: public ScanAddress
+{
+public:
+    SnapshotPermanentRoots(HeapSnapshot *snapshot): m_snapshot(snapshot) {}
+
+    virtual void ScanAddressesInObject(PolyObject *obj, POLYUNSIGNED lengthWord)
+        { (void)m_snapshot->ScanObjectAddress(obj); }
+
+    // Have to define this.
+    virtual PolyObject *ScanObjectAddress(PolyObject *base) { ASSERT(false); return 0; }
+
+private:
+    HeapSnapshot *m_snapshot;
+};
+
+class HeapSnapshotRequest: public MainThreadRequest
+{
+public:
+    HeapSnapshotRequest(FILE *f): MainThreadRequest(MTP_HEAPSNAPSHOT), snapFile(f), errorMessage(0) {}
+
+    virtual void Perform();
+
+    FILE *snapFile;
+    const char *errorMessage;
+};
+
+// This is called by the root thread with all the ML threads stopped.
+void HeapSnapshotRequest::Perform()
+{
+    HeapSnapshot snapshot(snapFile);
+    snapshot.WriteHeader();
+
+    SnapshotPermanentRoots permRoots(&snapshot);
+    for (std::vector<PermanentMemSpace*>::iterator i = gMem.pSpaces.begin(); i < gMem.pSpaces.end(); i++)
+    {
+        PermanentMemSpace *space = *i;
+        if (space->isMutable && ! space->byteOnly)
+            permRoots.ScanAddressesInRegion(space->bottom, space->top);
+    }
+    // The RTS roots including the thread stacks.
+    GCModules(&snapshot);
+
+    snapshot.WriteEnd();
+    errorMessage = snapshot.errorMessage;
+}
+
+// Write a snapshot of the heap to a file.  The file can be analysed offline.
+POLYUNSIGNED PolyHeapSnapshot(PolyObject *threadId, PolyWord fileName)
+{
+    TaskData *taskData = TaskData::FindTaskForId(threadId);
+    ASSERT(taskData != 0);
+    taskData->PreRTSCall();
+    Handle reset = taskData->saveVec.mark();
+
+    try {
+        TempString fileNameBuff(fileName);
+        if (fileNameBuff == NULL)
+            raise_syscall(taskData, "Insufficient memory", NOMEMORY);
+#if (defined(_WIN32) && defined(UNICODE))
+        FILE *snapFile = _wfopen(fileNameBuff, L"wb");
+#else
+        FILE *snapFile = fopen(fileNameBuff, "wb");
+#endif
+        if (snapFile == NULL)
+            raise_syscall(taskData, "Cannot open snapshot file", ERRORNUMBER);
+        // Run a full GC first so that there are no forwarding pointers and
+        // only the live data is written.
+        FullGC(taskData);
+        HeapSnapshotRequest request(snapFile);
+        processes->MakeRootRequest(taskData, &request);
+        bool writeError = ferror(snapFile) != 0;
+        fclose(snapFile);
+        if (request.errorMessage)
+            raise_fail(taskData, request.errorMessage);
+        if (writeError)
+            raise_fail(taskData, "Error writing snapshot file");
+    } catch (...) { } // If an ML exception is raised
+
+    taskData->saveVec.reset(reset);
+    taskData->PostRTSCall();
+    return TAGGED(0).AsUnsigned(); // Returns unit
+}
+
 struct _entrypts objSizeEPT[] =
 {
     { "PolyObjSize",                    (polyRTSFunction)&PolyObjSize},
     { "PolyShowSize",                   (polyRTSFunction)&PolyShowSize},
     { "PolyObjProfile",                 (polyRTSFunction)&PolyObjProfile},
+    { "PolyHeapSnapshot",               (polyRTSFunction)&PolyHeapSnapshot},
 
     { NULL, NULL} // End of list.
 };
@@ -55,6 +55,8 @@
 
 #if (defined(__CYGWIN__) || defined(_WIN32))
 #include <process.h>
+#else
+#include <spawn.h>
 #endif
 
 #ifdef HAVE_ASSERT_H
@@ -237,18 +239,18 @@ static Handle process_env_dispatch_c(TaskData *mdTaskData, Handle args, Handle c
             // SIG_IGN in the parent so that the wait will not be interrupted.
             // That may make sense in a single-threaded application but is
             // that right here?
-            int pid = vfork();
-            if (pid == -1)
-                raise_syscall(mdTaskData, "Function system failed", errno);
-            else if (pid == 0)
-            { // In child
-                sigset_t sigset;
-                sigemptyset(&sigset);
-                sigprocmask(SIG_SETMASK, &sigset, 0);
-                // Reset other signals?
-                execv("/bin/sh", argv);
-                _exit(1);
-            }
+            // posix_spawn avoids copying the page tables of a large heap.
+            posix_spawnattr_t attr;
+            posix_spawnattr_init(&attr);
+            sigset_t sigset;
+            sigemptyset(&sigset);
+            posix_spawnattr_setsigmask(&attr, &sigset);
+            posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+            pid_t pid;
+            int err = posix_spawn(&pid, "/bin/sh", 0, &attr, argv, environ);
+            posix_spawnattr_destroy(&attr);
+            if (err != 0)
+                raise_syscall(mdTaskData, "Function system failed", err);
 #endif
 #endif
             while (true)
@@ -92,6 +92,23 @@
 #include <sys/sysctl.h>
 #endif
 
+#if (defined(__linux__) && defined(HAVE_PTHREAD))
+// On Linux threads blocked on ML mutexes wait on futexes.
+#define USE_FUTEX_MUTEX 1
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
+#if (defined(__linux__) && defined(HAVE_PTHREAD) && defined(HAVE_POLL_H))
+// Threads waiting for IO are woken by the epoll reactor.
+#include <sys/epoll.h>
+#include <map>
+#endif
+
 #if (defined(_WIN32) && ! defined(__CYGWIN__))
 #include <tchar.h>
 #endif
@@ -144,6 +161,9 @@ extern "C" {
     POLYEXTERNALSYMBOL POLYUNSIGNED PolyThreadNumProcessors();
     POLYEXTERNALSYMBOL POLYUNSIGNED PolyThreadNumPhysicalProcessors();
     POLYEXTERNALSYMBOL POLYUNSIGNED PolyThreadMaxStackSize(PolyObject *threadId, PolyWord newSize);
+    POLYEXTERNALSYMBOL POLYUNSIGNED PolyFiberCreate(PolyObject *threadId, PolyWord closure);
+    POLYEXTERNALSYMBOL POLYUNSIGNED PolyFiberSwitch(PolyObject *threadId, PolyWord fiberId);
+    POLYEXTERNALSYMBOL POLYUNSIGNED PolyFiberFree(PolyObject *threadId, PolyWord fiberId);
 }
 
 #define SAVE(x) taskData->saveVec.push(x)
@@ -178,10 +198,33 @@ struct _entrypts processesEPT[] =
     { "PolyThreadNumProcessors",        (polyRTSFunction)&PolyThreadNumProcessors},
     { "PolyThreadNumPhysicalProcessors",(polyRTSFunction)&PolyThreadNumPhysicalProcessors},
     { "PolyThreadMaxStackSize",         (polyRTSFunction)&PolyThreadMaxStackSize},
+    { "PolyFiberCreate",                (polyRTSFunction)&PolyFiberCreate},
+    { "PolyFiberSwitch",                (polyRTSFunction)&PolyFiberSwitch},
+    { "PolyFiberFree",                  (polyRTSFunction)&PolyFiberFree},
 
     { NULL, NULL} // End of list.
 };
 
+#ifdef USE_EPOLL_REACTOR
+// A thread waiting in the IO reactor.
+class ReactorWait
+{
+public:
+    ReactorWait(): ready(false) {}
+    PCondVar wakeUp;
+    bool ready;
+};
+
+// The events that a waiting thread is interested in for a descriptor.
+struct ReactorInterest
+{
+    ReactorWait *waiter;
+    short events;
+};
+
+typedef std::multimap<int, ReactorInterest> ReactorInterests;
+#endif
+
 class Processes: public ProcessExternal, public RtsModule
 {
 public:
@@ -269,9 +312,32 @@ public:
 
     virtual void SetSingleThreaded(void) { singleThreaded = true; }
 
+    // Record how long it took for all the threads to stop for a request.
+    void RecordSafepointTime(void);
+
+#ifdef USE_EPOLL_REACTOR
+    virtual int ReactorPoll(struct pollfd *fds, unsigned nfds, unsigned maxMillisecs);
+    virtual void ReactorWakeFD(int fd);
+    bool StartReactor(void);
+    void ReactorLoop(void);
+    static void *ReactorThread(void *);
+
+    // reactorLock protects reactorInterests and the reactorWait field of
+    // each thread.  reactorFd is the epoll descriptor.  It is set once, with
+    // the lock held, when the reactor thread is started.
+    PLock reactorLock;
+    int reactorFd;
+    ReactorInterests reactorInterests;
+#endif
+
     // Operations on mutexes
     void MutexBlock(TaskData *taskData, Handle hMutex);
     void MutexUnlock(TaskData *taskData, Handle hMutex);
+    // Wake any threads blocked on the mutex.  Must be called with schedLock
+    // held unless futexes are being used.
+    void SignalMutexWaiters(PolyObject *mutex);
+    // Test whether a thread about to block on a mutex should return instead.
+    bool MutexWaitInterrupted(TaskData *taskData);
 
     // Operations on condition variables.
     void WaitInfinite(TaskData *taskData, Handle hMutex);
@@ -307,8 +373,12 @@ public:
        close-down. */
     PCondVar initialThreadWait;
     // A requesting thread sets this to indicate the request.  This value
-    // is only reset once the request has been satisfied.
-    MainThreadRequest *threadRequest;
+    // is only reset once the request has been satisfied.  It is only set
+    // with schedLock held but threads read it without the lock when
+    // entering or leaving the ML heap.
+    MainThreadRequest * volatile threadRequest;
+    // The time, in microseconds, when threadRequest was set.
+    uint64_t requestTime;
 
     PCondVar mlThreadWait;  // All the threads block on here until the request has completed.
 
@@ -330,9 +400,12 @@ public:
 static Processes processesModule;
 ProcessExternal *processes = &processesModule;
 
-Processes::Processes(): singleThreaded(false),
-    schedLock("Scheduler"), interrupt_exn(0),
-    threadRequest(0), exitResult(0), exitRequest(false), sigTask(0)
+Processes::Processes():
+#ifdef USE_EPOLL_REACTOR
+    reactorLock("IO reactor"), reactorFd(-1),
+#endif
+    singleThreaded(false), schedLock("Scheduler"), interrupt_exn(0),
+    threadRequest(0), requestTime(0), exitResult(0), exitRequest(false), sigTask(0)
 {
 #ifdef HAVE_WINDOWS_H
     hStopEvent = NULL;
@@ -421,6 +494,93 @@ POLYUNSIGNED PolyThreadMutexUnlock(PolyObject *threadId, PolyWord arg)
     return TAGGED(0).AsUnsigned();
 }
 
+#ifdef USE_FUTEX_MUTEX
+// Threads blocked on an ML mutex wait on a futex rather than on their
+// threadLock so that neither blocking nor unlocking needs schedLock or a scan
+// of the thread list.  The mutex word itself cannot be used as the futex because
+// the GC may move the mutex while a thread is waiting for it.  Instead the
+// address is hashed into a table of parking slots each with a sequence number
+// and a thread waits until the sequence number changes.  A wake-up is only a
+// hint: the thread returns to ML and tries to get the lock again.  Mutexes may
+// share a slot and a mutex may hash to a different slot after it has been moved
+// so every slot is woken after a GC or other request that stops the world.
+#define MUTEX_PARKING_SLOTS 256
+// Number of times to poll the mutex in the RTS before blocking.
+#define MUTEX_SPIN_COUNT    100
+
+struct MutexParkingSlot
+{
+    volatile int sequence;
+    volatile int waiters;
+    char padding[64-2*sizeof(int)]; // Keep the slots in separate cache lines.
+};
+
+static MutexParkingSlot mutexParking[MUTEX_PARKING_SLOTS];
+
+static MutexParkingSlot *ParkingSlotFor(PolyObject *mutex)
+{
+    uintptr_t addr = (uintptr_t)mutex;
+    return &mutexParking[((addr >> 4) ^ (addr >> 12)) % MUTEX_PARKING_SLOTS];
+}
+
+static void WakeParkingSlot(MutexParkingSlot *slot)
+{
+    // The increment is a full barrier so any thread that has not
+    // registered as a waiter will see the new sequence number.
+    __sync_fetch_and_add(&slot->sequence, 1);
+    if (slot->waiters != 0)
+        syscall(SYS_futex, &slot->sequence, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static void WakeAllParkingSlots(void)
+{
+    for (unsigned i = 0; i < MUTEX_PARKING_SLOTS; i++)
+        WakeParkingSlot(&mutexParking[i]);
+}
+
+static inline void SpinPause(void)
+{
+#if (defined(__i386__) || defined(__x86_64__))
+    __asm__ __volatile__("pause");
+#endif
+}
+#endif
+
+bool Processes::MutexWaitInterrupted(TaskData *taskData)
+{
+    // We mustn't block if we have been interrupted, and are processing
+    // interrupts asynchronously, or we've been killed.
+    switch (taskData->requests)
+    {
+    case kRequestKill:
+        return true;
+    case kRequestInterrupt:
+        {
+            POLYUNSIGNED attrs = ThreadAttrs(taskData) & PFLAG_INTMASK;
+            // If we're ignoring interrupts or handling them synchronously
+            // we can block.
+            return attrs == PFLAG_ASYNCH || attrs == PFLAG_ASYNCH_ONCE;
+        }
+    default:
+        return false;
+    }
+}
+
+void Processes::SignalMutexWaiters(PolyObject *mutex)
+{
+#ifdef USE_FUTEX_MUTEX
+    WakeParkingSlot(ParkingSlotFor(mutex));
+#else
+    for (std::vector<TaskData*>::iterator i = taskArray.begin(); i != taskArray.end(); i++)
+    {
+        TaskData *p = *i;
+        // If the thread is blocked on this mutex we can signal the thread.
+        if (p && p->blockMutex == mutex)
+            p->threadLock.Signal();
+    }
+#endif
+}
+
 /* A mutex was locked i.e. the count was ~1 or less.  We will have set it to
   ~1. This code blocks if the count is still ~1.  It does actually return
   if another thread tries to lock the mutex and hasn't yet set the value
@@ -428,6 +588,40 @@ POLYUNSIGNED PolyThreadMutexUnlock(PolyObject *threadId, PolyWord arg)
   get the lock again. */
 void Processes::MutexBlock(TaskData *taskData, Handle hMutex)
 {
+#ifdef USE_FUTEX_MUTEX
+    // The ML code has already spun but it is worth polling briefly here since
+    // the cost of blocking is high.  We still hold the ML memory so stop
+    // if another thread is waiting to stop the world.
+    for (unsigned i = 0; i < MUTEX_SPIN_COUNT && threadRequest == 0; i++)
+    {
+        if (UNTAGGED(DEREFHANDLE(hMutex)->Get(0)) >= 0)
+            return;
+        SpinPause();
+    }
+    MutexParkingSlot *slot = ParkingSlotFor(DEREFHANDLE(hMutex));
+    // Set this so we can see what we're blocked on.  MakeRequest uses it to
+    // wake us if we are interrupted or killed.
+    taskData->blockMutex = DEREFHANDLE(hMutex);
+    __sync_fetch_and_add(&slot->waiters, 1);
+    int sequence = slot->sequence;
+    PMemoryBarrier();
+    // We have to check the value again after reading the sequence number
+    // because the unlocking thread could have set the variable back to 1
+    // (unlocked) and woken any waiters before we got here.  If it unlocks
+    // it after this the sequence number will have changed and the wait
+    // will return immediately.
+    if (UNTAGGED(DEREFHANDLE(hMutex)->Get(0)) < 0 && ! MutexWaitInterrupted(taskData))
+    {
+        // Now release the ML memory.  A GC can start.
+        ThreadReleaseMLMemory(taskData);
+        globalStats.incCount(PSC_THREADS_WAIT_MUTEX);
+        syscall(SYS_futex, &slot->sequence, FUTEX_WAIT_PRIVATE, sequence, NULL, NULL, 0);
+        globalStats.decCount(PSC_THREADS_WAIT_MUTEX);
+        ThreadUseMLMemory(taskData);
+    }
+    __sync_fetch_and_sub(&slot->waiters, 1);
+    taskData->blockMutex = 0; // No longer blocked.
+#else
     schedLock.Lock();
     // We have to check the value again with schedLock held rather than
     // simply waiting because otherwise the unlocking thread could have
@@ -442,21 +636,8 @@ void Processes::MutexBlock(TaskData *taskData, Handle hMutex)
         // Wait until we're woken up.  We mustn't block if we have been
         // interrupted, and are processing interrupts asynchronously, or
         // we've been killed.
-        switch (taskData->requests)
+        if (! MutexWaitInterrupted(taskData))
         {
-        case kRequestKill:
-            // We've been killed.  Handle this later.
-            break;
-        case kRequestInterrupt:
-            {
-                // We've been interrupted.  
-                POLYUNSIGNED attrs = ThreadAttrs(taskData) & PFLAG_INTMASK;
-                if (attrs == PFLAG_ASYNCH || attrs == PFLAG_ASYNCH_ONCE)
-                    break;
-                // If we're ignoring interrupts or handling them synchronously
-                // we don't do anything here.
-            }
-        case kRequestNone:
             globalStats.incCount(PSC_THREADS_WAIT_MUTEX);
             taskData->threadLock.Wait(&schedLock);
             globalStats.decCount(PSC_THREADS_WAIT_MUTEX);
@@ -466,6 +647,7 @@ void Processes::MutexBlock(TaskData *taskData, Handle hMutex)
     }
     // Return and try and get the lock again.
     schedLock.Unlock();
+#endif
     // Test to see if we have been interrupted and if this thread
     // processes interrupts asynchronously we should raise an exception
     // immediately.  Perhaps we do that whenever we exit from the RTS.
@@ -477,20 +659,19 @@ void Processes::MutexBlock(TaskData *taskData, Handle hMutex)
 void Processes::MutexUnlock(TaskData *taskData, Handle hMutex)
 {
     // The caller has already set the variable to 1 (unlocked).
+#ifdef USE_FUTEX_MUTEX
+    // Any thread that is about to block will see either the updated
+    // value or the change to the sequence number.
+    SignalMutexWaiters(DEREFHANDLE(hMutex));
+#else
     // We need to acquire schedLock so that we can
     // be sure that any thread that is trying to lock sees either
     // the updated value (and so doesn't wait) or has successfully
     // waited on its threadLock (and so will be woken up).
     schedLock.Lock();
-    // Unlock any waiters.
-    for (std::vector<TaskData*>::iterator i = taskArray.begin(); i != taskArray.end(); i++)
-    {
-        TaskData *p = *i;
-        // If the thread is blocked on this mutex we can signal the thread.
-        if (p && p->blockMutex == DEREFHANDLE(hMutex))
-            p->threadLock.Signal();
-    }
+    SignalMutexWaiters(DEREFHANDLE(hMutex));
     schedLock.Unlock();
+#endif
 }
 
 POLYUNSIGNED PolyThreadCondVarWait(PolyObject *threadId, PolyWord arg)
@@ -553,14 +734,7 @@ void Processes::WaitInfinite(TaskData *taskData, Handle hMutex)
     {
         taskData->AtomicReset(hMutex);
         // The mutex was locked so we have to release any waiters.
-        // Unlock any waiters.
-        for (std::vector<TaskData*>::iterator i = taskArray.begin(); i != taskArray.end(); i++)
-        {
-            TaskData *p = *i;
-            // If the thread is blocked on this mutex we can signal the thread.
-            if (p && p->blockMutex == DEREFHANDLE(hMutex))
-                p->threadLock.Signal();
-        }
+        SignalMutexWaiters(DEREFHANDLE(hMutex));
     }
     // Wait until we're woken up.  Don't block if we have been interrupted
     // or killed.
@@ -604,14 +778,7 @@ void Processes::WaitUntilTime(TaskData *taskData, Handle hMutex, Handle hWakeTim
     {
         taskData->AtomicReset(hMutex);
         // The mutex was locked so we have to release any waiters.
-        // Unlock any waiters.
-        for (std::vector<TaskData*>::iterator i = taskArray.begin(); i != taskArray.end(); i++)
-        {
-            TaskData *p = *i;
-            // If the thread is blocked on this mutex we can signal the thread.
-            if (p && p->blockMutex == DEREFHANDLE(hMutex))
-                p->threadLock.Signal();
-        }
+        SignalMutexWaiters(DEREFHANDLE(hMutex));
     }
     // Wait until we're woken up.  Don't block if we have been interrupted
     // or killed.
@@ -766,6 +933,130 @@ POLYUNSIGNED PolyThreadMaxStackSize(PolyObject *threadId, PolyWord newSize)
     return TAGGED(0).AsUnsigned();
 }
 
+// Fibers.  A fiber is an ML stack that is not permanently associated with
+// any thread.  A thread switches to a fiber within an RTS call by saving its
+// current stack state and loading the fiber's; the call then returns on the
+// new stack.  The scheduling is done entirely in ML (the Fiber structure).
+// Fibers are identified in ML by a small integer, the index in this table
+// plus one.  Zero refers to the thread's own stack.
+static std::vector<FiberState*> fiberTable;
+// fiberLock protects fiberTable and the "running" flags.
+static PLock fiberLock("Fibers");
+
+static FiberState *FiberForId(TaskData *taskData, POLYUNSIGNED id)
+{
+    if (id == 0 || id > fiberTable.size() || fiberTable[id-1] == 0)
+        raise_fail(taskData, "Invalid fiber");
+    return fiberTable[id-1];
+}
+
+// Create a new fiber that will run the closure when it is first switched to.
+POLYUNSIGNED PolyFiberCreate(PolyObject *threadId, PolyWord closure)
+{
+    TaskData *taskData = TaskData::FindTaskForId(threadId);
+    ASSERT(taskData != 0);
+    taskData->PreRTSCall();
+    Handle reset = taskData->saveVec.mark();
+    POLYUNSIGNED result = 0;
+
+    try {
+        StackSpace *space = gMem.NewStackSpace(machineDependent->InitialStackSize());
+        if (space == 0)
+            raise_fail(taskData, "Unable to allocate fiber stack");
+        FiberState *fiber = new FiberState;
+        fiber->stack = space;
+        taskData->InitFiberStack(fiber, closure.AsObjPtr());
+        PLocker lock(&fiberLock);
+        size_t i;
+        for (i = 0; i < fiberTable.size() && fiberTable[i] != 0; i++) ;
+        if (i == fiberTable.size()) fiberTable.push_back(fiber);
+        else fiberTable[i] = fiber;
+        result = TAGGED(i+1).AsUnsigned();
+    }
+    catch (...) { } // If an ML exception is raised
+
+    taskData->saveVec.reset(reset);
+    taskData->PostRTSCall();
+    return result;
+}
+
+// Switch the thread to run on a different fiber.  The current stack is saved
+// and the call returns on the new stack.  A fiber can only be run by one thread
+// at a time.
+POLYUNSIGNED PolyFiberSwitch(PolyObject *threadId, PolyWord fiberId)
+{
+    TaskData *taskData = TaskData::FindTaskForId(threadId);
+    ASSERT(taskData != 0);
+    taskData->PreRTSCall();
+    Handle reset = taskData->saveVec.mark();
+    POLYUNSIGNED result = TAGGED(0).AsUnsigned();
+
+    try {
+        POLYUNSIGNED id = fiberId.UnTaggedUnsigned();
+        FiberState *from = taskData->currentFiber, *to;
+        // Hold the lock until the switch is complete.  Until then the stack of
+        // "from" is still the thread's current stack.
+        PLocker lock(&fiberLock);
+        if (id == 0)
+        {
+            // Back to the thread's own stack.
+            if (from == 0)
+                raise_fail(taskData, "Not running a fiber");
+            to = taskData->ownFiber;
+        }
+        else
+        {
+            to = FiberForId(taskData, id);
+            if (to == from) raise_fail(taskData, "Fiber is already running");
+            if (to->running) raise_fail(taskData, "Fiber is running in another thread");
+            if (to->stack == 0) raise_fail(taskData, "Fiber has terminated");
+            if (from == 0)
+            {
+                if (taskData->ownFiber == 0)
+                    taskData->ownFiber = new FiberState;
+                from = taskData->ownFiber;
+            }
+        }
+        taskData->SaveFiberState(from);
+        result = taskData->LoadFiberState(to);
+        from->running = false;
+        to->running = true;
+        taskData->currentFiber = id == 0 ? 0 : to;
+    }
+    catch (...) { } // If an ML exception is raised
+
+    taskData->saveVec.reset(reset);
+    taskData->PostRTSCall();
+    return result;
+}
+
+// Release a fiber.  It must not be running.
+POLYUNSIGNED PolyFiberFree(PolyObject *threadId, PolyWord fiberId)
+{
+    TaskData *taskData = TaskData::FindTaskForId(threadId);
+    ASSERT(taskData != 0);
+    taskData->PreRTSCall();
+    Handle reset = taskData->saveVec.mark();
+
+    try {
+        POLYUNSIGNED id = fiberId.UnTaggedUnsigned();
+        FiberState *fiber;
+        {
+            PLocker lock(&fiberLock);
+            fiber = FiberForId(taskData, id);
+            if (fiber->running) raise_fail(taskData, "Fiber is running");
+            fiberTable[id-1] = 0;
+        }
+        if (fiber->stack) gMem.DeleteStackSpace(fiber->stack);
+        delete(fiber);
+    }
+    catch (...) { } // If an ML exception is raised
+
+    taskData->saveVec.reset(reset);
+    taskData->PostRTSCall();
+    return TAGGED(0).AsUnsigned();
+}
+
 // Old dispatch function.  This is only required because the pre-built compiler
 // may use some of these e.g. fork.
 Handle Processes::ThreadDispatch(TaskData *taskData, Handle args, Handle code)
@@ -813,9 +1104,12 @@ void TaskData::FillUnusedSpace(void)
 
 TaskData::TaskData(): allocPointer(0), allocLimit(0), allocSize(MIN_HEAP_SIZE), allocCount(0),
         stack(0), threadObject(0), signalStack(0), foreignStack(TAGGED(0)),
-        inML(false), requests(kRequestNone), blockMutex(0), inMLHeap(false),
-        runningProfileTimer(false)
+        inML(false), ownFiber(0), currentFiber(0), requests(kRequestNone), blockMutex(0), inMLHeap(false),
+        safepointDelay(0), runningProfileTimer(false)
 {
+#ifdef USE_EPOLL_REACTOR
+    reactorWait = 0;
+#endif
 #ifdef HAVE_WINDOWS_H
     lastCPUTime = 0;
 #endif
@@ -829,6 +1123,16 @@ TaskData::~TaskData()
 {
     if (signalStack) free(signalStack);
     if (stack) gMem.DeleteStackSpace(stack);
+    if (currentFiber != 0)
+    {
+        // The thread exited while running a fiber.  The fiber's stack has just
+        // been deleted and the thread's own stack is held in ownFiber.
+        PLocker lock(&fiberLock);
+        currentFiber->stack = 0;
+        currentFiber->running = false;
+        if (ownFiber->stack) gMem.DeleteStackSpace(ownFiber->stack);
+    }
+    delete(ownFiber);
 #ifdef HAVE_WINDOWS_H
     if (threadHandle) CloseHandle(threadHandle);
 #endif
@@ -863,6 +1167,24 @@ void Processes::MakeRequest(TaskData *p, ThreadRequests request)
         p->requests = request;
         p->InterruptCode();
         p->threadLock.Signal();
+#ifdef USE_FUTEX_MUTEX
+        // If it is blocked on a mutex it is waiting on the futex.
+        PMemoryBarrier();
+        if (p->blockMutex != 0)
+            SignalMutexWaiters(p->blockMutex);
+#endif
+#ifdef USE_EPOLL_REACTOR
+        // If it is waiting for IO wake it.
+        if (! singleThreaded)
+        {
+            PLocker lock(&reactorLock);
+            if (p->reactorWait != 0)
+            {
+                p->reactorWait->ready = true;
+                p->reactorWait->wakeUp.Signal();
+            }
+        }
+#endif
         // Set the value in the ML object as well so the ML code can see it
         p->threadObject->requestCopy = TAGGED(request);
     }
@@ -898,10 +1220,40 @@ void Processes::ThreadExit(TaskData *taskData)
 #endif
 }
 
+// Current real time in microseconds.  Used to measure how long threads
+// take to reach a safe point when the world has to be stopped.
+static uint64_t SafepointClock(void)
+{
+#if (defined(_WIN32) && ! defined(__CYGWIN__))
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    ULARGE_INTEGER li;
+    li.LowPart = ft.dwLowDateTime;
+    li.HighPart = ft.dwHighDateTime;
+    return li.QuadPart / 10;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
 // These two functions are used for calls from outside where
-// the lock has not yet been acquired.
+// the lock has not yet been acquired.  Entering and leaving the ML heap
+// normally does not need schedLock.  The thread sets or clears inMLHeap
+// and then checks threadRequest; the main thread sets threadRequest and
+// then checks inMLHeap for each thread.  With a barrier between the write
+// and the read on each side at least one of them will see the other's
+// update.  schedLock is only needed if there is a request outstanding.
 void Processes::ThreadUseMLMemory(TaskData *taskData)
 {
+    ASSERT(! taskData->inMLHeap);
+    taskData->inMLHeap = true;
+    PMemoryBarrier();
+    if (threadRequest == 0)
+        return;
+    // There is a request outstanding.  Back off and wait for it to complete.
+    taskData->inMLHeap = false;
     // Trying to acquire the lock here may block if a GC is in progress
     schedLock.Lock();
     ThreadUseMLMemoryWithSchedLock(taskData);
@@ -910,9 +1262,23 @@ void Processes::ThreadUseMLMemory(TaskData *taskData)
 
 void Processes::ThreadReleaseMLMemory(TaskData *taskData)
 {
-    schedLock.Lock();
-    ThreadReleaseMLMemoryWithSchedLock(taskData);
-    schedLock.Unlock();
+    ASSERT(taskData->inMLHeap);
+    // Put a dummy object in any unused space.  This must be visible
+    // before the main thread can see that we have released the heap.
+    taskData->FillUnusedSpace();
+    if (threadRequest != 0)
+        taskData->safepointDelay = SafepointClock() - requestTime;
+    PMemoryBarrier();
+    taskData->inMLHeap = false;
+    PMemoryBarrier();
+    // If there is a request the main thread may be waiting for us.  The
+    // signal must be sent with schedLock held otherwise it could be lost.
+    if (threadRequest != 0)
+    {
+        schedLock.Lock();
+        initialThreadWait.Signal();
+        schedLock.Unlock();
+    }
 }
 
 // Called when a thread wants to resume using the ML heap.  That could
@@ -949,10 +1315,41 @@ void Processes::ThreadReleaseMLMemoryWithSchedLock(TaskData *taskData)
     ptaskData->FillUnusedSpace();
     //
     if (threadRequest != 0)
+    {
+        ptaskData->safepointDelay = SafepointClock() - requestTime;
         initialThreadWait.Signal();
+    }
 }
 
 
+// Called by the main thread with schedLock held once all the threads
+// have stopped.  The overall time goes into the statistics.  With thread
+// debugging on we also report which thread was the last to stop since that
+// is the one that is holding up the GC.
+void Processes::RecordSafepointTime(void)
+{
+    uint64_t total = SafepointClock() - requestTime;
+    TaskData *slowest = 0;
+    uint64_t slowestDelay = 0;
+    for (std::vector<TaskData*>::iterator i = taskArray.begin(); i != taskArray.end(); i++)
+    {
+        TaskData *p = *i;
+        if (p)
+        {
+            if (p->safepointDelay > slowestDelay)
+            {
+                slowest = p;
+                slowestDelay = p->safepointDelay;
+            }
+            p->safepointDelay = 0;
+        }
+    }
+    globalStats.recordSafepointTime(total);
+    if ((debugOptions & DEBUG_THREADS) && slowest != 0)
+        Log("THREAD: All threads stopped after %lu us.  Thread %p took %lu us\n",
+            (unsigned long)total, slowest, (unsigned long)slowestDelay);
+}
+
 // Make a request to the root thread.
 void Processes::MakeRootRequest(TaskData *taskData, MainThreadRequest *request)
 {
@@ -977,6 +1374,7 @@ void Processes::MakeRootRequest(TaskData *taskData, MainThreadRequest *request)
         }
         // Now the other requests have been dealt with (and we have schedLock).
         request->completed = false;
+        requestTime = SafepointClock();
         threadRequest = request;
         // Wait for it to complete.
         while (! request->completed)
@@ -1179,6 +1577,17 @@ void WaitHandle::Wait(unsigned maxMillisecs)
 // Unix and Cygwin: Wait for a file descriptor on input.
 void WaitInputFD::Wait(unsigned maxMillisecs)
 {
+#ifdef USE_EPOLL_REACTOR
+    if (m_waitFD >= 0)
+    {
+        struct pollfd fds;
+        fds.fd = m_waitFD;
+        fds.events = POLLIN;
+        fds.revents = 0;
+        (void)processesModule.ReactorPoll(&fds, 1, (unsigned)-1);
+        return;
+    }
+#endif
     fd_set read_fds, write_fds, except_fds;
     struct timeval toWait = { 0, 0 };
     toWait.tv_sec = maxMillisecs / 1000;
@@ -1191,6 +1600,188 @@ void WaitInputFD::Wait(unsigned maxMillisecs)
 }
 #endif
 
+#ifdef USE_EPOLL_REACTOR
+// IO reactor.  Rather than each thread blocking in its own poll or select
+// call, every descriptor that a thread waits for is added to a single epoll
+// set and the reactor thread waits on that.  Descriptors are registered
+// edge-triggered for all events and stay registered until they are closed
+// so they are never re-armed.  A thread records its interest in the table
+// before checking the descriptors with a zero-time poll so that any edge
+// after the check will find it.  Threads are woken only when a descriptor
+// they are interested in changes, when they are interrupted or killed or
+// when their time-out expires, so idle threads cost almost nothing.
+
+// Passing the wake-up through the reactor thread adds two context switches
+// so a thread first waits in poll for up to a second, as it did before there
+// was a reactor.  Only threads that are idle for longer wait in the reactor.
+// A short first wait costs more than it saves because setting the timer is
+// expensive, at least in a virtual machine.
+#define REACTOR_DIRECT_WAIT 1000
+
+// Limit on the time to wait in the reactor.  The descriptor may be closed
+// without calling ReactorWakeFD and epoll does not report that.
+#define MAX_REACTOR_WAIT 10000
+
+int Processes::ReactorPoll(struct pollfd *fds, unsigned nfds, unsigned maxMillisecs)
+{
+    // If something is ready within the first second we're done.
+    unsigned directWait = maxMillisecs < REACTOR_DIRECT_WAIT ? maxMillisecs : REACTOR_DIRECT_WAIT;
+    int result = poll(fds, nfds, directWait);
+    if (result != 0 || maxMillisecs == directWait) return result;
+    maxMillisecs -= directWait;
+
+    if (maxMillisecs > MAX_REACTOR_WAIT) maxMillisecs = MAX_REACTOR_WAIT;
+
+    bool useReactor = ! singleThreaded && StartReactor();
+    for (unsigned i = 0; useReactor && i < nfds; i++)
+    {
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fds[i].fd;
+        // EEXIST means it was registered by a previous wait.  Other errors,
+        // e.g. EPERM for a regular file, mean we can't use epoll for it.
+        if (epoll_ctl(reactorFd, EPOLL_CTL_ADD, fds[i].fd, &ev) != 0 && errno != EEXIST)
+            useReactor = false;
+    }
+    // If we can't use the reactor return and let the caller poll again.
+    if (! useReactor) return 0;
+
+    TaskData *taskData = GetTaskDataForThread();
+    ReactorWait waiter;
+    {
+        PLocker lock(&reactorLock);
+        for (unsigned i = 0; i < nfds; i++)
+        {
+            ReactorInterest interest = { &waiter, fds[i].events };
+            reactorInterests.insert(std::make_pair(fds[i].fd, interest));
+        }
+    }
+
+    result = poll(fds, nfds, 0);
+
+    reactorLock.Lock();
+    // A request made before reactorWait is set will not wake us so return if
+    // there is one.  We have already waited in poll so this does not spin if
+    // it is an interrupt that is deferred.
+    if (result == 0 && ! waiter.ready && (taskData == 0 || taskData->requests == kRequestNone))
+    {
+        if (taskData != 0)
+            taskData->reactorWait = &waiter;
+        waiter.wakeUp.WaitFor(&reactorLock, maxMillisecs);
+        if (taskData != 0)
+            taskData->reactorWait = 0;
+    }
+    for (unsigned j = 0; j < nfds; j++)
+    {
+        std::pair<ReactorInterests::iterator, ReactorInterests::iterator>
+            range = reactorInterests.equal_range(fds[j].fd);
+        for (ReactorInterests::iterator k = range.first; k != range.second; )
+        {
+            if (k->second.waiter == &waiter)
+                reactorInterests.erase(k++);
+            else ++k;
+        }
+    }
+    reactorLock.Unlock();
+
+    if (result == 0) result = poll(fds, nfds, 0);
+    return result;
+}
+
+// Wake any threads waiting for a descriptor.  Closing a descriptor removes it
+// from the epoll set without reporting an event.
+void Processes::ReactorWakeFD(int fd)
+{
+    if (singleThreaded) return;
+    PLocker lock(&reactorLock);
+    std::pair<ReactorInterests::iterator, ReactorInterests::iterator>
+        range = reactorInterests.equal_range(fd);
+    for (ReactorInterests::iterator k = range.first; k != range.second; ++k)
+    {
+        k->second.waiter->ready = true;
+        k->second.waiter->wakeUp.Signal();
+    }
+}
+
+// Create the epoll set and the reactor thread if they don't already exist.
+bool Processes::StartReactor(void)
+{
+    PLocker lock(&reactorLock);
+    if (reactorFd >= 0) return true;
+
+    reactorFd = epoll_create1(EPOLL_CLOEXEC);
+    if (reactorFd < 0) return false;
+
+    // Block all signals in the reactor thread.  They are handled by the ML
+    // threads and the signal detection thread.
+    sigset_t allSigs, oldSigs;
+    sigfillset(&allSigs);
+    pthread_sigmask(SIG_SETMASK, &allSigs, &oldSigs);
+    pthread_attr_t attrs;
+    pthread_attr_init(&attrs);
+    pthread_attr_setdetachstate(&attrs, PTHREAD_CREATE_DETACHED);
+    pthread_t reactorThreadId;
+    bool isError = pthread_create(&reactorThreadId, &attrs, ReactorThread, this) != 0;
+    pthread_attr_destroy(&attrs);
+    pthread_sigmask(SIG_SETMASK, &oldSigs, NULL);
+
+    if (isError)
+    {
+        close(reactorFd);
+        reactorFd = -1;
+        return false;
+    }
+    if (debugOptions & DEBUG_THREADS)
+        Log("THREAD: Started IO reactor thread\n");
+    return true;
+}
+
+void *Processes::ReactorThread(void *arg)
+{
+    ((Processes*)arg)->ReactorLoop();
+    return 0;
+}
+
+void Processes::ReactorLoop(void)
+{
+    struct epoll_event events[64];
+    while (true)
+    {
+        int n = epoll_wait(reactorFd, events, sizeof(events)/sizeof(events[0]), -1);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            // Threads will now only be woken when their time-outs expire.
+            if (debugOptions & DEBUG_THREADS)
+                Log("THREAD: IO reactor failed - error %d\n", errno);
+            return;
+        }
+        PLocker lock(&reactorLock);
+        for (int i = 0; i < n; i++)
+        {
+            // Convert the epoll events into the poll events that they satisfy.
+            // An error or hang-up satisfies any request.
+            uint32_t ev = events[i].events;
+            short pollEvents = 0;
+            if (ev & (EPOLLIN | EPOLLRDHUP)) pollEvents |= POLLIN;
+            if (ev & EPOLLOUT) pollEvents |= POLLOUT;
+            if (ev & EPOLLPRI) pollEvents |= POLLPRI;
+            if (ev & (EPOLLERR | EPOLLHUP)) pollEvents = -1;
+            std::pair<ReactorInterests::iterator, ReactorInterests::iterator>
+                range = reactorInterests.equal_range(events[i].data.fd);
+            for (ReactorInterests::iterator k = range.first; k != range.second; ++k)
+            {
+                if (k->second.events & pollEvents)
+                {
+                    k->second.waiter->ready = true;
+                    k->second.waiter->wakeUp.Signal();
+                }
+            }
+        }
+    }
+}
+#endif
+
 // Get the task data for the current thread.  This is held in
 // thread-local storage.  Normally this is passed in taskData but
 // in a few cases this isn't available.
@@ -1434,6 +2025,9 @@ void Processes::BeginRootThread(PolyObject *rootFunction)
     // We only release schedLock while waiting.
     while (1)
     {
+        // Threads may clear or set inMLHeap without schedLock so make
+        // sure they see any request before we look at them.
+        PMemoryBarrier();
         // Look at the threads to see if they are running.
         bool allStopped = true;
         bool noUserThreads = true;
@@ -1479,6 +2073,7 @@ void Processes::BeginRootThread(PolyObject *rootFunction)
 
         if (allStopped && threadRequest != 0)
         {
+            RecordSafepointTime();
             mainThreadPhase = threadRequest->mtp;
             gMem.ProtectImmutable(false); // GC, sharing and export may all write to the immutable area
             threadRequest->Perform();
@@ -1486,6 +2081,10 @@ void Processes::BeginRootThread(PolyObject *rootFunction)
             mainThreadPhase = MTP_USER_CODE;
             threadRequest->completed = true;
             threadRequest = 0; // Allow a new request.
+#ifdef USE_FUTEX_MUTEX
+            // Mutexes may have moved so wake any threads blocked on them.
+            WakeAllParkingSlots();
+#endif
             mlThreadWait.Signal();
         }
 
@@ -2091,7 +2690,19 @@ void Processes::GarbageCollect(ScanAddress *process)
     for (std::vector<TaskData*>::iterator i = taskArray.begin(); i != taskArray.end(); i++)
     {
         if (*i)
+        {
             (*i)->GarbageCollect(process);
+            // If the thread is running a fiber its own stack is suspended.
+            if ((*i)->currentFiber != 0)
+                machineDependent->ScanFiberStack(process, (*i)->ownFiber);
+        }
+    }
+    // Suspended fibers.  Running fibers are the current stacks of threads.
+    for (std::vector<FiberState*>::iterator j = fiberTable.begin(); j != fiberTable.end(); j++)
+    {
+        FiberState *fiber = *j;
+        if (fiber != 0 && fiber->stack != 0 && ! fiber->running)
+            machineDependent->ScanFiberStack(process, fiber);
     }
 }
 
@@ -62,6 +62,13 @@ typedef void *HANDLE;
 #include <pthread.h>
 #endif
 
+#if (defined(__linux__) && defined(HAVE_LIBPTHREAD) && defined(HAVE_PTHREAD_H) && defined(HAVE_POLL_H))
+// On Linux threads waiting for IO are woken by a single epoll reactor thread.
+#define USE_EPOLL_REACTOR 1
+struct pollfd;
+class ReactorWait;
+#endif
+
 // SIGNALCONTEXT is the argument type that is passed to GetPCandSPFromContext
 // to get the actual PC and SP in a profiling trap.
 #if defined(HAVE_WINDOWS_H)
@@ -101,6 +108,20 @@ typedef enum {
     kRequestKill = 2
 } ThreadRequests;
 
+// Saved state of a fiber: a separate ML stack that a thread can switch to
+// and from within an RTS call.  While a fiber is suspended the machine-dependent
+// code keeps its stack pointer, exception handler and program counter here.
+class FiberState {
+public:
+    FiberState(): stack(0), stackPtr(0), handler(0), pc(0), started(false), running(false) {}
+    StackSpace  *stack;     // The stack.  Zero if the fiber has terminated.
+    PolyWord    *stackPtr;  // Saved stack pointer.
+    PolyWord    *handler;   // Saved exception handler.
+    POLYCODEPTR pc;         // Saved program counter (interpreter only)
+    bool        started;    // False until it has first been switched to.
+    bool        running;    // True while some thread is running on this stack.
+};
+
 // Per-thread data.  This is subclassed for each architecture.
 class TaskData {
 public:
@@ -133,6 +154,14 @@ public:
     virtual void CopyStackFrame(StackObject *old_stack, uintptr_t old_length,
                                 StackObject *new_stack, uintptr_t new_length) = 0;
 
+    // Fibers.  Initialise a new fiber stack so that switching to it calls the closure
+    // with a unit argument.  Save the state of the current stack, which must be the
+    // one that made the RTS call, and load the state of another.  LoadFiberState
+    // returns the value to be returned from the RTS call.
+    virtual void InitFiberStack(FiberState *fiber, PolyObject *closure) = 0;
+    virtual void SaveFiberState(FiberState *fiber) = 0;
+    virtual POLYUNSIGNED LoadFiberState(FiberState *fiber) = 0;
+
 
     virtual uintptr_t currentStackSpace(void) const = 0;
     // Add a count to the local function if we are using store profiling.
@@ -153,6 +182,9 @@ public:
     void        *signalStack;  // Stack to handle interrupts (Unix only)
     PolyWord    foreignStack;   // Stack of saved data used in call_sym_and_convert
     bool        inML;          // True when this is in ML, false in the RTS
+    // When the thread is running a fiber currentFiber points to it and
+    // ownFiber holds the state of the thread's original stack.
+    FiberState  *ownFiber, *currentFiber;
 
     // Get a TaskData pointer given the ML taskId.
     // This is called at the start of every RTS function that may allocate memory.
@@ -171,10 +203,18 @@ private:
     ThreadRequests requests;
     // Pointer to the mutex when blocked. Set to NULL when it doesn't apply.
     PolyObject *blockMutex;
+#ifdef USE_EPOLL_REACTOR
+    // Set while the thread is waiting in the IO reactor.  Protected by the reactor lock.
+    ReactorWait *reactorWait;
+#endif
     // This is set to false when a thread blocks or enters foreign code,
     // While it is true the thread can manipulate ML memory so no other
-    // thread can garbage collect.
-    bool inMLHeap;
+    // thread can garbage collect.  The owning thread may change it without
+    // holding schedLock.
+    volatile bool inMLHeap;
+    // Time in microseconds from a stop-the-world request being made until this
+    // thread released the ML heap.  Zero if it was not in the heap.
+    uint64_t safepointDelay;
 
     // In Linux, at least, we need to run a separate timer in each thread
     bool runningProfileTimer;
@@ -219,6 +259,7 @@ extern enum _mainThreadPhase {
     MTP_CYGWINSPAWN,
     MTP_STOREMODULE,
     MTP_LOADMODULE,
+    MTP_HEAPSNAPSHOT,
     MTP_MAXENTRY
 } mainThreadPhase;
 
@@ -251,6 +292,10 @@ class PLock;
 // in Windows.
 // During a call to Waiter::Wait the thread is set as "not using ML memory"
 // so a GC can happen while this thread is blocked.
+// On Linux the waiters for descriptors use the IO reactor instead of select
+// or poll.  A thread waiting there is woken when another thread interrupts
+// or kills it so these ignore the time limit from ThreadPauseForIO and wait
+// until the descriptor is ready or their own time-out expires.
 class Waiter
 {
 public:
@@ -348,6 +393,16 @@ public:
     // After a Unix fork we only have a single thread in the new process.
     virtual void SetSingleThreaded(void) = 0;
 
+#ifdef USE_EPOLL_REACTOR
+    // Linux: The same as poll except that rather than blocking in poll the
+    // thread sleeps until the IO reactor reports that one of the descriptors
+    // may be ready.  It may return zero before maxMillisecs, which can be
+    // (unsigned)-1, has expired so the caller must be prepared to wait again.
+    virtual int ReactorPoll(struct pollfd *fds, unsigned nfds, unsigned maxMillisecs) = 0;
+    // Wake any threads waiting for the descriptor.  Called after closing it.
+    virtual void ReactorWakeFD(int fd) = 0;
+#endif
+
     virtual poly_exn* GetInterrupt(void) = 0;
 };
 
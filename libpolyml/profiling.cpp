@@ -29,6 +29,10 @@
 #error "No configuration file"
 #endif
 
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
 #ifdef HAVE_STDLIB_H
 #include <stdlib.h>
 #endif
@@ -44,6 +48,9 @@
 #define ASSERT(x) 0
 #endif
 
+#include <vector>
+#include <algorithm>
+
 #include "globals.h"
 #include "arb.h"
 #include "processes.h"
@@ -57,6 +64,7 @@
 #include "run_time.h"
 #include "sys.h"
 #include "rtsentry.h"
+#include "mpoly.h"
 
 extern "C" {
     POLYEXTERNALSYMBOL POLYUNSIGNED PolyProfiling(PolyObject *threadId, PolyWord mode);
@@ -79,7 +87,8 @@ static const char* const mainThreadText[MTP_MAXENTRY] =
     "Setting signal handler",
     "Cygwin spawn",
     "Storing module",
-    "Loading module"
+    "Loading module",
+    "Heap snapshot"
 };
 
 // Entries for store profiling
@@ -90,6 +99,10 @@ enum _extraStore {
     EST_WORD,
     EST_MUTABLE,
     EST_MUTABLEBYTE,
+    EST_RETAINED_PERMANENT,
+    EST_RETAINED_THREADS,
+    EST_RETAINED_RTS,
+    EST_RETAINED_UNKNOWN,
     EST_MAX_ENTRY
 };
 
@@ -101,7 +114,11 @@ static const char * const extraStoreText[EST_MAX_ENTRY] =
     "Byte data (long precision ints etc)",
     "Unidentified word data",
     "Unidentified mutable data",
-    "Mutable byte data (profiling counts)"
+    "Mutable byte data (profiling counts)",
+    "Retained by permanent data",
+    "Retained by thread stacks and handles",
+    "Retained by other run-time system data",
+    "Retained (origin unknown)"
 };
 
 // Poly strings for "standard" counts.  These are generated from the C strings
@@ -109,6 +126,7 @@ static const char * const extraStoreText[EST_MAX_ENTRY] =
 static PolyWord psRTSString[MTP_MAXENTRY], psExtraStrings[EST_MAX_ENTRY], psGCTotal;
 
 ProfileMode profileMode;
+POLYUNSIGNED instructionCounts[256];
 // If we are just profiling a single thread, this is the thread data.
 static TaskData *singleThreadProfile = 0;
 
@@ -160,7 +178,7 @@ static PLock countLock;
 
 // Get the profile object associated with a piece of code.  Returns null if
 // there isn't one, in particular if this is in the old format.
-static PolyObject *getProfileObjectForCode(PolyObject *code)
+PolyObject *getProfileObjectForCode(PolyObject *code)
 {
     ASSERT(code->IsCodeObject());
     PolyWord *consts;
@@ -412,6 +430,59 @@ void AddObjectProfile(PolyObject *obj)
     else extraStoreCounts[EST_WORD] += length+1;
 }
 
+// Retained-size profiling.  This is called from the GC mark phase for each
+// object as it is marked.  The object is charged to its own allocation profile
+// counter if it has one, otherwise to the counter of the object from which
+// it was reached.  That counter is returned and is used for anything reached
+// from this object.  The result is approximate: if an object is reachable from
+// several places it is charged to whichever path the mark phase took first.
+// As with AddObjectProfile the counts are not locked and the parallel GC
+// threads may occasionally lose an update.
+POLYUNSIGNED *AddRetainedProfile(PolyObject *obj, POLYUNSIGNED *owner)
+{
+    POLYUNSIGNED length = obj->Length();
+    if (obj->IsWordObject() && OBJ_HAS_PROFILE(obj->LengthWord()))
+    {
+        ASSERT(length != 0);
+        PolyWord profWord = obj->Get(length-1);
+        ASSERT(profWord.IsDataPtr());
+        PolyObject *profObject = profWord.AsObjPtr();
+        ASSERT(profObject->IsMutable() && profObject->IsByteObject() && profObject->Length() == 1);
+        owner = (POLYUNSIGNED*)profObject;
+    }
+    if (owner != 0)
+        *owner += length + 1;
+    return owner;
+}
+
+POLYUNSIGNED *RetainedRootCounter(RetainedRoot root)
+{
+    return &extraStoreCounts[EST_RETAINED_PERMANENT + root];
+}
+
+// Print the number of times each instruction was executed, most frequent
+// first, and reset the counts.  The counts for each function are returned
+// in the usual way.  Opcode values are in int_opcodes.h.
+static void printInstructionCounts(void)
+{
+    std::vector<std::pair<POLYUNSIGNED, unsigned> > counts;
+    POLYUNSIGNED total = 0;
+    for (unsigned i = 0; i < 256; i++)
+    {
+        if (instructionCounts[i] != 0)
+        {
+            counts.push_back(std::pair<POLYUNSIGNED, unsigned>(instructionCounts[i], i));
+            total += instructionCounts[i];
+            instructionCounts[i] = 0;
+        }
+    }
+    if (total == 0) return;
+    std::sort(counts.begin(), counts.end(), std::greater<std::pair<POLYUNSIGNED, unsigned> >());
+    fprintf(polyStderr, "Instructions: %" POLYUFMT " in total\n", total);
+    for (std::vector<std::pair<POLYUNSIGNED, unsigned> >::iterator i = counts.begin(); i != counts.end(); i++)
+        fprintf(polyStderr, "0x%02x %12" POLYUFMT " %5.2f%%\n", i->second, i->first, (double)i->first * 100.0 / (double)total);
+}
+
 // Called from ML to control profiling.
 static Handle profilerc(TaskData *taskData, Handle mode_handle)
 /* Profiler - generates statistical profiles of the code.
@@ -421,7 +492,10 @@ static Handle profilerc(TaskData *taskData, Handle mode_handle)
    If the parameter is 0 this is all it does, 
    if the parameter is 1 then it produces time profiling,
    if the parameter is 2 it produces store profiling.
-   3 - arbitrary precision emulation traps. */
+   3 - arbitrary precision emulation traps.
+   4, 5 and 8 - live data, live mutable data and retained size at the next
+   full GC.
+   9 - byte code instructions executed by the interpreter. */
 {
     unsigned mode = get_C_unsigned(taskData, mode_handle->Word());
     {
@@ -485,6 +559,8 @@ void ProfileRequest::Perform()
     {
     case kProfileOff:
         // Turn off old profiling mechanism and print out accumulated results 
+        if (profileMode == kProfileInstructions)
+            printInstructionCounts();
         profileMode = kProfileOff;
         processes->StopProfiling();
         getResults();
@@ -520,6 +596,15 @@ void ProfileRequest::Perform()
     case kProfileMutexContention:
         profileMode = kProfileMutexContention;
         break;
+
+    case kProfileLiveRetained:
+        profileMode = kProfileLiveRetained;
+        break;
+
+    case kProfileInstructions:
+        for (unsigned i = 0; i < 256; i++) instructionCounts[i] = 0;
+        profileMode = kProfileInstructions;
+        break;
        
     default: /* do nothing */
         break;
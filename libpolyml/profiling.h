@@ -36,9 +36,20 @@ typedef enum {
     kProfileLiveData,
     kProfileLiveMutables,
     kProfileTimeThread,
-    kProfileMutexContention
+    kProfileMutexContention,
+    kProfileLiveRetained,
+    kProfileInstructions // Interpreted code only
 } ProfileMode;
 
+// Root categories for retained-size profiling.  Objects that are not reached
+// through a cell with an allocation profile pointer are charged to these.
+typedef enum {
+    RETAINED_BY_PERMANENT = 0,  // Permanent mutable data e.g. top-level refs
+    RETAINED_BY_THREADS,        // Thread stacks and handles
+    RETAINED_BY_RTS,            // Other run-time system data
+    RETAINED_BY_UNKNOWN         // Lost track after mark-stack overflow
+} RetainedRoot;
+
 extern ProfileMode profileMode;
 
 #include "processes.h" // For SIGNALCONTEXT
@@ -46,6 +57,12 @@ extern ProfileMode profileMode;
 extern void handleProfileTrap(TaskData *taskData, SIGNALCONTEXT *context);
 extern void add_count(TaskData *taskData, POLYCODEPTR pc,POLYUNSIGNED incr);
 extern void AddObjectProfile(PolyObject *obj);
+extern PolyObject *getProfileObjectForCode(PolyObject *code);
+extern POLYUNSIGNED *RetainedRootCounter(RetainedRoot root);
+extern POLYUNSIGNED *AddRetainedProfile(PolyObject *obj, POLYUNSIGNED *owner);
+
+// Counts of each byte code instruction executed, used for instruction profiling.
+extern POLYUNSIGNED instructionCounts[256];
 
 extern struct _entrypts profilingEPT[];
 
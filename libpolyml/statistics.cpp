@@ -161,6 +161,7 @@ Statistics::Statistics(): accessLock("Statistics")
     memset(&gcUserTime, 0, sizeof(gcUserTime));
     memset(&gcSystemTime, 0, sizeof(gcSystemTime));
     memset(&gcRealTime, 0, sizeof(gcRealTime));
+    safepointMax = safepointTotal = 0;
 
 #ifdef HAVE_WINDOWS_H
     // File mapping handle
@@ -276,6 +277,9 @@ void Statistics::Init()
     addTime(PST_GC_STIME, POLY_STATS_ID_GC_STIME, "GCSystemTime");
     addTime(PST_NONGC_RTIME, POLY_STATS_ID_NONGC_RTIME, "NonGCRealTime");
     addTime(PST_GC_RTIME, POLY_STATS_ID_GC_RTIME, "GCRealTime");
+    addTime(PST_SAFEPOINT_LAST_RTIME, POLY_STATS_ID_SAFEPOINT_LAST_RTIME, "SafepointLastRealTime");
+    addTime(PST_SAFEPOINT_MAX_RTIME, POLY_STATS_ID_SAFEPOINT_MAX_RTIME, "SafepointMaxRealTime");
+    addTime(PST_SAFEPOINT_TOTAL_RTIME, POLY_STATS_ID_SAFEPOINT_TOTAL_RTIME, "SafepointTotalRealTime");
 
     addUser(0, POLY_STATS_ID_USER0, "UserCounter0");
     addUser(1, POLY_STATS_ID_USER1, "UserCounter1");
@@ -555,6 +559,16 @@ void Statistics::setTimeValue(int which, unsigned long secs, unsigned long usecs
     }
 }
 
+// Called by the main thread when all the threads have stopped.
+void Statistics::recordSafepointTime(uint64_t usecs)
+{
+    if (usecs > safepointMax) safepointMax = usecs;
+    safepointTotal += usecs;
+    setTimeValue(PST_SAFEPOINT_LAST_RTIME, (unsigned long)(usecs / 1000000), (unsigned long)(usecs % 1000000));
+    setTimeValue(PST_SAFEPOINT_MAX_RTIME, (unsigned long)(safepointMax / 1000000), (unsigned long)(safepointMax % 1000000));
+    setTimeValue(PST_SAFEPOINT_TOTAL_RTIME, (unsigned long)(safepointTotal / 1000000), (unsigned long)(safepointTotal % 1000000));
+}
+
 #if (defined(_WIN32) && ! defined(__CYGWIN__))
 // Native Windows
 void Statistics::copyGCTimes(const FILETIME &gcUtime, const FILETIME &gcStime, const FILETIME &gcRtime)
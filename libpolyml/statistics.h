@@ -59,6 +59,9 @@ enum {
     PST_GC_STIME,
     PST_NONGC_RTIME,
     PST_GC_RTIME,
+    PST_SAFEPOINT_LAST_RTIME,
+    PST_SAFEPOINT_MAX_RTIME,
+    PST_SAFEPOINT_TOTAL_RTIME,
     N_PS_TIMES
 };
 
@@ -90,6 +93,10 @@ public:
 
     void setUserCounter(unsigned which, POLYSIGNED value);
 
+    // Record the time in microseconds that it took for all threads to stop
+    // for a GC or other request.
+    void recordSafepointTime(uint64_t usecs);
+
 #if (defined(_WIN32) && ! defined(__CYGWIN__))
     // Native Windows
     void copyGCTimes(const FILETIME &gcUtime, const FILETIME &gcStime, const FILETIME &gcRtime);
@@ -127,6 +134,8 @@ private:
     void addTime(int cEnum, unsigned statId, const char *name);
     void addUser(int n, unsigned statId, const char *name);
 
+    uint64_t safepointMax, safepointTotal;
+
     size_t getSizeWithLock(int which);
     void setSizeWithLock(int which, size_t s);
     void setTimeValue(int which, unsigned long secs, unsigned long usecs);
@@ -115,6 +115,9 @@
 #include <signal.h>
 #endif
 
+// posix_spawn is part of POSIX.1-2001 and is provided on all the Unix systems we support.
+#include <spawn.h>
+
 #include "globals.h"
 #include "arb.h"
 #include "run_time.h"
@@ -141,6 +144,14 @@ extern "C" {
 #define ALLOC(n) alloc_and_save(taskData, n)
 #define SIZEOF(x) (sizeof(x)/sizeof(PolyWord))
 
+// "environ" is declared in the headers on some systems but not all.
+#if __APPLE__
+#include <crt_externs.h>
+#define environ (*_NSGetEnviron())
+#else
+extern char **environ;
+#endif
+
 /* Table of constants returned by call 4. */
 // This is currently unsigned because that's necessary on the PowerPC for
 // NOFLUSH.  Perhaps there should be separate tables for different kinds
@@ -390,6 +401,30 @@ static void restoreSignals(void)
     sigprocmask(SIG_SETMASK, &sigset, NULL);
 }
 
+// The file actions and attributes for posix_spawn.  These are destroyed
+// if an exception is raised while the actions are being added.
+class SpawnAttributes
+{
+public:
+    SpawnAttributes()
+    {
+        posix_spawn_file_actions_init(&actions);
+        posix_spawnattr_init(&attr);
+        // Unmask all signals in the child as restoreSignals does before exec.
+        sigset_t sigset;
+        sigemptyset(&sigset);
+        posix_spawnattr_setsigmask(&attr, &sigset);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+    }
+    ~SpawnAttributes()
+    {
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+};
+
 Handle OS_spec_dispatch_c(TaskData *taskData, Handle args, Handle code)
 {
     unsigned lastSigCount = receivedSignalCount; // Have we received a signal?
@@ -1163,6 +1198,41 @@ Handle OS_spec_dispatch_c(TaskData *taskData, Handle args, Handle code)
                 raise_syscall(taskData, "tcsetpgrp failed", errno);
             return Make_fixed_precision(taskData, 0);
         }
+
+    case 158: /* Start a new process without forking this one.  The arguments are the
+                 path, the argument list, whether to pass the environment list or
+                 to inherit ours, the environment list, a list of file actions and
+                 whether to search PATH.  Each file action is (0, new, old) for dup2
+                 or (1, fd, fd) for close. */
+        {
+            SpawnAttributes spawnAttrs;
+            for (PolyWord p = DEREFHANDLE(args)->Get(4); !ML_Cons_Cell::IsNull(p); p = ((ML_Cons_Cell*)p.AsObjPtr())->t)
+            {
+                PolyObject *action = ((ML_Cons_Cell*)p.AsObjPtr())->h.AsObjPtr();
+                int fd = getStreamFileDescriptor(taskData, action->Get(1));
+                int err;
+                if (get_C_long(taskData, action->Get(0)) == 0)
+                    err = posix_spawn_file_actions_adddup2(&spawnAttrs.actions,
+                            getStreamFileDescriptor(taskData, action->Get(2)), fd);
+                else err = posix_spawn_file_actions_addclose(&spawnAttrs.actions, fd);
+                if (err != 0) raise_syscall(taskData, "posix_spawn failed", err);
+            }
+            bool useEnv = get_C_unsigned(taskData, DEREFHANDLE(args)->Get(2)) != 0;
+            bool search = get_C_unsigned(taskData, DEREFHANDLE(args)->Get(5)) != 0;
+            char *path = Poly_string_to_C_alloc(DEREFHANDLE(args)->Get(0));
+            char **argl = stringListToVector(SAVE(DEREFHANDLE(args)->Get(1)));
+            char **envl = useEnv ? stringListToVector(SAVE(DEREFHANDLE(args)->Get(3))) : 0;
+            pid_t pid;
+            int err;
+            if (search)
+                err = posix_spawnp(&pid, path, &spawnAttrs.actions, &spawnAttrs.attr, argl, useEnv ? envl : environ);
+            else err = posix_spawn(&pid, path, &spawnAttrs.actions, &spawnAttrs.attr, argl, useEnv ? envl : environ);
+            free(path);
+            freeStringVector(argl);
+            if (envl) freeStringVector(envl);
+            if (err != 0) raise_syscall(taskData, "posix_spawn failed", err);
+            return Make_fixed_precision(taskData, pid);
+        }
     
     default:
         {
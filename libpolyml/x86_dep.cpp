@@ -221,7 +221,7 @@ public:
     int saveRegisterMask; // Registers that need to be updated by a GC.
 
     virtual void GarbageCollect(ScanAddress *process);
-    void ScanStackAddress(ScanAddress *process, stackItem &val, StackSpace *stack);
+    static void ScanStackAddress(ScanAddress *process, stackItem &val, StackSpace *stack);
     virtual Handle EnterPolyCode(); // Start running ML
     virtual void InterruptCode();
     virtual bool AddTimeProfileCount(SIGNALCONTEXT *context);
@@ -252,6 +252,10 @@ public:
 
     virtual Handle EnterCallbackFunction(Handle func, Handle args);
 
+    virtual void InitFiberStack(FiberState *fiber, PolyObject *closure);
+    virtual void SaveFiberState(FiberState *fiber);
+    virtual POLYUNSIGNED LoadFiberState(FiberState *fiber);
+
     int SwitchToPoly();
 
     void HeapOverflowTrap(byte *pcPtr);
@@ -302,6 +306,8 @@ public:
     virtual unsigned InitialStackSize(void) { return (128+OVERFLOW_STACK_SIZE) * sizeof(uintptr_t) / sizeof(PolyWord); }
     virtual void ScanConstantsWithinCode(PolyObject *addr, PolyObject *oldAddr, POLYUNSIGNED length, ScanAddress *process);
 
+    virtual void ScanFiberStack(ScanAddress *process, FiberState *fiber);
+
     virtual Architectures MachineArchitecture(void)
 #ifndef HOSTARCHITECTURE_X86_64
          { return MA_I386; }
@@ -746,6 +752,61 @@ void X86TaskData::InitStackFrame(TaskData *parentTaskData, Handle proc, Handle a
 #endif
 }
 
+// Set up a fiber stack in the same way as InitStackFrame.  When the RTS call that
+// switches to it returns it "returns" to X86AsmPopArgAndClosure which enters the closure.
+void X86TaskData::InitFiberStack(FiberState *fiber, PolyObject *closure)
+{
+    // The trampolines will have been set up when the first thread was created.
+    ASSERT(popArgAndClosure != 0 && killSelf != 0);
+    StackSpace *space = fiber->stack;
+    uintptr_t stack_size = space->spaceSize() * sizeof(PolyWord) / sizeof(stackItem);
+    uintptr_t topStack = stack_size-6;
+    stackItem *stackTop = (stackItem*)space->stack() + topStack;
+    stackTop[0].codeAddr = popArgAndClosure;
+    stackTop[1] = PolyWord(closure);
+    stackTop[2] = TAGGED(0); // Unit argument
+    stackTop[3].codeAddr = killSelf;
+    stackTop[4].codeAddr = killSelf;
+    stackTop[5] = TAGGED(0);
+    fiber->stackPtr = (PolyWord*)stackTop;
+    fiber->handler = (PolyWord*)(stackTop+4);
+    fiber->started = false;
+}
+
+// Called within an RTS call.  The ML stack pointer has been saved by the
+// RTS call sequence and is reloaded from assemblyInterface on return.
+void X86TaskData::SaveFiberState(FiberState *fiber)
+{
+    fiber->stack = this->stack;
+    fiber->stackPtr = (PolyWord*)assemblyInterface.stackPtr;
+    fiber->handler = (PolyWord*)assemblyInterface.handlerRegister;
+    fiber->started = true;
+}
+
+POLYUNSIGNED X86TaskData::LoadFiberState(FiberState *fiber)
+{
+    {
+        // InterruptCode sets the stack limit using the current stack so we
+        // need the lock.  Preserve any pending interrupt.
+        PLocker l(&interruptLock);
+        bool interruptPending = this->assemblyInterface.stackLimit == (stackItem*)(this->stack->top-1);
+        this->stack = fiber->stack;
+        if (interruptPending)
+            this->assemblyInterface.stackLimit = (stackItem*)(this->stack->top-1);
+        else this->assemblyInterface.stackLimit = (stackItem*)this->stack->bottom + OVERFLOW_STACK_SIZE;
+    }
+    assemblyInterface.stackPtr = (stackItem*)fiber->stackPtr;
+    assemblyInterface.handlerRegister = (stackItem*)fiber->handler;
+    fiber->started = true;
+    return TAGGED(0).AsUnsigned();
+}
+
+void X86Dependent::ScanFiberStack(ScanAddress *process, FiberState *fiber)
+{
+    for (stackItem *q = (stackItem*)fiber->stackPtr; q < (stackItem*)fiber->stack->top; q++)
+        X86TaskData::ScanStackAddress(process, *q, fiber->stack);
+}
+
 // In Solaris-x86 the registers are named EIP and ESP.
 #if (!defined(REG_EIP) && defined(EIP))
 #define REG_EIP EIP
@@ -0,0 +1,63 @@
+/*
+    Title:  polyheapsnapshot.h - Layout of a heap snapshot file
+    Copyright (c) 2019 David C.J. Matthews
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License version 2.1 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifndef POLY_HEAPSNAPSHOT_INCLUDED
+#define POLY_HEAPSNAPSHOT_INCLUDED
+
+// A heap snapshot is written by PolyML.heapSnapshot and read by the
+// PolyHeap analyser.  It is a stream of records written in the native
+// byte order of the machine that wrote it.  The file begins with the eight
+// byte magic string followed by three 32-bit values: the version, the size
+// in bytes of a "word" in the rest of the file (the size of an address) and
+// the size of a length word (smaller than an address in 32-in-64).
+// Each subsequent record begins with a single tag byte.
+#define POLY_SNAP_MAGIC         "POLYHEAP"
+#define POLY_SNAP_VERSION       1
+
+// A root of the graph.  Followed by the address of the object (word).
+// The permanent mutable areas, thread stacks and the other RTS roots
+// are all reported as roots.
+#define POLY_SNAP_ROOT          'R'
+// An object.  Followed by the address (word), the length word (word),
+// the number of addresses in it (word) and then the addresses (word each).
+// Every object is reported exactly once.
+#define POLY_SNAP_OBJECT        'O'
+// The name of a code object.  Followed by the address of the code (word),
+// the address of its allocation profile cell or zero (word), the length of
+// the name in bytes (word) and the bytes of the name.  Objects created with
+// allocation profiling enabled have the profile cell as their last word so
+// this can be used to find the allocating function.
+#define POLY_SNAP_CODENAME      'N'
+// End of the snapshot.  No further data.
+#define POLY_SNAP_END           'E'
+
+// Bits in the length word.  These match the definitions in globals.h.
+// The flags are held in the top byte of the length word.
+#define POLY_SNAP_LENGTH_MASK(lengthSize)  ((((uint64_t)1) << ((lengthSize)*8-8)) - 1)
+#define POLY_SNAP_FLAGS(lengthWord, lengthSize) ((unsigned)((lengthWord) >> ((lengthSize)*8-8)) & 0xff)
+#define POLY_SNAP_F_TYPE_MASK   0x03
+#define POLY_SNAP_F_BYTE        0x01
+#define POLY_SNAP_F_CODE        0x02
+#define POLY_SNAP_F_CLOSURE     0x03
+#define POLY_SNAP_F_NEGATIVE    0x10
+#define POLY_SNAP_F_PROFILE     0x10
+#define POLY_SNAP_F_WEAK        0x20
+#define POLY_SNAP_F_MUTABLE     0x40
+
+#endif
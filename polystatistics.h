@@ -77,6 +77,9 @@
 #define POLY_STATS_ID_GC_SHARING             28     // Number of sharing passes
 #define POLY_STATS_ID_CODE_SPACE             29     // Space occupied by code
 #define POLY_STATS_ID_STACK_SPACE            30     // Space occupied by stacks
+#define POLY_STATS_ID_SAFEPOINT_LAST_RTIME   31     // Time for threads to stop for the last GC or other request
+#define POLY_STATS_ID_SAFEPOINT_MAX_RTIME    32     // Longest time for threads to stop
+#define POLY_STATS_ID_SAFEPOINT_TOTAL_RTIME  33     // Total time waiting for threads to stop
 
 
 #endif // POLY_STATISTICS_INCLUDED